@@ -0,0 +1,119 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Bump allocator. Memory is carved out of 64 KB blocks and released only
+// all at once, when the arena is destroyed. An allocation larger than a
+// quarter block gets a block of its own, so that it does not waste the
+// rest of the current one. memoryUsage() counts whole blocks, which is
+// what the arena actually holds.
+class Arena {
+    static constexpr size_t ARENA_BLOCK = 64 << 10;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* ptr = nullptr;
+    size_t remaining = 0;
+    size_t usage = 0;
+
+    char* newBlock(size_t bytes) {
+        blocks.emplace_back(new char[bytes]);
+        usage += bytes;
+        return blocks.back().get();
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // `align` must be a power of two no larger than alignof(max_align_t).
+    char* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        size_t pad = (0 - (uintptr_t)ptr) & (align - 1);
+        if (pad + bytes > remaining) {
+            if (bytes > ARENA_BLOCK / 4) return newBlock(bytes);
+            ptr = newBlock(ARENA_BLOCK);
+            remaining = ARENA_BLOCK;
+            pad = 0;
+        }
+        char* res = ptr + pad;
+        ptr += pad + bytes;
+        remaining -= pad + bytes;
+        return res;
+    }
+
+    size_t memoryUsage() const { return usage; }
+};
+
+// Arena shared by several threads, with the same block policy as Arena.
+// Threads bump the current block's offset with a CAS; the lock is taken
+// only to install a new block or to hand out a dedicated one.
+// memoryUsage() takes no lock either.
+class ConcurrentArena {
+    static constexpr size_t ARENA_BLOCK = 64 << 10;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::atomic<size_t> used{0};
+        explicit Block(size_t bytes) : data(new char[bytes]) {}
+    };
+
+    std::mutex mu;
+    std::vector<std::unique_ptr<Block>> blocks; // guarded by mu
+    std::atomic<Block*> current{nullptr};
+    std::atomic<size_t> usage{0};
+
+    Block* newBlock(size_t bytes) {
+        blocks.emplace_back(new Block(bytes));
+        usage.fetch_add(bytes, std::memory_order_relaxed);
+        return blocks.back().get();
+    }
+
+    // Carves `bytes` out of `b`, or returns nullptr if they do not fit.
+    static char* bump(Block* b, size_t bytes, size_t align) {
+        uintptr_t base = (uintptr_t)b->data.get();
+        size_t used = b->used.load(std::memory_order_relaxed);
+        while (true) {
+            size_t start = ((base + used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (start + bytes > ARENA_BLOCK) return nullptr;
+            if (b->used.compare_exchange_weak(used, start + bytes, std::memory_order_relaxed)) {
+                return b->data.get() + start;
+            }
+        }
+    }
+
+public:
+    ConcurrentArena() = default;
+    ConcurrentArena(const ConcurrentArena&) = delete;
+    ConcurrentArena& operator=(const ConcurrentArena&) = delete;
+
+    // `align` must be a power of two no larger than alignof(std::max_align_t).
+    char* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        if (bytes > ARENA_BLOCK / 4) {
+            std::lock_guard<std::mutex> lock(mu);
+            return newBlock(bytes)->data.get();
+        }
+        while (true) {
+            Block* b = current.load(std::memory_order_acquire);
+            if (b) {
+                if (char* res = bump(b, bytes, align)) return res;
+            }
+            std::lock_guard<std::mutex> lock(mu);
+            // Another thread may have installed a block meanwhile.
+            if (current.load(std::memory_order_relaxed) != b) continue;
+            Block* fresh = newBlock(ARENA_BLOCK);
+            char* res = bump(fresh, bytes, align);
+            current.store(fresh, std::memory_order_release);
+            return res;
+        }
+    }
+
+    size_t memoryUsage() const { return usage.load(std::memory_order_relaxed); }
+};
+
+#endif // ARENA_H
@@ -1,32 +1,158 @@
 #ifndef BPLUSTREE_H
 #define BPLUSTREE_H
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <optional>
 #include <cassert>
 #include <cstring>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <stdexcept>
 #include "BufferPool.h"
+#include "InternalNode.h"
+#include "LeafNode.h"
 #include "Page.h"
 
 class BPlusTree {
 private:
     BufferPool pool;
-    uint32_t root_id;
+    std::shared_mutex root_latch; // guards root_id changes; held until the root page is latched
+    std::atomic<uint32_t> root_id{0}; // also read without the latch by optimistic readers
 
-    struct Slot {
-        uint16_t offset;
-        uint16_t length;
-    };
+    using Slot = LeafNode::Slot;
+
+
+    static constexpr int MAX_OPTIMISTIC_RESTARTS = 8;
+
+    // Key lengths are stored in one byte.
+    static constexpr size_t MAX_KEY_SIZE = 255;
+
+    // Below a quarter full, a node is refilled from or merged with a sibling.
+    static constexpr size_t LEAF_MIN_USED = (PAGE_SIZE - sizeof(PageHeader)) / 4;
 
+    // Requires root_latch held exclusively.
     void updateMetaPage() {
-        char* meta_data = pool.getPage(0);
-        std::memcpy(meta_data, &root_id, sizeof(uint32_t));
-        pool.flushPage(0);
+        PageGuard meta = pool.fetchPageForWrite(0);
+        ((MetaPage*)meta.data())->root_id = root_id;
+        meta.markDirty();
+    }
+
+    // Bounds-checked, so it is also safe on a page read optimistically.
+    // When `high` is given it receives the separator right of the chosen
+    // child, if any; over a whole descent that leaves the leaf's exclusive
+    // upper bound (or nothing for the rightmost leaf).
+    static uint32_t childFor(const char* node_data, std::string_view key, std::optional<std::string>* high = nullptr) {
+        int i = InternalNode::find(node_data, key);
+        if (high && i + 1 < InternalNode::size(node_data)) *high = InternalNode::separator(node_data, i + 1);
+        return InternalNode::child(node_data, i);
+    }
+
+    static uint32_t overflowPages(size_t value_len) {
+        return (uint32_t)((value_len + OVERFLOW_PAYLOAD - 1) / OVERFLOW_PAYLOAD);
+    }
+
+    // Fills page `i` of the overflow run for `value` that starts at `first`.
+    // The page must be zeroed.
+    static void fillOverflowPage(char* page, uint32_t first, uint32_t i, std::string_view value) {
+        size_t begin = (size_t)i * OVERFLOW_PAYLOAD;
+        size_t n = std::min(OVERFLOW_PAYLOAD, value.size() - begin);
+        PageHeader* h = (PageHeader*)page;
+        h->page_id = first + i;
+        h->next_sibling = i + 1 < overflowPages(value.size()) ? first + i + 1 : 0;
+        h->num_slots = (uint32_t)n;
+        h->free_space_offset = PAGE_SIZE;
+        std::memcpy(page + sizeof(PageHeader), value.data() + begin, n);
+    }
+
+    // Writes `value` to a fresh overflow run and returns the OverflowRef
+    // for its leaf record. The pages are logged with the caller's
+    // transaction but not kept pinned (see BufferPool::newRun()).
+    std::string writeOverflow(std::string_view value) {
+        uint32_t first = pool.newRun(overflowPages(value.size()), [&](char* page, uint32_t run, uint32_t i) {
+            fillOverflowPage(page, run, i, value);
+        });
+        OverflowRef ref{first, (uint32_t)value.size()};
+        return std::string((const char*)&ref, sizeof(ref));
+    }
+
+    // Reads an out-of-line value back. The run is requested as one batch,
+    // then each payload is copied straight into the result. The caller
+    // keeps the referencing leaf latched so the run cannot change.
+    std::string readOverflow(std::string_view stored) {
+        OverflowRef ref;
+        std::memcpy(&ref, stored.data(), sizeof(ref));
+        std::vector<uint32_t> ids(overflowPages(ref.length));
+        std::iota(ids.begin(), ids.end(), ref.first_page);
+        pool.prefetchPages(ids);
+
+        std::string value;
+        value.reserve(ref.length);
+        for (uint32_t id : ids) {
+            PageGuard g = pool.fetchPage(id);
+            size_t n = std::min<size_t>(g.header()->num_slots, ref.length - value.size());
+            value.append(g.data() + sizeof(PageHeader), n);
+        }
+        return value;
+    }
+
+    void freeOverflow(std::string_view stored) {
+        OverflowRef ref;
+        std::memcpy(&ref, stored.data(), sizeof(ref));
+        pool.freeRun(ref.first_page, overflowPages(ref.length));
+    }
+
+    // Point lookup within a leaf. Every offset is bounds-checked so it can
+    // run on an optimistically read page; returns false if the page is not
+    // self-consistent (a writer was mid-change). `overflow` tells whether
+    // `value` holds an OverflowRef rather than the value.
+    static bool lookupLeaf(const char* page_data, std::string_view key, std::optional<std::string>& value, bool& overflow) {
+        const PageHeader* h = (const PageHeader*)page_data;
+        const Slot* slots = (const Slot*)(page_data + sizeof(PageHeader));
+        value.reset();
+        overflow = false;
+        if (h->num_slots > (PAGE_SIZE - sizeof(PageHeader)) / sizeof(Slot)) return false;
+
+        int low = 0;
+        int high = (int)h->num_slots - 1;
+        while (low <= high) {
+            int mid = low + (high - low) / 2;
+            size_t off = slots[mid].offset;
+            if (off + 3 > PAGE_SIZE) return false;
+            const char* rec = page_data + off;
+            uint8_t kLen = (uint8_t)rec[0];
+            if (LeafNode::recordSize(kLen, 0) + off > PAGE_SIZE) return false;
+            int cmp = key.compare(std::string_view(rec + 1, kLen));
+            if (cmp == 0) {
+                uint16_t field = LeafNode::valueField(rec);
+                size_t vLen = field & ~OVERFLOW_FLAG;
+                if (LeafNode::recordSize(kLen, vLen) + off > PAGE_SIZE) return false;
+                overflow = field & OVERFLOW_FLAG;
+                if (overflow && vLen != sizeof(OverflowRef)) return false;
+                value = std::string(LeafNode::storedValue(rec));
+                return true;
+            }
+            if (cmp > 0) low = mid + 1;
+            else high = mid - 1;
+        }
+        return true;
+    }
+
+    // A node is safe when the pending insert cannot split it, so nothing
+    // above it can change and its ancestors' latches may be released.
+    static bool isSafe(char* page_data, size_t entry_size) {
+        PageHeader* h = (PageHeader*)page_data;
+        if (h->is_leaf) return LeafNode::hasRoom(page_data, entry_size);
+        return InternalNode::uncompressedSize(page_data) + InternalNode::ENTRY_OVERHEAD + MAX_KEY_SIZE <= InternalNode::capacity();
     }
 
-    int findSlotBinary(char* page_data, const std::string& key) {
+    int findSlotBinary(char* page_data, std::string_view key) {
         PageHeader* h = (PageHeader*)page_data;
         Slot* slots = (Slot*)(page_data + sizeof(PageHeader));
 
@@ -36,12 +162,10 @@ private:
 
         while (low <= high) {
             int mid = low + (high - low) / 2;
-            char* record_ptr = page_data + slots[mid].offset;
-            uint8_t kLen = (uint8_t)(*record_ptr);
-            std::string current_key(record_ptr + 1, kLen);
+            int cmp = LeafNode::recordKey(page_data + slots[mid].offset).compare(key);
 
-            if (current_key == key) return mid;
-            if (current_key < key) {
+            if (cmp == 0) return mid;
+            if (cmp < 0) {
                 low = mid + 1;
             } else {
                 result_idx = mid;
@@ -51,295 +175,1410 @@ private:
         return result_idx;
     }
 
-    void defragmentPage(uint32_t page_id) {
-        char* page_data = pool.getPage(page_id);
-        PageHeader* h = (PageHeader*)page_data;
-        Slot* slots = (Slot*)(page_data + sizeof(PageHeader));
 
-        std::vector<char> temp_buffer(PAGE_SIZE, 0);
-        uint32_t current_offset = PAGE_SIZE;
-
-        for (uint32_t i = 0; i < h->num_slots; ++i) {
-            char* old_rec_ptr = page_data + slots[i].offset;
-            uint8_t kLen = (uint8_t)old_rec_ptr[0];
-            uint8_t vLen = (uint8_t)old_rec_ptr[1 + kLen];
-            uint32_t rec_size = 2 + kLen + vLen;
-
-            current_offset -= rec_size;
-            std::memcpy(temp_buffer.data() + current_offset, old_rec_ptr, rec_size);
-            slots[i].offset = (uint16_t)current_offset;
-            slots[i].length = (uint16_t)rec_size;
-        }
-
-        uint32_t data_area_start = sizeof(PageHeader) + (h->num_slots * sizeof(Slot));
-        std::memset(page_data + data_area_start, 0, PAGE_SIZE - data_area_start);
-        
-        uint32_t data_size = PAGE_SIZE - current_offset;
-        if (data_size > 0) {
-            std::memcpy(page_data + current_offset, temp_buffer.data() + current_offset, data_size);
-        }
-        h->free_space_offset = (uint16_t)current_offset;
-    }
-
-    void splitInternal(uint32_t node_id) {
-        uint32_t new_node_id = pool.allocatePage();
-        char* old_data = pool.getPage(node_id);
-        char* new_data = pool.getPage(new_node_id);
-        
-        PageHeader* old_h = (PageHeader*)old_data;
-        PageHeader* new_h = (PageHeader*)new_data;
-        new_h->is_leaf = false;
-        new_h->parent_id = old_h->parent_id;
-        new_h->num_slots = 0;
-
-        IndexEntry* old_entries = (IndexEntry*)(old_data + sizeof(PageHeader));
-        IndexEntry* new_entries = (IndexEntry*)(new_data + sizeof(PageHeader));
-        
-        uint32_t mid = old_h->num_slots / 2;
-        std::string promotion_key = old_entries[mid].key;
-
-        // Set lower_bound_child for the new node and update its parent pointer
-        new_h->lower_bound_child = old_entries[mid].child_page_id;
-        PageHeader* child_h = (PageHeader*)pool.getPage(new_h->lower_bound_child);
-        child_h->parent_id = new_node_id;
-        pool.flushPage(new_h->lower_bound_child);
-
-        // Move subsequent entries directly to avoid recursion
-        uint32_t move_count = 0;
-        for (uint32_t i = mid + 1; i < old_h->num_slots; ++i) {
-            std::memcpy(&new_entries[move_count], &old_entries[i], sizeof(IndexEntry));
-            
-            PageHeader* moved_child_h = (PageHeader*)pool.getPage(old_entries[i].child_page_id);
-            moved_child_h->parent_id = new_node_id;
-            pool.flushPage(old_entries[i].child_page_id);
-            move_count++;
-        }
-
-        new_h->num_slots = move_count;
-        old_h->num_slots = mid; 
-
-        pool.flushPage(node_id);
-        pool.flushPage(new_node_id);
-
-        if (node_id == root_id) {
-            createNewRoot(node_id, new_node_id, promotion_key);
-        } else {
-            insertIntoInternal(old_h->parent_id, promotion_key, new_node_id);
-        }
+    static bool internalUnderflows(const char* node) {
+        return InternalNode::uncompressedSize(node) < InternalNode::capacity() / 4;
     }
 
-    void insertIntoInternal(uint32_t parent_id, const std::string& key, uint32_t child_id) {
-        char* data = pool.getPage(parent_id);
-        PageHeader* h = (PageHeader*)data;
-        size_t max_entries = (PAGE_SIZE - sizeof(PageHeader)) / sizeof(IndexEntry);
+    // A node is safe for a delete when losing one entry cannot make it
+    // underflow, so nothing above it can change. A root only has to keep
+    // one separator.
+    static bool isSafeForRemove(const char* page_data, bool is_root) {
+        const PageHeader* h = (const PageHeader*)page_data;
+        if (h->is_leaf) return is_root || LeafNode::used(page_data) >= LEAF_MIN_USED + sizeof(Slot) + LeafNode::recordSize(MAX_KEY_SIZE, INLINE_VALUE_MAX);
+        if (is_root) return h->num_slots > 1;
+        return InternalNode::uncompressedSize(page_data) >= InternalNode::capacity() / 4 + InternalNode::ENTRY_OVERHEAD + MAX_KEY_SIZE;
+    }
 
-        if (h->num_slots >= max_entries) {
-            splitInternal(parent_id);
-            // After split, we would normally find which new page to insert into.
-            // For now, propagation happens via promotion.
-            return; 
-        }
+    // Slot of the record with `key`, -1 if there is none.
+    int findRecord(char* page_data, std::string_view key) {
+        int idx = findSlotBinary(page_data, key);
+        if (idx >= (int)((PageHeader*)page_data)->num_slots) return -1;
+        const Slot* slots = (const Slot*)(page_data + sizeof(PageHeader));
+        return LeafNode::recordKey(page_data + slots[idx].offset) == key ? idx : -1;
+    }
 
-        IndexEntry* entries = (IndexEntry*)(data + sizeof(PageHeader));
-        IndexEntry& new_entry = entries[h->num_slots];
-        
-        std::memset(new_entry.key, 0, 16); // Sanity check: Clear buffer
-        std::strncpy(new_entry.key, key.c_str(), 15);
-        new_entry.child_page_id = child_id;
+    // Deletes the record in slot `idx` and frees its overflow pages.
+    void eraseRecord(PageGuard& leaf, int idx) {
+        const char* rec = leaf.data() + LeafNode::slots(leaf.data())[idx].offset;
+        if (LeafNode::isOverflow(rec)) freeOverflow(LeafNode::storedValue(rec));
+        LeafNode::erase(leaf.data(), idx);
+        leaf.markDirty();
+    }
 
-        h->num_slots++;
-        pool.flushPage(parent_id);
+    static void removeSeparator(PageGuard& node, int j) {
+        std::vector<InternalNode::Entry> entries = InternalNode::entries(node.data());
+        entries.erase(entries.begin() + j);
+        InternalNode::write(node.data(), node.header()->lower_bound_child, entries, 0, entries.size());
+        node.markDirty();
     }
 
-    void createNewRoot(uint32_t left_child_id, uint32_t right_child_id, const std::string& key) {
-        uint32_t new_root_id = pool.allocatePage();
-        char* root_data = pool.getPage(new_root_id);
-        PageHeader* root_h = (PageHeader*)root_data;
-        
-        root_h->is_leaf = false;
-        root_h->num_slots = 1;
-        root_h->lower_bound_child = left_child_id;
-
-        IndexEntry* entries = (IndexEntry*)(root_data + sizeof(PageHeader));
-        std::memset(entries[0].key, 0, 16);
-        std::strncpy(entries[0].key, key.c_str(), 15);
-        entries[0].child_page_id = right_child_id;
-        
-        ((PageHeader*)pool.getPage(left_child_id))->parent_id = new_root_id;
-        ((PageHeader*)pool.getPage(right_child_id))->parent_id = new_root_id;
-        pool.flushPage(left_child_id);
-        pool.flushPage(right_child_id);
-
-        root_id = new_root_id;
-        updateMetaPage();
+    // Merges two adjacent leaves when they fit in one page, else moves
+    // records across until both are about half full. `j` is the parent's
+    // separator for `right`. Returns true if `right` was merged into `left`
+    // and freed. An even split whose separator no longer fits in the parent
+    // is skipped; the leaf then just stays underfull.
+    bool rebalanceLeaves(PageGuard& parent, int j, PageGuard& left, PageGuard& right) {
+        size_t total = LeafNode::used(left.data()) + LeafNode::used(right.data());
+        if (total <= PAGE_SIZE - sizeof(PageHeader)) {
+            const Slot* slots = (const Slot*)(right.data() + sizeof(PageHeader));
+            for (uint32_t i = 0; i < right.header()->num_slots; ++i) LeafNode::append(left.data(), right.data() + slots[i].offset);
+            left.header()->next_sibling = right.header()->next_sibling;
+            left.markDirty();
+            removeSeparator(parent, j);
+            pool.freePage(std::move(right));
+            return true;
+        }
+
+        char copy[2 * PAGE_SIZE];
+        std::memcpy(copy, left.data(), PAGE_SIZE);
+        std::memcpy(copy + PAGE_SIZE, right.data(), PAGE_SIZE);
+        std::vector<const char*> recs;
+        for (const char* page : {copy, copy + PAGE_SIZE}) {
+            const Slot* slots = (const Slot*)(page + sizeof(PageHeader));
+            for (uint32_t i = 0; i < ((const PageHeader*)page)->num_slots; ++i) recs.push_back(page + slots[i].offset);
+        }
+        size_t k = 0, acc = 0;
+        while (k < recs.size() && acc + LeafNode::recordSize(recs[k]) + sizeof(Slot) <= total / 2) acc += LeafNode::recordSize(recs[k++]) + sizeof(Slot);
+        k = std::min(std::max<size_t>(k, 1), recs.size() - 1);
+
+        std::vector<InternalNode::Entry> entries = InternalNode::entries(parent.data());
+        entries[j].key = InternalNode::shortestSeparator(std::string(LeafNode::recordKey(recs[k - 1])), std::string(LeafNode::recordKey(recs[k])));
+        if (InternalNode::encodedSize(entries, 0, entries.size()) > InternalNode::capacity()) return false;
+        InternalNode::write(parent.data(), parent.header()->lower_bound_child, entries, 0, entries.size());
+        parent.markDirty();
+        LeafNode::clear(left.data());
+        LeafNode::clear(right.data());
+        for (size_t i = 0; i < recs.size(); ++i) LeafNode::append(i < k ? left.data() : right.data(), recs[i]);
+        left.markDirty();
+        right.markDirty();
+        return false;
     }
 
-    void insertIntoLeaf(uint32_t leaf_id, const std::string& key, const std::string& value) {
-        char* page_data = pool.getPage(leaf_id);
-        PageHeader* h = (PageHeader*)page_data;
-        int slot_idx = findSlotBinary(page_data, key);
-        
-        size_t entry_size = key.size() + value.size() + 2;
-        size_t slot_array_end = sizeof(PageHeader) + (h->num_slots + 1) * sizeof(Slot);
+    // The same for adjacent internal nodes: the parent's separator moves
+    // down between them, and for an even split the middle entry moves up.
+    bool rebalanceInternal(PageGuard& parent, int j, PageGuard& left, PageGuard& right) {
+        std::vector<InternalNode::Entry> all = InternalNode::entries(left.data());
+        all.push_back({InternalNode::separator(parent.data(), j), right.header()->lower_bound_child});
+        std::vector<InternalNode::Entry> right_entries = InternalNode::entries(right.data());
+        all.insert(all.end(), right_entries.begin(), right_entries.end());
+        uint32_t lower_bound_child = left.header()->lower_bound_child;
 
-        if (h->free_space_offset < entry_size || (h->free_space_offset - entry_size) < slot_array_end) {
-            return; // Managed by split logic in put()
+        size_t total = InternalNode::encodedSize(all, 0, all.size());
+        if (total <= InternalNode::capacity()) {
+            InternalNode::write(left.data(), lower_bound_child, all, 0, all.size());
+            left.markDirty();
+            removeSeparator(parent, j);
+            pool.freePage(std::move(right));
+            return true;
         }
 
-        Slot* slots = (Slot*)(page_data + sizeof(PageHeader));
-        if (slot_idx < (int)h->num_slots) {
-            std::memmove(&slots[slot_idx + 1], &slots[slot_idx], (h->num_slots - slot_idx) * sizeof(Slot));
+        size_t m = 0, acc = 0;
+        while (m < all.size() && acc < total / 2) acc += all[m++].key.size() + InternalNode::ENTRY_OVERHEAD;
+        m = std::min(std::max<size_t>(m, 1), all.size() - 2);
+        std::vector<InternalNode::Entry> entries = InternalNode::entries(parent.data());
+        entries[j].key = all[m].key;
+        if (InternalNode::encodedSize(all, 0, m) > InternalNode::capacity() ||
+            InternalNode::encodedSize(all, m + 1, all.size()) > InternalNode::capacity() ||
+            InternalNode::encodedSize(entries, 0, entries.size()) > InternalNode::capacity()) {
+            return false;
+        }
+        InternalNode::write(parent.data(), parent.header()->lower_bound_child, entries, 0, entries.size());
+        InternalNode::write(left.data(), lower_bound_child, all, 0, m);
+        InternalNode::write(right.data(), all[m].child, all, m + 1, all.size());
+        parent.markDirty();
+        left.markDirty();
+        right.markDirty();
+        return false;
+    }
+
+    // Hands the separator of a split to the parent at the end of `path`,
+    // splitting the parent in turn when it is full. `path` holds the
+    // X-latched ancestors the pessimistic descent kept; an empty path means
+    // the root itself split.
+    void insertIntoParent(std::vector<PageGuard>& path, uint32_t left_id, const std::string& key, uint32_t right_id) {
+        if (path.empty()) {
+            createNewRoot(left_id, right_id, key);
+            return;
+        }
+
+        PageGuard& node = path.back();
+        uint32_t lower_bound_child = node.header()->lower_bound_child;
+        std::vector<InternalNode::Entry> entries = InternalNode::entries(node.data());
+
+        // Keep separators sorted so childFor can route by comparison
+        size_t pos = entries.size();
+        while (pos > 0 && key < entries[pos - 1].key) pos--;
+        entries.insert(entries.begin() + pos, {key, right_id});
+
+        if (InternalNode::encodedSize(entries, 0, entries.size()) <= InternalNode::capacity()) {
+            InternalNode::write(node.data(), lower_bound_child, entries, 0, entries.size());
+            node.markDirty();
+            return;
         }
 
-        h->free_space_offset -= entry_size;
-        char* data_ptr = page_data + h->free_space_offset;
-        data_ptr[0] = (uint8_t)key.size();
-        std::memcpy(data_ptr + 1, key.data(), key.size());
-        data_ptr[1 + key.size()] = (uint8_t)value.size();
-        std::memcpy(data_ptr + 2 + key.size(), value.data(), value.size());
+        // Full: split around the entry at the middle by size, whose key moves
+        // up as the lower bound of the new right sibling.
+        size_t total = InternalNode::encodedSize(entries, 0, entries.size()), acc = 0, mid = 0;
+        while (mid < entries.size() && acc < total / 2) acc += entries[mid++].key.size() + InternalNode::ENTRY_OVERHEAD;
+        mid = std::min(std::max<size_t>(mid, 1), entries.size() - 2);
+        std::string promotion_key = entries[mid].key;
+
+        PageGuard sibling = pool.newPage();
+        InternalNode::write(sibling.data(), entries[mid].child, entries, mid + 1, entries.size());
+        InternalNode::write(node.data(), lower_bound_child, entries, 0, mid);
+        node.markDirty();
+
+        // Both halves stay latched until the parent routes to them, so an
+        // optimistic reader cannot validate a half-published split.
+        PageGuard left = std::move(path.back());
+        path.pop_back();
+        insertIntoParent(path, left.id(), promotion_key, sibling.id());
+    }
+
+    // Requires root_latch held exclusively.
+    void createNewRoot(uint32_t left_child_id, uint32_t right_child_id, const std::string& key) {
+        PageGuard root = pool.newPage();
+        InternalNode::write(root.data(), left_child_id, {{key, right_child_id}}, 0, 1);
+        root_id = root.id();
+        root.release();
+        updateMetaPage();
+    }
 
-        slots[slot_idx].offset = (uint16_t)h->free_space_offset;
-        slots[slot_idx].length = (uint16_t)entry_size;
-        h->num_slots++;
-        pool.flushPage(leaf_id);
+    // Replaces the record with the same key, if any, and frees its overflow
+    // run. Returns false, leaving the leaf as it was, when the record does
+    // not fit; put() splits first. `stored` is the value, or its
+    // OverflowRef when `overflow` is set.
+    bool insertIntoLeaf(char* page_data, std::string_view key, std::string_view stored, bool overflow = false) {
+        size_t size = LeafNode::recordSize(key.size(), stored.size());
+        int idx = findSlotBinary(page_data, key);
+        const char* rec = idx < (int)((PageHeader*)page_data)->num_slots
+                              ? page_data + LeafNode::slots(page_data)[idx].offset
+                              : nullptr;
+        if (!rec || LeafNode::recordKey(rec) != key) {
+            if (!LeafNode::hasRoom(page_data, size)) return false;
+        } else {
+            if (sizeof(PageHeader) + LeafNode::used(page_data) - LeafNode::recordSize(rec) + size > PAGE_SIZE) return false;
+            if (LeafNode::isOverflow(rec)) freeOverflow(LeafNode::storedValue(rec));
+            LeafNode::erase(page_data, idx);
+        }
+        LeafNode::insert(page_data, idx, key, stored, overflow);
+        return true;
     }
 
-    void splitLeaf(uint32_t old_leaf_id, const std::string& key, const std::string& value) {
-        uint32_t new_leaf_id = pool.allocatePage();
-        char* old_data = pool.getPage(old_leaf_id);
-        PageHeader* old_h = (PageHeader*)old_data;
-        PageHeader* new_h = (PageHeader*)pool.getPage(new_leaf_id);
+    // Splits the leaf at the end of `path` and inserts the record into the
+    // half it belongs to, which also holds the record it replaces, then
+    // propagates the separator upwards.
+    void splitLeaf(std::vector<PageGuard>& path, std::string_view key, std::string_view stored, bool overflow) {
+        PageGuard& old_leaf = path.back();
+        PageGuard new_leaf = pool.newPage();
+        char* old_data = old_leaf.data();
+        PageHeader* old_h = old_leaf.header();
+        PageHeader* new_h = new_leaf.header();
 
         new_h->is_leaf = true;
-        new_h->parent_id = old_h->parent_id;
         new_h->next_sibling = old_h->next_sibling;
-        old_h->next_sibling = new_leaf_id;
+        old_h->next_sibling = new_leaf.id();
 
+        // Halves the bytes, not the slots: with records of uneven size, the
+        // half that gets the new record could otherwise still be too full.
         Slot* old_slots = (Slot*)(old_data + sizeof(PageHeader));
-        uint32_t mid = old_h->num_slots / 2;
+        size_t half = LeafNode::used(old_data) / 2, below = 0;
+        uint32_t mid = 0;
+        while (mid + 1 < old_h->num_slots && below + sizeof(Slot) + old_slots[mid].length <= half) {
+            below += sizeof(Slot) + old_slots[mid++].length;
+        }
+        if (mid == 0) mid = 1;
         char* sep_rec_ptr = old_data + old_slots[mid].offset;
         std::string mid_key(sep_rec_ptr + 1, (uint8_t)sep_rec_ptr[0]);
+        std::string sep_key = mid_key;
+        if (mid > 0) {
+            char* last_rec_ptr = old_data + old_slots[mid - 1].offset;
+            sep_key = InternalNode::shortestSeparator(std::string(last_rec_ptr + 1, (uint8_t)last_rec_ptr[0]), mid_key);
+        }
+
+        LeafNode::moveUpper(old_data, mid, new_leaf.data());
+        old_leaf.markDirty();
+
+        bool inserted = key < sep_key ? insertIntoLeaf(old_data, key, stored, overflow)
+                                      : insertIntoLeaf(new_leaf.data(), key, stored, overflow);
+        assert(inserted && "split half has no room for the record");
+        (void)inserted;
+
+        PageGuard left = std::move(path.back());
+        path.pop_back();
+        insertIntoParent(path, left.id(), sep_key, new_leaf.id());
+    }
+
+    // Optimistic lock coupling: descends without taking any latch. A node's
+    // version is validated after the child's has been read, so the child
+    // was the right one when we stepped onto it. Returns false if a node is
+    // not resident or writers kept interfering; callers then fall back to
+    // latch crabbing. `parent` stays empty for a root leaf.
+    bool optimisticFindLeaf(const std::string& key, OptimisticRead& leaf, OptimisticRead& parent,
+                            std::optional<std::string>* high = nullptr) {
+        for (int attempt = 0; attempt < MAX_OPTIMISTIC_RESTARTS; ++attempt) {
+            if (high) high->reset();
+            uint32_t root = root_id.load(std::memory_order_acquire);
+            OptimisticRead node;
+            if (!pool.readOptimistic(root, node)) continue;
+            if (root_id.load(std::memory_order_acquire) != root) continue;
+
+            parent = OptimisticRead();
+            bool restart = false;
+            while (!((const PageHeader*)node.data)->is_leaf) {
+                OptimisticRead child;
+                bool readable = pool.readOptimistic(childFor(node.data, key, high), child);
+                if (!readable || !pool.validate(node)) {
+                    restart = true;
+                    break;
+                }
+                parent = node;
+                node = child;
+            }
+            if (restart) continue;
+            leaf = node;
+            return true;
+        }
+        return false;
+    }
+
+    // The leaf for an update: located optimistically, then X-latched. An
+    // unchanged parent version (or root_id, for a root leaf) proves the
+    // leaf still covers `key`: splits and merges, and with them the freeing
+    // and reuse of a leaf, all rewrite the parent. Returns an empty guard
+    // when that fails.
+    PageGuard tryLockLeafForWrite(const std::string& key, std::optional<std::string>* high = nullptr) {
+        OptimisticRead leaf, parent;
+        if (optimisticFindLeaf(key, leaf, parent, high)) {
+            PageGuard g = pool.fetchPageForWrite(leaf.page_id);
+            bool valid = parent.data ? pool.validate(parent) : root_id.load() == leaf.page_id;
+            if (valid && g.header()->is_leaf) return g;
+        }
+        return PageGuard();
+    }
+
+    // As above, falling back to crabbing.
+    PageGuard lockLeafForWrite(const std::string& key) {
+        PageGuard g = tryLockLeafForWrite(key);
+        if (g) return g;
+        return descendToLeaf(key, true);
+    }
+
+    // Read crabbing: S-latches the child before releasing the parent. With
+    // for_write the leaf is re-latched exclusively while its parent (or the
+    // root latch, for a root leaf) is still held, so no split can slip in.
+    PageGuard descendToLeaf(const std::string& key, bool for_write, std::optional<std::string>* high = nullptr) {
+        std::shared_lock<std::shared_mutex> root_lock(root_latch);
+        if (high) high->reset();
+        PageGuard parent;
+        PageGuard node = pool.fetchPage(root_id);
+        while (!node.header()->is_leaf) {
+            uint32_t child_id = childFor(node.data(), key, high);
+            parent = std::move(node);
+            if (root_lock.owns_lock()) root_lock.unlock();
+            node = pool.fetchPage(child_id);
+        }
+        if (for_write) {
+            uint32_t leaf_id = node.id();
+            node.release();
+            node = pool.fetchPageForWrite(leaf_id);
+        }
+        return node;
+    }
+
+    // Crabs down to the leaf that holds the last key <= `key` (< `key` when
+    // strict) and reports the leaf's lower bound, nothing for the leftmost
+    // leaf. Reverse scans reach the previous leaf this way instead of
+    // latching leftwards, which could deadlock with a split.
+    PageGuard descendReverse(const std::string& key, bool strict, std::optional<std::string>& low) {
+        std::shared_lock<std::shared_mutex> root_lock(root_latch);
+        low.reset();
+        PageGuard parent;
+        PageGuard node = pool.fetchPage(root_id);
+        while (!node.header()->is_leaf) {
+            int i = InternalNode::find(node.data(), key, strict);
+            if (i >= 0) low = InternalNode::separator(node.data(), i);
+            uint32_t child_id = InternalNode::child(node.data(), i);
+            parent = std::move(node);
+            if (root_lock.owns_lock()) root_lock.unlock();
+            node = pool.fetchPage(child_id);
+        }
+        return node;
+    }
+
+    // Appends the separators in (start, end] of the index level `depth`
+    // below `node`, with those of the levels in between, in key order.
+    // Children are latched one at a time under their parent. False if that
+    // level would be the leaves.
+    bool collectSeparators(const PageGuard& node, int depth, const std::string& start, const std::string& end,
+                           std::vector<std::string>& keys) {
+        const char* data = node.data();
+        if (((const PageHeader*)data)->is_leaf) return false;
+        int first = depth == 0 ? 0 : InternalNode::find(data, start);
+        int last = depth == 0 ? InternalNode::size(data) - 1 : InternalNode::find(data, end);
+        for (int i = first; i <= last; ++i) {
+            if (i >= 0) {
+                std::string sep = InternalNode::separator(data, i);
+                if (sep > start && sep <= end) keys.push_back(std::move(sep));
+            }
+            if (depth > 0) {
+                PageGuard child = pool.fetchPage(InternalNode::child(data, i));
+                if (!collectSeparators(child, depth - 1, start, end, keys)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Write crabbing for inserts that may split: X-latches top-down and
+    // drops every ancestor (and the root latch) once a child is safe.
+    void putPessimistic(const std::string& key, std::string_view stored, bool overflow) {
+        size_t entry_size = LeafNode::recordSize(key.size(), stored.size());
+        std::unique_lock<std::shared_mutex> root_lock(root_latch);
+        std::vector<PageGuard> path;
+        path.push_back(pool.fetchPageForWrite(root_id));
+        if (isSafe(path.back().data(), entry_size)) root_lock.unlock();
+
+        while (!path.back().header()->is_leaf) {
+            PageGuard child = pool.fetchPageForWrite(childFor(path.back().data(), key));
+            if (isSafe(child.data(), entry_size)) {
+                path.clear();
+                if (root_lock.owns_lock()) root_lock.unlock();
+            }
+            path.push_back(std::move(child));
+        }
+
+        PageGuard& leaf = path.back();
+        if (insertIntoLeaf(leaf.data(), key, stored, overflow)) {
+            leaf.markDirty();
+            return;
+        }
+        assert((path.size() > 1 || root_lock.owns_lock()) && "root split without the root latch");
+        splitLeaf(path, key, stored, overflow);
+    }
+
+    static bool underflowsWithout(const char* page_data, int idx) {
+        const Slot* slots = (const Slot*)(page_data + sizeof(PageHeader));
+        return LeafNode::used(page_data) - sizeof(Slot) - LeafNode::recordSize(page_data + slots[idx].offset) < LEAF_MIN_USED;
+    }
+
+    // Write crabbing for deletes that may rebalance: keeps the ancestors
+    // that are not safe for a delete, then fixes underflows bottom-up.
+    // Siblings are latched left to right like cursors move, so a leaf
+    // whose partner is its left sibling is released and re-latched after
+    // it; the X-latched parent keeps both in place meanwhile.
+    bool removePessimistic(const std::string& key) {
+        std::unique_lock<std::shared_mutex> root_lock(root_latch);
+        std::vector<PageGuard> path;
+        std::vector<int> index; // index[k]: the separator of path[k - 1] that routes to path[k]
+        path.push_back(pool.fetchPageForWrite(root_id));
+        index.push_back(-1);
+        if (isSafeForRemove(path.back().data(), true)) root_lock.unlock();
+
+        while (!path.back().header()->is_leaf) {
+            int i = InternalNode::find(path.back().data(), key);
+            PageGuard child = pool.fetchPageForWrite(InternalNode::child(path.back().data(), i));
+            if (isSafeForRemove(child.data(), false)) {
+                path.clear();
+                index.clear();
+                if (root_lock.owns_lock()) root_lock.unlock();
+            }
+            path.push_back(std::move(child));
+            index.push_back(i);
+        }
+
+        int idx = findRecord(path.back().data(), key);
+        if (idx < 0) return false;
+        size_t depth = path.size() - 1;
+        PageGuard& parent = path[depth ? depth - 1 : 0];
+        if (depth == 0 || InternalNode::size(parent.data()) == 0 || !underflowsWithout(path.back().data(), idx)) {
+            eraseRecord(path.back(), idx);
+            return true;
+        }
+
+        int i = index[depth];
+        PageGuard left, right;
+        if (i + 1 < InternalNode::size(parent.data())) {
+            eraseRecord(path.back(), idx);
+            left = std::move(path.back());
+            right = pool.fetchPageForWrite(InternalNode::child(parent.data(), i + 1));
+            i++;
+        } else {
+            uint32_t leaf_id = path.back().id();
+            path.back().release();
+            left = pool.fetchPageForWrite(InternalNode::child(parent.data(), i - 1));
+            right = pool.fetchPageForWrite(leaf_id);
+            idx = findRecord(right.data(), key);
+            assert(idx >= 0 && "leaf changed under its X-latched parent");
+            eraseRecord(right, idx);
+        }
+        path.pop_back();
+        bool merged = rebalanceLeaves(parent, i, left, right);
+        left.release();
+        right.release();
+
+        // A merge took a separator from the parent, which may underflow in
+        // turn; a root left without separators hands over to its only child.
+        while (merged && !path.empty()) {
+            depth = path.size() - 1;
+            PageGuard& node = path.back();
+            if (depth == 0) {
+                if (root_lock.owns_lock() && node.id() == root_id && InternalNode::size(node.data()) == 0) {
+                    root_id = node.header()->lower_bound_child;
+                    updateMetaPage();
+                    pool.freePage(std::move(node));
+                }
+                break;
+            }
+            if (!internalUnderflows(node.data())) break;
+            PageGuard& up = path[depth - 1];
+            i = index[depth];
+            PageGuard sibling;
+            if (i + 1 < InternalNode::size(up.data())) {
+                sibling = pool.fetchPageForWrite(InternalNode::child(up.data(), i + 1));
+                merged = rebalanceInternal(up, i + 1, node, sibling);
+            } else {
+                sibling = pool.fetchPageForWrite(InternalNode::child(up.data(), i - 1));
+                merged = rebalanceInternal(up, i, sibling, node);
+            }
+            path.pop_back();
+        }
+        return true;
+    }
+
+    // 1. Key length (stored in one byte)
+    // 2. Value length (MAX_VALUE_SIZE)
+    bool checkRecord(const std::string& key, const std::string& value) {
+        if (key.length() > MAX_KEY_SIZE) {
+            std::cerr << "Error: Key too long (" << key.length()
+                    << " bytes). Max allowed is " << MAX_KEY_SIZE << " bytes." << std::endl;
+            return false;
+        }
+        if (value.length() > MAX_VALUE_SIZE) {
+            std::cerr << "Error: Value too large (" << value.length()
+                    << " bytes). Max allowed is " << MAX_VALUE_SIZE << " bytes." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Ends a write's transaction. A write the WAL could not make durable
+    // must not look like a success.
+    static void commitDurably(TxnScope& txn) {
+        if (!txn.commit()) throw std::runtime_error("BPlusTree: the write-ahead log failed, the write is not durable");
+    }
+
+    // Batch positions sorted by key; equal keys keep their batch order.
+    template <typename KeyOf>
+    static std::vector<size_t> sortedOrder(size_t n, KeyOf key_of) {
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return key_of(a) < key_of(b); });
+        return order;
+    }
+
+    // End of the run of sorted batch keys, starting at `begin`, that fall
+    // below the leaf bound `high`; the key at `begin` routed to that leaf.
+    template <typename KeyOf>
+    static size_t groupEnd(const std::vector<size_t>& order, size_t begin, const std::optional<std::string>& high, KeyOf key_of) {
+        size_t end = begin + 1;
+        while (end < order.size() && (!high || key_of(order[end]) < *high)) ++end;
+        return end;
+    }
+
+    // Stages freshly built pages in an aligned buffer and writes each run
+    // of consecutive page ids with a single call.
+    class ExtentWriter {
+        static constexpr uint32_t CAPACITY = 64;
+
+        BufferPool& pool;
+        FrameArena buffer;
+        uint32_t first_id = 0;
+        uint32_t count = 0;
+        bool ok = true;
+
+    public:
+        explicit ExtentWriter(BufferPool& bp) : pool(bp), buffer(CAPACITY * PAGE_SIZE) {}
+
+        void add(uint32_t id, const char* page) {
+            if (count == CAPACITY || (count > 0 && id != first_id + count)) flush();
+            if (count == 0) first_id = id;
+            std::memcpy(buffer.data() + (size_t)count++ * PAGE_SIZE, page, PAGE_SIZE);
+        }
+
+        // False if any extent written so far failed.
+        bool flush() {
+            if (count > 0) ok = pool.writeExtent(first_id, buffer.data(), count) && ok;
+            count = 0;
+            return ok;
+        }
+    };
 
-        for (uint32_t i = mid; i < old_h->num_slots; ++i) {
-            char* rec_ptr = old_data + old_slots[i].offset;
-            uint8_t kLen = (uint8_t)rec_ptr[0];
-            uint8_t vLen = (uint8_t)rec_ptr[1 + kLen];
-            insertIntoLeaf(new_leaf_id, std::string(rec_ptr + 1, kLen), std::string(rec_ptr + 2 + kLen, vLen));
+    bool isEmpty() {
+        std::shared_lock<std::shared_mutex> root_lock(root_latch);
+        PageGuard root = pool.fetchPage(root_id);
+        return root.header()->is_leaf && root.header()->num_slots == 0;
+    }
+
+    bool checkNode(uint32_t node_id, const std::string* lo, const std::string* hi) {
+        PageGuard node = pool.fetchPage(node_id);
+        char* data = node.data();
+        PageHeader* h = node.header();
+        if (h->is_leaf) {
+            Slot* slots = (Slot*)(data + sizeof(PageHeader));
+            std::string prev;
+            for (uint32_t i = 0; i < h->num_slots; ++i) {
+                char* rec = data + slots[i].offset;
+                std::string k(rec + 1, (uint8_t)*rec);
+                if ((i > 0 && k < prev) || (lo && k < *lo) || (hi && k > *hi)) {
+                    std::cerr << "Invariant: leaf " << node_id << " key out of order: " << k << std::endl;
+                    return false;
+                }
+                prev = k;
+            }
+            return true;
+        }
+
+        std::vector<InternalNode::Entry> entries = InternalNode::entries(data);
+        std::vector<std::string> keys;
+        std::vector<uint32_t> children{h->lower_bound_child};
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            keys.push_back(entries[i].key);
+            children.push_back(entries[i].child);
+            if ((i > 0 && keys[i] < keys[i - 1]) || (lo && keys[i] < *lo) || (hi && keys[i] > *hi)) {
+                std::cerr << "Invariant: node " << node_id << " separator out of order: " << keys[i] << std::endl;
+                return false;
+            }
+        }
+        node.release();
+        for (size_t i = 0; i < children.size(); ++i) {
+            const std::string* child_lo = i == 0 ? lo : &keys[i - 1];
+            const std::string* child_hi = i == keys.size() ? hi : &keys[i];
+            if (!checkNode(children[i], child_lo, child_hi)) return false;
         }
+        return true;
+    }
+
+    // Vacuum (see Vacuum below). The inner nodes above a leaf and the child
+    // index taken in each (-1: lower_bound_child).
+    struct Route {
+        std::vector<uint32_t> nodes;
+        std::vector<int> index;
+        uint32_t leaf = 0;
+        std::optional<std::string> high; // the leaf's upper bound
+    };
+
+    // Crabs down like descendToLeaf() (strict: to the last leaf with keys
+    // below `key`) and records the way. Nothing is latched afterwards, so
+    // a move based on the route re-checks it under its own latches.
+    Route route(std::string_view key, bool strict) {
+        Route r;
+        std::shared_lock<std::shared_mutex> root_lock(root_latch);
+        PageGuard node = pool.fetchPage(root_id);
+        while (!node.header()->is_leaf) {
+            int i = InternalNode::find(node.data(), key, strict);
+            if (!strict && i + 1 < InternalNode::size(node.data())) r.high = InternalNode::separator(node.data(), i + 1);
+            r.nodes.push_back(node.id());
+            r.index.push_back(i);
+            uint32_t child_id = InternalNode::child(node.data(), i);
+            if (root_lock.owns_lock()) root_lock.unlock();
+            node = pool.fetchPage(child_id);
+        }
+        r.leaf = node.id();
+        return r;
+    }
+
+    // Free pages are zeroed and overflow pages never set lower_bound_child,
+    // so a page that passes this is a live inner node.
+    static bool isInnerNode(const char* page_data) {
+        const PageHeader* h = (const PageHeader*)page_data;
+        return !h->is_leaf && h->free_space_offset != 0 && h->lower_bound_child != 0;
+    }
 
-        old_h->num_slots = mid;
-        defragmentPage(old_leaf_id);
+    // Moves r.nodes[depth] (depth == r.nodes.size(): the leaf) to the free
+    // page `target` and repoints its parent, or root_id. A leaf is also
+    // relinked from its left neighbour `left` (0 for the leftmost leaf).
+    // One transaction per move. Latches go top-down and the left neighbour
+    // before the leaf, as elsewhere; since splits and merges may have run
+    // since the route was taken, each link is re-checked once latched.
+    // Returns false if one no longer holds or `target` has been taken.
+    bool movePage(const Route& r, size_t depth, uint32_t left, uint32_t target) {
+        bool leaf_page = depth == r.nodes.size();
+        uint32_t id = leaf_page ? r.leaf : r.nodes[depth];
+        TxnScope txn(pool);
+        std::unique_lock<std::shared_mutex> root_lock(root_latch, std::defer_lock);
+        PageGuard parent;
+        if (depth == 0) {
+            root_lock.lock();
+            if (root_id != id) return false;
+        } else {
+            parent = pool.fetchPageForWrite(r.nodes[depth - 1]);
+            int i = r.index[depth - 1];
+            if (!isInnerNode(parent.data()) || i >= InternalNode::size(parent.data()) ||
+                InternalNode::child(parent.data(), i) != id) {
+                return false;
+            }
+        }
+        PageGuard left_leaf;
+        if (left != 0) {
+            left_leaf = pool.fetchPageForWrite(left);
+            if (!left_leaf.header()->is_leaf || left_leaf.header()->next_sibling != id) return false;
+        }
+        PageGuard page = pool.fetchPageForWrite(id);
+        if (page.header()->free_space_offset == 0 || page.header()->is_leaf != leaf_page) return false;
+        std::vector<PageGuard> moved = pool.newPagesAt(target, 1);
+        if (moved.empty()) return false;
 
-        if (key < mid_key) insertIntoLeaf(old_leaf_id, key, value);
-        else insertIntoLeaf(new_leaf_id, key, value);
+        std::memcpy(moved[0].data(), page.data(), PAGE_SIZE);
+        moved[0].header()->page_id = target;
+        if (depth == 0) {
+            root_id = target;
+            updateMetaPage();
+        } else {
+            InternalNode::setChild(parent.data(), r.index[depth - 1], target);
+            parent.markDirty();
+        }
+        if (left_leaf) {
+            left_leaf.header()->next_sibling = target;
+            left_leaf.markDirty();
+        }
+        pool.freePage(std::move(page));
+        return true;
+    }
 
-        if (old_leaf_id == root_id) createNewRoot(old_leaf_id, new_leaf_id, mid_key);
-        else insertIntoInternal(old_h->parent_id, mid_key, new_leaf_id);
+    // Moves each overflow run of leaf `leaf_id` down to the lowest free run
+    // below it, one record per transaction. The leaf's X latch keeps
+    // readers off the run. Returns the number of pages moved.
+    size_t packOverflow(uint32_t leaf_id) {
+        size_t moved = 0;
+        for (uint32_t slot = 0;; ++slot) {
+            TxnScope txn(pool);
+            PageGuard leaf = pool.fetchPageForWrite(leaf_id);
+            if (!leaf.header()->is_leaf || leaf.header()->free_space_offset == 0) break;
+            if (slot >= leaf.header()->num_slots) break;
+            char* rec = leaf.data() + ((Slot*)(leaf.data() + sizeof(PageHeader)))[slot].offset;
+            if (!LeafNode::isOverflow(rec)) continue;
+            char* stored = (char*)LeafNode::storedValue(rec).data();
+            OverflowRef ref;
+            std::memcpy(&ref, stored, sizeof(ref));
+            uint32_t count = overflowPages(ref.length);
+            uint32_t first = pool.lowestFreeRun(count);
+            if (first == 0 || first >= ref.first_page) continue;
+            first = pool.newRun(count, [&](char* page, uint32_t run, uint32_t i) {
+                PageGuard old = pool.fetchPage(ref.first_page + i);
+                std::memcpy(page, old.data(), PAGE_SIZE);
+                ((PageHeader*)page)->page_id = run + i;
+                ((PageHeader*)page)->next_sibling = i + 1 < count ? run + i + 1 : 0;
+            }, first);
+            if (first == 0) continue;
+            pool.freeRun(ref.first_page, count);
+            ref.first_page = first;
+            std::memcpy(stored, &ref, sizeof(ref));
+            leaf.markDirty();
+            moved += count;
+        }
+        return moved;
     }
 
 public:
-    BPlusTree() : pool("db.bin") {
-        char* meta_data = pool.getPage(0);
-        root_id = *reinterpret_cast<uint32_t*>(meta_data);
+    // Opening the pool replays any committed WAL records left by a crash
+    // before the meta page is read.
+    explicit BPlusTree(const std::string& path = "db.bin", const PoolOptions& options = PoolOptions())
+        : pool(path, options) {
+        {
+            PageGuard meta = pool.fetchPage(0);
+            root_id = ((MetaPage*)meta.data())->root_id;
+        }
         if (root_id == 0) {
-            root_id = pool.allocatePage();
-            PageHeader* h = (PageHeader*)pool.getPage(root_id);
-            h->is_leaf = true;
+            TxnScope txn(pool);
+            std::unique_lock<std::shared_mutex> root_lock(root_latch);
+            PageGuard root = pool.newPage();
+            root.header()->is_leaf = true;
+            root_id = root.id();
+            root.release();
             updateMetaPage();
         }
     }
 
-    uint32_t findLeaf(uint32_t node_id, const std::string& key) {
-        char* page_data = pool.getPage(node_id);
-        PageHeader* h = (PageHeader*)page_data;
-        if (h->is_leaf) return node_id;
+    uint32_t findLeaf(const std::string& key) {
+        OptimisticRead leaf, parent;
+        if (optimisticFindLeaf(key, leaf, parent) && pool.validate(leaf)) return leaf.page_id;
+        return descendToLeaf(key, false).id();
+    }
 
-        IndexEntry* entries = (IndexEntry*)(page_data + sizeof(PageHeader));
-        if (key < std::string(entries[0].key)) return findLeaf(h->lower_bound_child, key);
+    // Safe to call from several threads. Inserts first try the optimistic
+    // path (S latches down to an X-latched leaf); only an insert that has to
+    // split restarts with exclusive latches from the root. An existing key
+    // gets the new value; the overflow run of the old one is freed.
+    //
+    // A large value is written to an overflow run first, in the same
+    // transaction, and the leaf only receives its reference. Throws if the
+    // WAL failed before the write was durable.
+    void put(const std::string& key, const std::string& value) {
+        if (!checkRecord(key, value)) return;
 
-        for (int i = (int)h->num_slots - 1; i >= 0; --i) {
-            if (key >= std::string(entries[i].key)) return findLeaf(entries[i].child_page_id, key);
+        TxnScope txn(pool);
+        bool overflow = value.size() > INLINE_VALUE_MAX;
+        std::string ref;
+        if (overflow) ref = writeOverflow(value);
+        std::string_view stored = overflow ? std::string_view(ref) : std::string_view(value);
+        bool inserted;
+        {
+            PageGuard leaf = lockLeafForWrite(key);
+            inserted = insertIntoLeaf(leaf.data(), key, stored, overflow);
+            if (inserted) leaf.markDirty();
         }
-        return findLeaf(entries[0].child_page_id, key);
+        if (!inserted) putPessimistic(key, stored, overflow);
+        commitDurably(txn);
     }
 
-    void put(const std::string& key, const std::string& value) {
-        // 1. Enforce Key Length (Internal node constraint)
-        assert(key.length() <= 15 && "Key length exceeds limit of 15");
+    // Takes no latch when the path is resident and no writer interferes.
+    // Out-of-line values are read under the leaf's S latch.
+    std::optional<std::string> get(const std::string& key) {
+        std::optional<std::string> value;
+        bool overflow = false;
+        OptimisticRead leaf, parent;
+        if (optimisticFindLeaf(key, leaf, parent) && lookupLeaf(leaf.data, key, value, overflow) &&
+            pool.validate(leaf) && !overflow) {
+            return value;
+        }
+        PageGuard g = descendToLeaf(key, false);
+        lookupLeaf(g.data(), key, value, overflow);
+        if (overflow) value = readOverflow(*value);
+        return value;
+    }
 
-        // 2. Enforce Total Record Size (Slotted Page constraint)
-        // We reserve roughly 100 bytes for headers and slot metadata
-        const size_t MAX_RECORD_SIZE = PAGE_SIZE - 100;
-        size_t entry_size = key.length() + value.length() + 2;
+    // Point lookups for a batch, returned in the order of `keys`. The keys
+    // are visited sorted, so each distinct leaf is descended to once and
+    // every key below its upper bound is resolved in the page at hand.
+    std::vector<std::optional<std::string>> multiGet(const std::vector<std::string>& keys) {
+        std::vector<std::optional<std::string>> res(keys.size());
+        auto key_of = [&](size_t i) -> const std::string& { return keys[i]; };
+        std::vector<size_t> order = sortedOrder(keys.size(), key_of);
 
-        if (entry_size > MAX_RECORD_SIZE) {
-            std::cerr << "Error: Record too large (" << entry_size
-                    << " bytes). Max allowed is " << MAX_RECORD_SIZE << " bytes." << std::endl;
-            return;
+        size_t i = 0;
+        while (i < order.size()) {
+            std::optional<std::string> high;
+            OptimisticRead leaf, parent;
+            if (optimisticFindLeaf(keys[order[i]], leaf, parent, &high)) {
+                size_t end = groupEnd(order, i, high, key_of);
+                bool consistent = true, overflow = false;
+                for (size_t j = i; j < end && consistent && !overflow; ++j) {
+                    consistent = lookupLeaf(leaf.data, keys[order[j]], res[order[j]], overflow);
+                }
+                if (consistent && !overflow && pool.validate(leaf)) {
+                    i = end;
+                    continue;
+                }
+            }
+            PageGuard g = descendToLeaf(keys[order[i]], false, &high);
+            size_t end = groupEnd(order, i, high, key_of);
+            for (size_t j = i; j < end; ++j) {
+                bool overflow = false;
+                lookupLeaf(g.data(), keys[order[j]], res[order[j]], overflow);
+                if (overflow) res[order[j]] = readOverflow(*res[order[j]]);
+            }
+            i = end;
         }
+        return res;
+    }
+
+    // Inserts a batch as one transaction, so with the WAL on its pages are
+    // logged by a single commit. Records are inserted in key order, one
+    // descent per distinct leaf; of a key given twice, the last value
+    // stays. The transaction is committed early when a leaf has to split
+    // or the optimistic descent fails: the latched descent must not wait on
+    // upper levels while this thread keeps leaves latched. Its leaves stay
+    // pinned until it commits, so it also commits
+    // once it has dirtied as many as the frames it could reserve: up to a
+    // quarter of the pool, fewer while other transactions hold frames,
+    // besides those a split may take. Throws if the WAL failed before a
+    // commit was durable; the batch is then partly applied.
+    void multiPut(const std::vector<std::pair<std::string, std::string>>& records) {
+        std::vector<std::pair<std::string, std::string>> batch;
+        batch.reserve(records.size());
+        for (const auto& r : records) {
+            if (checkRecord(r.first, r.second)) batch.push_back(r);
+        }
+        auto key_of = [&](size_t i) -> const std::string& { return batch[i].first; };
+        std::vector<size_t> order = sortedOrder(batch.size(), key_of);
+
+        const size_t max_pages = std::max<size_t>(1, pool.capacity() / 4);
+        const size_t split_pages = BufferPool::TXN_FRAMES;
+        size_t pages = 0; // pages latched by the open transaction
 
-        uint32_t leaf_id = findLeaf(root_id, key);
-        PageHeader* h = (PageHeader*)pool.getPage(leaf_id);
-        size_t needed = sizeof(PageHeader) + (h->num_slots + 1) * sizeof(Slot) + entry_size;
+        // Large values are written out when their record is first tried; a
+        // record that then has to wait for a split keeps its reference.
+        std::vector<std::string> refs(batch.size());
+        auto overflow = [&](size_t k) { return batch[k].second.size() > INLINE_VALUE_MAX; };
+        auto stored = [&](size_t k) -> std::string_view {
+            if (!overflow(k)) return batch[k].second;
+            if (refs[k].empty()) refs[k] = writeOverflow(batch[k].second);
+            return refs[k];
+        };
 
-        if (h->free_space_offset < needed) splitLeaf(leaf_id, key, value);
-        else insertIntoLeaf(leaf_id, key, value);
+        // One transaction per pass; a pass ends where the transaction has to
+        // be committed early. A record whose leaf has to split opens the
+        // next one.
+        size_t i = 0;
+        bool split = false;
+        while (i < order.size()) {
+            // Waits until at least one leaf fits besides a split.
+            TxnScope txn(pool, split_pages + 1, split_pages + max_pages);
+            const size_t pass_pages = txn.reserved() > split_pages ? txn.reserved() - split_pages : 1;
+            pages = 0;
+            if (split) {
+                size_t k = order[i++];
+                putPessimistic(batch[k].first, stored(k), overflow(k));
+                pages = 1;
+                split = false;
+            }
+            while (i < order.size() && pages < pass_pages) {
+                std::optional<std::string> high;
+                PageGuard leaf = tryLockLeafForWrite(batch[order[i]].first, &high);
+                if (!leaf) {
+                    if (pages > 0) break;
+                    leaf = descendToLeaf(batch[order[i]].first, true, &high);
+                }
+                size_t end = groupEnd(order, i, high, key_of);
+                size_t j = i;
+                while (j < end && pages < pass_pages) {
+                    size_t k = order[j];
+                    if (!insertIntoLeaf(leaf.data(), batch[k].first, stored(k), overflow(k))) break;
+                    ++j;
+                }
+                if (j > i) {
+                    leaf.markDirty();
+                    pages++;
+                }
+                leaf.release();
+                i = j;
+                if (j < end && pages < pass_pages) {
+                    split = true;
+                    break;
+                }
+            }
+            commitDurably(txn);
+        }
     }
 
-    std::optional<std::string> get(const std::string& key) {
-        uint32_t leaf_id = findLeaf(root_id, key);
-        char* page_data = pool.getPage(leaf_id);
-        PageHeader* h = (PageHeader*)page_data;
-        Slot* slots = (Slot*)(page_data + sizeof(PageHeader));
-        int idx = findSlotBinary(page_data, key);
-        if (idx < (int)h->num_slots) {
-            char* rec = page_data + slots[idx].offset;
-            uint8_t kLen = (uint8_t)*rec;
-            if (std::string(rec + 1, kLen) == key) {
-                uint8_t vLen = (uint8_t)rec[1 + kLen];
-                return std::string(rec + 2 + kLen, vLen);
+    // Streaming scan over the leaf chain: seek() positions the cursor on
+    // the first key >= its argument, next() advances. Only the current leaf
+    // is pinned and S-latched; leaves are crabbed left to right, so writers
+    // (which never latch leftwards) cannot deadlock with a cursor. key() and
+    // value() view the pinned page and are invalidated by the next move.
+    // A thread must not write to the tree while it holds an open cursor.
+    //
+    // Reverse scans start with seekForPrev() (last key <= its argument) and
+    // move with prev(). Stepping to the previous leaf releases the current
+    // one and descends again to the last key below its lower bound.
+    //
+    // An out-of-line value is read into a buffer owned by the cursor, which
+    // value() then views.
+    class Cursor {
+        BPlusTree* tree = nullptr;
+        PageGuard leaf;
+        int slot = 0;
+        bool sequential = false;
+        bool reverse = false;
+        std::optional<std::string> low; // lower bound of the current leaf, for prev()
+        mutable std::string large_value;
+
+        const char* record() const {
+            const Slot* slots = (const Slot*)(leaf.data() + sizeof(PageHeader));
+            return leaf.data() + slots[slot].offset;
+        }
+
+        // Steps over exhausted (possibly empty) leaves.
+        void settle() {
+            while (leaf && slot >= (int)leaf.header()->num_slots) {
+                uint32_t next_id = leaf.header()->next_sibling;
+                if (next_id == 0) {
+                    close();
+                    return;
+                }
+                PageGuard next = tree->pool.fetchPage(next_id);
+                leaf = std::move(next);
+                slot = 0;
             }
         }
-        return std::nullopt;
+
+        void settleBackward() {
+            while (leaf && slot < 0) {
+                if (!low) {
+                    close();
+                    return;
+                }
+                std::string bound = *low;
+                leaf.release();
+                leaf = tree->descendReverse(bound, true, low);
+                slot = tree->findSlotBinary(leaf.data(), bound) - 1;
+            }
+        }
+
+    public:
+        explicit Cursor(BPlusTree& t) : tree(&t) {}
+        ~Cursor() { close(); }
+
+        Cursor(Cursor&& other) noexcept
+            : tree(other.tree), leaf(std::move(other.leaf)), slot(other.slot),
+              sequential(std::exchange(other.sequential, false)), reverse(other.reverse),
+              low(std::move(other.low)), large_value(std::move(other.large_value)) {}
+        Cursor(const Cursor&) = delete;
+        Cursor& operator=(const Cursor&) = delete;
+
+        void seek(const std::string& key) {
+            close();
+            tree->pool.beginSequentialAccess();
+            sequential = true;
+            reverse = false;
+            leaf = tree->descendToLeaf(key, false);
+            slot = tree->findSlotBinary(leaf.data(), key);
+            settle();
+        }
+
+        void seekForPrev(const std::string& key) {
+            close();
+            reverse = true;
+            leaf = tree->descendReverse(key, false, low);
+            slot = tree->findSlotBinary(leaf.data(), key);
+            while (slot < (int)leaf.header()->num_slots && this->key() == key) slot++;
+            slot--;
+            settleBackward();
+        }
+
+        bool valid() const { return (bool)leaf; }
+
+        void next() {
+            assert(!reverse && "next() on a cursor positioned by seekForPrev()");
+            slot++;
+            settle();
+        }
+
+        void prev() {
+            assert(reverse && "prev() on a cursor positioned by seek()");
+            slot--;
+            settleBackward();
+        }
+
+        std::string_view key() const {
+            const char* rec = record();
+            return std::string_view(rec + 1, (uint8_t)rec[0]);
+        }
+
+        std::string_view value() const {
+            const char* rec = record();
+            if (!LeafNode::isOverflow(rec)) return LeafNode::storedValue(rec);
+            large_value = tree->readOverflow(LeafNode::storedValue(rec));
+            return large_value;
+        }
+
+        // Unpins the current leaf; the cursor is invalid until the next seek.
+        void close() {
+            leaf.release();
+            if (sequential) tree->pool.endSequentialAccess();
+            sequential = false;
+        }
+    };
+
+    Cursor cursor() { return Cursor(*this); }
+
+    // Sorted keys in (start, end] that cut the range into pieces of about
+    // equal size, for scanning it from several threads: the separators of
+    // the highest index levels that hold at least parts - 1 of them in the
+    // range (fewer if the tree is too small). Only a hint under concurrent
+    // writes, but always sorted.
+    std::vector<std::string> splitKeys(const std::string& start, const std::string& end, size_t parts) {
+        std::vector<std::string> keys;
+        for (int depth = 0; keys.size() + 1 < parts; ++depth) {
+            std::vector<std::string> level;
+            std::shared_lock<std::shared_mutex> root_lock(root_latch);
+            PageGuard root = pool.fetchPage(root_id);
+            root_lock.unlock();
+            if (!collectSeparators(root, depth, start, end, level)) break;
+            keys = std::move(level);
+        }
+        return keys;
     }
 
+    // Materializes [start, end]; use a Cursor to stream large ranges.
     std::vector<std::pair<std::string, std::string>> rangeScan(const std::string& start, const std::string& end) {
         std::vector<std::pair<std::string, std::string>> res;
-        uint32_t curr = findLeaf(root_id, start);
+        Cursor c(*this);
+        for (c.seek(start); c.valid() && c.key() <= end; c.next()) res.emplace_back(c.key(), c.value());
+        return res;
+    }
+
+    // Only a delete that leaves its leaf under a quarter full restarts with
+    // exclusive latches from the root, to rebalance. Freed pages, overflow
+    // pages of the value included, are reused by later allocations. Throws
+    // if the WAL failed before the delete was durable.
+    bool remove(const std::string& key) {
+        TxnScope txn(pool);
+        bool erased = false;
+        {
+            PageGuard leaf = lockLeafForWrite(key);
+            int idx = findRecord(leaf.data(), key);
+            if (idx < 0) return false;
+            if (leaf.id() == root_id.load() || !underflowsWithout(leaf.data(), idx)) {
+                eraseRecord(leaf, idx);
+                erased = true;
+            }
+        }
+        if (!erased) erased = removePessimistic(key);
+        commitDurably(txn);
+        return erased;
+    }
+
+    // Builds the tree bottom-up from key-sorted input (pairs of key and
+    // value): leaves are packed to `fill_factor` and written sequentially
+    // with their sibling links, then each internal level is built over the
+    // one below. The pages bypass the pool and the WAL; they are synced
+    // before the meta page, the only logged write, makes them reachable.
+    // Only an empty tree can be loaded. Returns false on unsorted, repeated
+    // or oversized input, leaving the tree unchanged: the input is checked in
+    // a first pass (so `It` must be a forward iterator) before any page is
+    // reserved. Also false, with the tree unchanged, if the pages cannot be
+    // written. The empty root it replaces is freed; like put(), it throws if
+    // the WAL failed before the new root was durable.
+    template <typename It>
+    bool bulkLoad(It first, It last, double fill_factor = 0.9) {
+        fill_factor = std::min(1.0, std::max(0.1, fill_factor));
+        if (!isEmpty()) {
+            std::cerr << "Error: bulkLoad requires an empty tree." << std::endl;
+            return false;
+        }
+        if (first == last) return true;
+        for (It it = first, prev = first; it != last; prev = it++) {
+            if (!checkRecord(it->first, it->second)) return false;
+            if (it != first && !(prev->first < it->first)) {
+                std::cerr << "Error: bulkLoad input is not sorted or repeats key " << it->first << std::endl;
+                return false;
+            }
+        }
+
+        const size_t leaf_budget = (size_t)(fill_factor * PAGE_SIZE);
+        ExtentWriter writer(pool);
+        std::vector<char> page(PAGE_SIZE);
+        std::vector<InternalNode::Entry> level; // separator left of each node, and its id
+        std::vector<std::pair<uint32_t, uint32_t>> reserved; // (first id, count), to release on failure
+        auto reserve = [&](uint32_t count) {
+            uint32_t id = pool.reservePages(count);
+            if (!reserved.empty() && reserved.back().first + reserved.back().second == id) reserved.back().second += count;
+            else reserved.emplace_back(id, count);
+            return id;
+        };
+
+        // Out-of-line values go to their own runs, written like the leaves.
+        auto writeOverflowRun = [&](const std::string& value) {
+            uint32_t count = overflowPages(value.size());
+            OverflowRef ref{reserve(count), (uint32_t)value.size()};
+            std::vector<char> run_page(PAGE_SIZE);
+            for (uint32_t i = 0; i < count; ++i) {
+                std::memset(run_page.data(), 0, PAGE_SIZE);
+                fillOverflowPage(run_page.data(), ref.first_page, i, value);
+                writer.add(ref.first_page + i, run_page.data());
+            }
+            return std::string((const char*)&ref, sizeof(ref));
+        };
+
+        auto startPage = [&](bool is_leaf) {
+            std::memset(page.data(), 0, PAGE_SIZE);
+            PageHeader* h = (PageHeader*)page.data();
+            h->page_id = reserve(1);
+            h->is_leaf = is_leaf;
+            h->free_space_offset = PAGE_SIZE;
+            return h;
+        };
+
+        // 1. Leaves
+        PageHeader* h = startPage(true);
+        std::string prev_key;
+        for (It it = first; it != last; ++it) {
+            const std::string& key = it->first;
+            const std::string& value = it->second;
+            bool overflow = value.size() > INLINE_VALUE_MAX;
+            size_t entry_size = LeafNode::recordSize(key.size(), overflow ? sizeof(OverflowRef) : value.size());
+
+            size_t used = sizeof(PageHeader) + LeafNode::used(page.data()) + sizeof(Slot) + entry_size;
+            if (h->num_slots > 0 && (used > leaf_budget || used > PAGE_SIZE)) {
+                uint32_t next_id = reserve(1);
+                h->next_sibling = next_id;
+                writer.add(h->page_id, page.data());
+                std::memset(page.data(), 0, PAGE_SIZE);
+                h->page_id = next_id;
+                h->is_leaf = true;
+                h->free_space_offset = PAGE_SIZE;
+            }
+            if (h->num_slots == 0) level.push_back({level.empty() ? key : InternalNode::shortestSeparator(prev_key, key), h->page_id});
+
+            if (overflow) LeafNode::insert(page.data(), (int)h->num_slots, key, writeOverflowRun(value), true);
+            else LeafNode::insert(page.data(), (int)h->num_slots, key, value, false);
+            prev_key = key;
+        }
+        writer.add(h->page_id, page.data());
+
+        // 2. Internal levels: each node routes to one lower-bound child plus
+        // as many separated children as fit in `fill_factor` of the page once
+        // their common prefix is factored out.
+        const size_t node_budget = (size_t)(fill_factor * InternalNode::capacity());
+        while (level.size() > 1) {
+            std::vector<InternalNode::Entry> parents;
+            size_t i = 0;
+            while (i < level.size()) {
+                size_t end = i + 1;
+                size_t key_bytes = 0;
+                while (end < level.size()) {
+                    size_t prefix = InternalNode::commonPrefix(level[i + 1].key, level[end].key);
+                    size_t count = end - i;
+                    size_t size = prefix + key_bytes + level[end].key.size() - count * prefix + count * InternalNode::ENTRY_OVERHEAD;
+                    if (end > i + 1 && size > node_budget) break;
+                    key_bytes += level[end++].key.size();
+                }
+                h = startPage(false);
+                InternalNode::write(page.data(), level[i].child, level, i + 1, end);
+                parents.push_back({level[i].key, h->page_id});
+                writer.add(h->page_id, page.data());
+                i = end;
+            }
+            level.swap(parents);
+        }
+        // 3. Publish the new root, unless the pages did not reach the disk
+        // or a put slipped into the empty tree; then they are handed back.
+        if (!writer.flush() || !pool.syncDataFile()) {
+            std::cerr << "Error: bulkLoad could not write the loaded pages." << std::endl;
+        } else {
+            {
+                TxnScope txn(pool);
+                std::unique_lock<std::shared_mutex> root_lock(root_latch);
+                PageGuard old_root = pool.fetchPageForWrite(root_id);
+                if (old_root.header()->is_leaf && old_root.header()->num_slots == 0) {
+                    root_id = level[0].child;
+                    updateMetaPage();
+                    pool.freePage(std::move(old_root));
+                    root_lock.unlock();
+                    commitDurably(txn);
+                    return true;
+                }
+            }
+            std::cerr << "Error: bulkLoad requires an empty tree." << std::endl;
+        }
+        for (auto& r : reserved) pool.releasePages(r.first, r.second);
+        return false;
+    }
+
+    // Share of leaf-chain hops that go to the next page id, i.e. that a
+    // sequential read of db.bin serves; 1 for a single leaf.
+    double sequentialLeafRatio() {
+        PageGuard leaf = descendToLeaf(std::string(), false);
+        size_t hops = 0, sequential = 0;
+        while (uint32_t next_id = leaf.header()->next_sibling) {
+            hops++;
+            sequential += next_id == leaf.id() + 1;
+            leaf = pool.fetchPage(next_id);
+        }
+        return hops == 0 ? 1.0 : (double)sequential / hops;
+    }
+
+    // Average share of a leaf page taken by its header, slots and live
+    // records; bulkLoad() packs leaves to about its fill_factor.
+    double leafFill() {
+        PageGuard leaf = descendToLeaf(std::string(), false);
+        size_t leaves = 0, used = 0;
+        while (true) {
+            leaves++;
+            used += sizeof(PageHeader) + LeafNode::used(leaf.data());
+            uint32_t next_id = leaf.header()->next_sibling;
+            if (next_id == 0) break;
+            leaf = pool.fetchPage(next_id);
+        }
+        return (double)used / (leaves * PAGE_SIZE);
+    }
+
+    struct VacuumStats {
+        uint32_t pages_before = 0; // size of db.bin, in pages
+        uint32_t pages_after = 0;
+        double sequential_before = 0; // sequentialLeafRatio()
+        double sequential_after = 0;
+        uint64_t pages_moved = 0;
+    };
+
+    // Online vacuum: rewrites the leaves in key order into one run of
+    // consecutive pages right behind the inner nodes and overflow pages,
+    // then truncates db.bin. It works in three passes over the leaves:
+    //
+    //   1. every leaf moves, in key order, to a run at the end of the file,
+    //      which clears the low page ids of leaves;
+    //   2. inner nodes and overflow runs move down into the lowest free ids;
+    //   3. the leaves move, in key order, into the free ids behind them.
+    //
+    // The file therefore grows by the leaf count before it shrinks. The
+    // tail left free is then cut off at a checkpoint.
+    //
+    // Each page moves in its own short transaction that latches only the
+    // page, its parent and (for a leaf) its left neighbour, so readers and
+    // writers keep running in between; a page a concurrent split or merge
+    // has touched is simply skipped or tried again. step() does a bounded
+    // amount of that work and returns false once the vacuum has finished.
+    // Call it outside any TxnScope.
+    //
+    //   auto vacuum = db.vacuum();
+    //   while (vacuum.step()) {}
+    //   vacuum.stats();
+    class Vacuum {
+        enum class Phase { LeavesToEnd, PackOthers, LeavesDown, Truncate, Done };
+        static constexpr int MAX_RETRIES = 3;
+
+        BPlusTree* tree;
+        Phase phase = Phase::LeavesToEnd;
+        std::optional<std::string> low; // lower bound of the next leaf, nothing for the leftmost
+        uint32_t prev = 0;              // where the previous leaf of this pass ended up
+        uint32_t run_start = 0;         // pass 1 moves every leaf to this id or above
+        int retries = 0;
+        VacuumStats st;
+
+        // Target of the next leaf in passes 1 and 3, 0 to leave it in place.
+        uint32_t leafTarget(uint32_t leaf_id) {
+            BufferPool& pool = tree->pool;
+            if (prev != 0 && leaf_id == prev + 1) return 0;
+            if (phase == Phase::LeavesToEnd) {
+                if (prev != 0 && pool.nextFreePage(prev + 1) == prev + 1) return prev + 1;
+                return pool.pageCount();
+            }
+            uint32_t target = pool.nextFreePage(prev + 1);
+            return target < leaf_id ? target : 0;
+        }
+
+        // Returns the number of pages moved; false in `done` means try the
+        // same leaf again.
+        size_t visit(Route& r, bool& done) {
+            done = true;
+            if (phase == Phase::PackOthers) {
+                size_t moved = 0;
+                bool stale = false;
+                for (size_t depth = 0; depth < r.nodes.size() && !stale; ++depth) {
+                    uint32_t target = tree->pool.nextFreePage(1);
+                    if (target >= r.nodes[depth]) continue;
+                    stale = !tree->movePage(r, depth, 0, target);
+                    if (!stale) r.nodes[depth] = target;
+                    moved += !stale;
+                }
+                // A split behind pass 1 put this leaf on a low id, where it
+                // would split the run pass 3 lays out; it joins the others.
+                if (!stale && r.leaf < run_start) {
+                    uint32_t left = low ? tree->route(*low, true).leaf : 0;
+                    uint32_t target = tree->pool.nextFreePage(run_start);
+                    if (tree->movePage(r, r.nodes.size(), left, target)) {
+                        r.leaf = target;
+                        moved++;
+                    }
+                }
+                return moved + tree->packOverflow(r.leaf);
+            }
+            uint32_t target = leafTarget(r.leaf);
+            if (target == 0) {
+                prev = r.leaf;
+                return 0;
+            }
+            uint32_t left = low ? tree->route(*low, true).leaf : 0;
+            if (tree->movePage(r, r.nodes.size(), left, target)) {
+                prev = target;
+                return 1;
+            }
+            if (++retries < MAX_RETRIES) {
+                done = false;
+                return 0;
+            }
+            prev = r.leaf; // give up on this one
+            return 0;
+        }
+
+    public:
+        explicit Vacuum(BPlusTree& t) : tree(&t) {
+            st.pages_before = tree->pool.pageCount();
+            run_start = st.pages_before;
+            st.sequential_before = tree->sequentialLeafRatio();
+        }
+
+        // Moves up to `max_pages` pages (and looks at no more than four
+        // times as many leaves).
+        bool step(size_t max_pages = 64) {
+            size_t moved = 0, visited = 0;
+            while (phase != Phase::Done && moved < max_pages && visited < 4 * max_pages) {
+                if (phase == Phase::Truncate) {
+                    st.pages_after = tree->pool.truncateFreeTail();
+                    st.sequential_after = tree->sequentialLeafRatio();
+                    phase = Phase::Done;
+                    break;
+                }
+                Route r = tree->route(low ? *low : std::string(), false);
+                visited++;
+                bool done;
+                moved += visit(r, done);
+                if (!done) continue;
+                retries = 0;
+                if (r.high) {
+                    low = r.high;
+                    continue;
+                }
+                low.reset();
+                prev = 0;
+                phase = (Phase)((int)phase + 1);
+            }
+            st.pages_moved += moved;
+            return phase != Phase::Done;
+        }
+
+        bool done() const { return phase == Phase::Done; }
+        const VacuumStats& stats() const { return st; }
+    };
+
+    Vacuum vacuum() { return Vacuum(*this); }
+
+    // Checks key order within every node and against the separators above
+    // it, plus the order of the leaf chain. Meant for tests: it latches one
+    // page at a time and should run while no writers are active.
+    bool checkInvariants() {
+        uint32_t root;
+        {
+            std::shared_lock<std::shared_mutex> root_lock(root_latch);
+            root = root_id;
+        }
+        if (!checkNode(root, nullptr, nullptr)) return false;
+
+        uint32_t curr = root;
+        while (true) {
+            PageGuard node = pool.fetchPage(curr);
+            if (node.header()->is_leaf) break;
+            curr = node.header()->lower_bound_child;
+        }
+        std::string prev;
+        bool first = true;
         while (curr != 0) {
-            char* data = pool.getPage(curr);
-            PageHeader* h = (PageHeader*)data;
+            PageGuard leaf = pool.fetchPage(curr);
+            char* data = leaf.data();
             Slot* slots = (Slot*)(data + sizeof(PageHeader));
-            for (uint32_t i = findSlotBinary(data, start); i < h->num_slots; ++i) {
+            for (uint32_t i = 0; i < leaf.header()->num_slots; ++i) {
                 char* rec = data + slots[i].offset;
-                uint8_t kLen = (uint8_t)*rec;
-                std::string k(rec + 1, kLen);
-                if (k > end) return res;
-                uint8_t vLen = (uint8_t)rec[1 + kLen];
-                res.push_back({k, std::string(rec + 2 + kLen, vLen)});
+                std::string k(rec + 1, (uint8_t)*rec);
+                if (!first && k < prev) {
+                    std::cerr << "Invariant: leaf chain out of order at " << k << std::endl;
+                    return false;
+                }
+                prev = k;
+                first = false;
             }
-            curr = h->next_sibling;
+            curr = leaf.header()->next_sibling;
         }
-        return res;
-    }
-
-    bool remove(const std::string& key) {
-        uint32_t leaf_id = findLeaf(root_id, key);
-        char* data = pool.getPage(leaf_id);
-        PageHeader* h = (PageHeader*)data;
-        int idx = findSlotBinary(data, key);
-        if (idx >= (int)h->num_slots) return false;
-        Slot* slots = (Slot*)(data + sizeof(PageHeader));
-        char* rec = data + slots[idx].offset;
-        if (std::string(rec + 1, (uint8_t)*rec) != key) return false;
-        if (idx < (int)h->num_slots - 1) {
-            std::memmove(&slots[idx], &slots[idx + 1], (h->num_slots - idx - 1) * sizeof(Slot));
-        }
-        h->num_slots--;
-        defragmentPage(leaf_id);
-        pool.flushPage(leaf_id);
         return true;
     }
+
+    // Writes every dirty page back to db.bin and resets the WAL. False if
+    // that failed; the WAL is then kept.
+    bool checkpoint() { return pool.flushAllPages(); }
+
+    PoolStats poolStats() { return pool.stats(); }
+    void resetPoolStats() { pool.resetStats(); }
 };
 
 #endif
\ No newline at end of file
@@ -1,68 +1,1633 @@
 #ifndef BUFFERPOOL_H
 #define BUFFERPOOL_H
 
-#include <fstream>
-#include <map>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
 #include <string>
-#include <stack>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <unistd.h>
 #include <cstdio>
+#include <sys/mman.h>
 
 #include "Page.h"
+#include "PageIO.h"
+#include "Replacer.h"
+#include "WAL.h"
+
+enum class ReplacementPolicy { Clock, LRUK };
+
+struct PoolOptions {
+    size_t pool_size = 1024;
+    ReplacementPolicy policy = ReplacementPolicy::Clock;
+    IoBackend io_backend = IoBackend::Pread;
+    bool direct_io = false;               // open db.bin with O_DIRECT (bypass the page cache)
+    bool mmap_reads = false;              // serve clean pages straight from an mmap of db.bin
+    size_t writeback_batch = 16;          // dirty frames cleaned per write-back submission
+    bool enable_wal = true;
+    bool sync_commit = true;              // commitTxn waits for the group-commit fsync
+    size_t checkpoint_bytes = 64u << 20;  // checkpoint once the log grows past this
+};
+
+// One contiguous, page-aligned allocation holding every frame. Tries
+// explicit huge pages first, then asks for transparent huge pages, so the
+// frame table costs a handful of TLB entries instead of one per page.
+// Page alignment also makes every frame a valid O_DIRECT buffer.
+class FrameArena {
+    char* base = nullptr;
+    size_t length = 0;
+    bool huge = false;
+
+public:
+    explicit FrameArena(size_t bytes) {
+        const size_t HUGE_PAGE = 2u << 20;
+        if (bytes >= HUGE_PAGE) {
+            size_t rounded = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+            void* p = ::mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                base = (char*)p;
+                length = rounded;
+                huge = true;
+                return;
+            }
+        }
+        length = bytes;
+        void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        base = (char*)p;
+#ifdef MADV_HUGEPAGE
+        ::madvise(base, length, MADV_HUGEPAGE);
+#endif
+    }
+
+    ~FrameArena() {
+        if (base) ::munmap(base, length);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    char* data() const { return base; }
+    bool hugePages() const { return huge; }
+};
+
+struct PoolStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t pages_written = 0;
+    uint64_t free_pages = 0; // on the free list when the stats were taken
+
+    double hitRate() const {
+        uint64_t total = hits + misses;
+        return total == 0 ? 0.0 : (double)hits / total;
+    }
+};
+
+class BufferPool;
+
+// Snapshot taken by BufferPool::readOptimistic().
+struct OptimisticRead {
+    uint32_t page_id = 0;
+    size_t frame_id = 0;
+    uint64_t version = 0;
+    const char* data = nullptr;
+};
+
+// Per-thread state of an open WAL transaction. Pages it modifies stay
+// pinned and exclusively latched until commit, so no other thread can
+// observe (or log) a half-finished structural change.
+struct TxnState {
+    BufferPool* pool = nullptr;
+    int depth = 0;
+    uint64_t txn_id = 0;        // assigned when it logs its first record
+    size_t reserved = 0;        // frames it counts for in the pool's txn_frames
+    std::vector<size_t> held;   // frames kept pinned + X-latched until commit
+    std::vector<size_t> dirty;  // frames whose after-image is logged at commit
+    std::vector<uint32_t> freed; // pages it freed, reusable once it has committed
+    std::vector<std::pair<uint32_t, uint32_t>> freed_runs; // (first, count), cleared after the commit
+};
+
+// RAII pin + latch on a buffered page. fetchPage() takes the frame's latch
+// in shared mode, fetchPageForWrite() in exclusive mode. The page cannot
+// be evicted while a guard referencing it is alive; markDirty() schedules
+// it for write-back and is only allowed on write guards.
+class PageGuard {
+    friend class BufferPool;
+
+    BufferPool* pool = nullptr;
+    uint32_t page_id = 0;
+    size_t frame_id = 0;
+    char* page_data = nullptr;
+    bool dirty = false;
+    bool writable = false;
+    bool owns_latch = false;    // false when the txn already held the X latch
+    bool implicit_txn = false;  // write outside a TxnScope: logged on release
+
+public:
+    PageGuard() = default;
+    ~PageGuard() { release(); }
+
+    PageGuard(const PageGuard&) = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+
+    PageGuard(PageGuard&& other) noexcept { *this = std::move(other); }
+    PageGuard& operator=(PageGuard&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            page_id = other.page_id;
+            frame_id = other.frame_id;
+            page_data = other.page_data;
+            dirty = other.dirty;
+            writable = other.writable;
+            owns_latch = other.owns_latch;
+            implicit_txn = other.implicit_txn;
+            other.pool = nullptr;
+            other.page_data = nullptr;
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return pool != nullptr; }
+    char* data() const { return page_data; }
+    PageHeader* header() const { return (PageHeader*)page_data; }
+    uint32_t id() const { return page_id; }
+    void markDirty() {
+        assert(writable && "page was fetched read-only");
+        dirty = true;
+    }
+    void release();
+};
 
 class BufferPool {
-    std::fstream file;
-    std::map<uint32_t, std::vector<char>> cache;
-    std::stack<uint32_t> free_list;
+    friend class PageGuard;
+
+    static constexpr uint32_t INVALID_PAGE = UINT32_MAX;
+    static constexpr size_t NO_FRAME = SIZE_MAX;
+
+    // Metadata is protected by `mu`; page contents by the frame latch.
+    // `version` is even while the frame is stable and odd while it is
+    // X-latched or being reassigned; optimistic readers validate against it.
+    struct Frame {
+        uint32_t page_id = INVALID_PAGE;
+        char* data = nullptr;      // arena slot, or the page inside the mapping
+        bool mapped = false;       // data points into the read-only mapping
+        bool loading = false;      // I/O in flight; other fetchers wait on load_cv
+        int pin_count = 0;
+        bool dirty = false;
+        bool txn_pending = false;  // modified by an open txn, not yet logged
+        uint64_t log_end = 0;      // WAL must be durable up to here before write-back
+        std::shared_mutex latch;
+        std::atomic<TxnState*> x_owner{nullptr};
+        std::atomic<uint64_t> version{0};
+        std::atomic<bool> touched{false}; // read optimistically since it was last considered for eviction
+    };
+
+    struct alignas(64) HitCounter {
+        std::atomic<uint64_t> n{0};
+    };
+
+    PoolOptions options;
+    std::unique_ptr<PageIO> io;
+    FrameArena arena;                 // pool_size * PAGE_SIZE, allocated up front
+    std::unique_ptr<PageMapping> mapping;
+    uint32_t file_pages = 0;          // pages that exist in db.bin (safe to map)
+    int sequential_scans = 0;
+    std::vector<Frame> frames;
+    std::unordered_map<uint32_t, size_t> page_table;
+    std::vector<size_t> free_frames;
+    std::unique_ptr<Replacer> replacer;
+    std::set<uint32_t> free_list;          // reusable page ids, the lowest first
+    std::vector<uint32_t> free_list_pages; // chain that persists free_list
+    bool free_list_changed = false;
     uint32_t next_page_id = 0;
 
-public:
-    BufferPool(std::string path) {
-        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
-        if (!file.is_open()) {
-            std::ofstream create(path, std::ios::binary);
-            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::mutex mu;
+    std::condition_variable load_cv;
+
+    // Latch-free lookup for optimistic readers: page id -> frame hints,
+    // direct-mapped and possibly stale (a hit is confirmed by the frame's
+    // page_id under its version). Optimistic hits are counted in per-thread
+    // shards so readers do not share a cache line.
+    std::vector<std::atomic<uint64_t>> frame_hints;
+    size_t hint_mask = 0;
+    std::array<HitCounter, 16> optimistic_hits;
+    static inline thread_local size_t hit_shard =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % 16;
+
+    // No-steal write-ahead logging: pages dirtied inside a txn stay resident
+    // until commitTxn() has appended their after-images to the log, so the
+    // data file never contains uncommitted changes and recovery is redo-only.
+    // Txns hold the checkpoint gate shared; a checkpoint takes it exclusively
+    // so it never runs while a txn has unlogged pages.
+    std::unique_ptr<LogManager> wal;
+    std::atomic<uint64_t> txn_counter{0}; // above every txn_id still in the log
+    std::shared_mutex checkpoint_gate;
+    static inline thread_local TxnState* current_txn = nullptr;
+
+    // Admission control. No-steal keeps the pages a txn modifies pinned
+    // until it commits, so a txn reserves frames when it begins and waits
+    // while the open txns' reservations would pass three quarters of the
+    // pool; the rest is left to readers and evictions. A txn that pins
+    // more than it reserved grows its reservation without waiting, as it
+    // holds latches by then. A fetch that still finds every frame pinned
+    // waits for one to be released rather than failing.
+    static constexpr std::chrono::seconds FRAME_WAIT{5};
+    size_t txn_frames = 0;            // reserved by open txns; under mu
+    size_t frame_waiters = 0;
+    uint64_t frames_released = 0;     // progress seen by waiting fetches
+    std::condition_variable frame_cv; // a frame became evictable or a txn committed
+
+    PoolStats pool_stats;
+
+    TxnState* activeTxn() const {
+        return current_txn && current_txn->pool == this ? current_txn : nullptr;
+    }
+
+    uint64_t txnId(TxnState& txn) {
+        if (txn.txn_id == 0) txn.txn_id = ++txn_counter;
+        return txn.txn_id;
+    }
+
+    char* arenaSlot(size_t frame_id) { return arena.data() + frame_id * PAGE_SIZE; }
+    char* frameData(size_t frame_id) { return frames[frame_id].data; }
+
+    static void beginChange(Frame& f) {
+        f.version.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void endChange(Frame& f) { f.version.fetch_add(1, std::memory_order_release); }
+
+    void publishHint(uint32_t page_id, size_t frame_id) {
+        frame_hints[page_id & hint_mask].store(((uint64_t)page_id << 32) | frame_id, std::memory_order_relaxed);
+    }
+
+    void lockExclusive(Frame& f, TxnState* txn) {
+        f.latch.lock();
+        if (txn) f.x_owner.store(txn, std::memory_order_relaxed);
+        beginChange(f);
+    }
+
+    void unlockExclusive(Frame& f) {
+        f.x_owner.store(nullptr, std::memory_order_relaxed);
+        endChange(f);
+        f.latch.unlock();
+    }
+
+    void noteWritten(uint32_t page_id) {
+        if (page_id >= file_pages) file_pages = page_id + 1;
+    }
+
+    // Page 0 has free_space_offset == 0 too, but is never free.
+    static bool isFreePage(const char* page, uint32_t id) {
+        const PageHeader* h = (const PageHeader*)page;
+        return id != 0 && h->page_id == id && h->free_space_offset == 0;
+    }
+
+    // The lowest run of `count` consecutive free ids; 0 if there is none.
+    // Requires mu.
+    uint32_t findFreeRun(uint32_t count) const {
+        auto run = free_list.begin();
+        uint32_t len = 0;
+        for (auto it = free_list.begin(); it != free_list.end(); ++it) {
+            if (len > 0 && *it == *run + len) {
+                len++;
+            } else {
+                run = it;
+                len = 1;
+            }
+            if (len == count) return *run;
         }
-        file.seekg(0, std::ios::end);
-        next_page_id = file.tellg() / PAGE_SIZE;
+        return 0;
+    }
 
-        if (next_page_id == 0) {
-            next_page_id = 1; 
-            std::vector<char> empty_meta(PAGE_SIZE, 0);
-            file.seekp(0);
-            file.write(empty_meta.data(), PAGE_SIZE);
-            file.flush();
+    // Whether ids [first, first + count) are all free or past the end of
+    // the file. Requires mu.
+    bool pagesFree(uint32_t first, uint32_t count) const {
+        for (uint32_t id = first; id < first + count && id < next_page_id; ++id) {
+            if (!free_list.count(id)) return false;
+        }
+        return true;
+    }
+
+    // Takes ids [first, first + count), each either free or past the end of
+    // the file (skipped ids become free). Requires mu.
+    void takePageIds(uint32_t first, uint32_t count) {
+        for (uint32_t id = first; id < first + count; ++id) {
+            if (id >= next_page_id) {
+                for (uint32_t gap = next_page_id; gap < id; ++gap) free_list.insert(gap);
+                next_page_id = id + 1;
+            } else {
+                bool was_free = free_list.erase(id) > 0;
+                assert(was_free && "claimed page is in use");
+                (void)was_free;
+            }
+        }
+        free_list_changed = true;
+    }
+
+    // Takes ids [first, first + count) and creates frames for those not
+    // cached. All ids are taken before the first frame is created, since
+    // that may release `lock`.
+    void claimPages(uint32_t first, uint32_t count, std::vector<size_t>& frame_ids, std::vector<bool>& resident,
+                    std::unique_lock<std::mutex>& lock) {
+        takePageIds(first, count);
+        for (uint32_t id = first; id < first + count; ++id) {
+            size_t frame_id = page_table.count(id) ? NO_FRAME : createFrame(id, lock);
+            resident.push_back(frame_id == NO_FRAME);
+            frame_ids.push_back(resident.back() ? 0 : frame_id);
+        }
+    }
+
+    // A freed page may still be cached, and a stale optimistic reader may
+    // be about to fetch it, so it is latched like any other page and then
+    // cleared. A page created by createFrame() is latched uncontended.
+    PageGuard latchNewPage(uint32_t id, size_t frame_id, bool resident, TxnState* txn, bool implicit_txn) {
+        if (resident) frame_id = pinPage(id, true);
+        PageGuard g = latchFrame(frame_id, true, txn, implicit_txn);
+        if (resident) {
+            std::memset(g.data(), 0, PAGE_SIZE);
+            g.header()->page_id = id;
+            g.header()->free_space_offset = PAGE_SIZE;
         }
+        g.markDirty();
+        return g;
     }
 
-    char* getPage(uint32_t id) {
-        if (cache.count(id)) return cache[id].data();
-        
-        std::vector<char> buffer(PAGE_SIZE, 0);
-        file.seekg(id * PAGE_SIZE);
-        file.read(buffer.data(), PAGE_SIZE);
-        cache[id] = std::move(buffer);
-        return cache[id].data();
+    // Claims ids [first, first + count) and returns them latched; `lock`
+    // holds mu and is released before latching.
+    std::vector<PageGuard> latchNewPages(uint32_t first, uint32_t count, std::unique_lock<std::mutex>& lock) {
+        TxnState* txn = activeTxn();
+        assert((txn || !wal) && "new pages outside a TxnScope");
+        std::vector<size_t> frame_ids;
+        std::vector<bool> resident;
+        claimPages(first, count, frame_ids, resident, lock);
+        lock.unlock();
+        std::vector<PageGuard> pages;
+        pages.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) pages.push_back(latchNewPage(first + i, frame_ids[i], resident[i], txn, false));
+        return pages;
     }
 
-    uint32_t allocatePage() {
-        uint32_t id = next_page_id++;
-        std::vector<char> buffer(PAGE_SIZE, 0);
-        PageHeader* h = (PageHeader*)buffer.data();
+    // A zeroed, pinned frame for the new page `id`, or NO_FRAME if a stale
+    // reader fetched the page while acquireFrame() released `lock`.
+    size_t createFrame(uint32_t id, std::unique_lock<std::mutex>& lock) {
+        if (mapping) mapping->ensureMapped(id); // grow the view along with the file
+        size_t frame_id = acquireFrame(lock);
+        if (page_table.count(id)) {
+            returnFrame(frame_id);
+            return NO_FRAME;
+        }
+        Frame& f = frames[frame_id];
+        useArenaSlot(frame_id);
+        std::memset(f.data, 0, PAGE_SIZE);
+        PageHeader* h = (PageHeader*)f.data;
         h->page_id = id;
         h->free_space_offset = PAGE_SIZE;
-        cache[id] = std::move(buffer);
-        flushPage(id);
-        return id;
+
+        f.page_id = id;
+        f.pin_count = 0;
+        f.dirty = true;
+        f.txn_pending = false;
+        f.log_end = 0;
+        page_table[id] = frame_id;
+        pinFrame(frame_id);
+        endChange(f);
+        publishHint(id, frame_id);
+        return frame_id;
+    }
+
+    // Points a frame that is about to be filled at its own arena slot.
+    void useArenaSlot(size_t frame_id) {
+        frames[frame_id].data = arenaSlot(frame_id);
+        frames[frame_id].mapped = false;
+    }
+
+    // Copy-on-write for mapped frames: dirty pages always live in the arena.
+    // Called with the frame's X latch held.
+    void materialize(size_t frame_id) {
+        Frame& f = frames[frame_id];
+        if (!f.mapped) return;
+        char* slot = arenaSlot(frame_id);
+        std::memcpy(slot, f.data, PAGE_SIZE);
+        f.data = slot;
+        f.mapped = false;
+    }
+
+    // Writes a set of committed dirty frames as one batch submission.
+    // `lock` holds mu and is released around the I/O; the frames must be
+    // pinned and S-latched by the caller so their contents cannot change
+    // underneath the write. If the log failed before their records were
+    // durable, or the write failed, they stay dirty and false is returned.
+    bool writeFrames(const std::vector<size_t>& frame_ids, std::unique_lock<std::mutex>& lock) {
+        if (frame_ids.empty()) return true;
+        uint64_t log_end = 0;
+        std::vector<PageWrite> batch;
+        batch.reserve(frame_ids.size());
+        for (size_t fid : frame_ids) {
+            log_end = std::max(log_end, frames[fid].log_end);
+            batch.push_back({frames[fid].page_id, frameData(fid)});
+        }
+        lock.unlock();
+        bool ok = (!wal || wal->waitDurable(log_end)) && io->writePages(batch);
+        lock.lock();
+        if (!ok) return false;
+        for (size_t fid : frame_ids) {
+            frames[fid].dirty = false;
+            noteWritten(frames[fid].page_id);
+        }
+        pool_stats.pages_written += batch.size();
+        return true;
+    }
+
+    // Cleans the victim together with other write-back candidates (dirty,
+    // unpinned, committed) so eviction write-back leaves in batches. They
+    // are pinned and S-latched for the write, which cannot block: nobody
+    // latches a frame without pinning it first. Releases mu like
+    // writeFrames(). False if the frames stay dirty.
+    bool writeBackForEviction(size_t victim, std::unique_lock<std::mutex>& lock) {
+        std::vector<size_t> batch{victim};
+        for (size_t i = 0; i < frames.size() && batch.size() < options.writeback_batch; ++i) {
+            const Frame& f = frames[i];
+            if (i == victim || f.page_id == INVALID_PAGE || !f.dirty) continue;
+            if (f.pin_count > 0 || f.txn_pending || f.loading) continue;
+            batch.push_back(i);
+        }
+        for (size_t fid : batch) {
+            frames[fid].pin_count++;
+            replacer->setEvictable(fid, false);
+            frames[fid].latch.lock_shared();
+        }
+        bool ok = writeFrames(batch, lock);
+        for (size_t fid : batch) {
+            frames[fid].latch.unlock_shared();
+            frames[fid].pin_count--;
+            updateEvictable(fid);
+        }
+        return ok;
+    }
+
+    // Optimistic reads bypass the replacer and only leave a mark; a marked
+    // victim gets its access recorded and one more chance. False if every
+    // frame is pinned. Requires mu.
+    bool pickVictim(size_t& frame_id) {
+        size_t second_chances = 0;
+        while (true) {
+            if (!replacer->evict(frame_id)) return false;
+            if (!frames[frame_id].touched.load(std::memory_order_relaxed) || second_chances++ >= frames.size()) return true;
+            frames[frame_id].touched.store(false, std::memory_order_relaxed);
+            replacer->recordAccess(frame_id);
+            replacer->setEvictable(frame_id, true);
+        }
+    }
+
+    // Called with mu whenever a frame may have become available.
+    void frameReleased() {
+        if (frame_waiters == 0) return;
+        frames_released++;
+        frame_cv.notify_all();
+    }
+
+    // Waits until another thread releases a frame; the pins usually belong
+    // to txns that are about to commit. Throws if none is released for
+    // FRAME_WAIT: the frames are then pinned by the caller or by threads
+    // that wait themselves.
+    void waitForFrame(std::unique_lock<std::mutex>& lock) {
+        uint64_t seen = frames_released;
+        frame_waiters++;
+        bool released = frame_cv.wait_for(lock, FRAME_WAIT, [&] { return frames_released != seen; });
+        frame_waiters--;
+        if (!released) throw std::runtime_error("BufferPool: all frames are pinned");
+    }
+
+    // Returns a frame that holds no page. A dirty victim is written back
+    // first with `lock` released, so callers must re-check anything they
+    // looked up under it; so does waiting for a frame while every one is
+    // pinned, which `wait` = false turns into an exception right away. The
+    // frame's version is left odd; the caller ends the change once the new
+    // page is in place, or hands the frame back with returnFrame().
+    size_t acquireFrame(std::unique_lock<std::mutex>& lock, bool wait = true) {
+        size_t frame_id;
+        while (true) {
+            if (!free_frames.empty()) {
+                frame_id = free_frames.back();
+                free_frames.pop_back();
+                beginChange(frames[frame_id]);
+                return frame_id;
+            }
+            if (!pickVictim(frame_id)) {
+                if (!wait) throw std::runtime_error("BufferPool: all frames are pinned");
+                waitForFrame(lock);
+                continue;
+            }
+            if (!frames[frame_id].dirty) break;
+            // The victim stays cached while it is written; once clean it is
+            // usually the next one evicted.
+            if (!writeBackForEviction(frame_id, lock)) {
+                throw std::runtime_error("BufferPool: write-back failed, dirty pages cannot be evicted");
+            }
+        }
+        replacer->remove(frame_id);
+        pool_stats.evictions++;
+        Frame& victim = frames[frame_id];
+        beginChange(victim);
+        page_table.erase(victim.page_id);
+        victim.page_id = INVALID_PAGE;
+        victim.mapped = false;
+        victim.touched.store(false, std::memory_order_relaxed);
+        victim.data = arenaSlot(frame_id);
+        return frame_id;
+    }
+
+    // Gives back a frame from acquireFrame() that was not used. Requires mu.
+    void returnFrame(size_t frame_id) {
+        endChange(frames[frame_id]);
+        free_frames.push_back(frame_id);
+        frameReleased();
+    }
+
+    void pinFrame(size_t frame_id) {
+        frames[frame_id].pin_count++;
+        replacer->recordAccess(frame_id);
+        replacer->setEvictable(frame_id, false);
+    }
+
+    void updateEvictable(size_t frame_id) {
+        const Frame& f = frames[frame_id];
+        bool evictable = f.pin_count == 0 && !f.txn_pending && !f.loading;
+        replacer->setEvictable(frame_id, evictable);
+        if (evictable) frameReleased();
+    }
+
+    void unpinFrame(size_t frame_id) {
+        std::lock_guard<std::mutex> lock(mu);
+        Frame& f = frames[frame_id];
+        if (f.pin_count > 0) f.pin_count--;
+        updateEvictable(frame_id);
+    }
+
+    // Undoes a load that failed: the frame goes back to the free frames and
+    // the next fetcher of the page reads it again. Requires mu.
+    void abandonLoad(size_t frame_id) {
+        Frame& f = frames[frame_id];
+        page_table.erase(f.page_id);
+        f.page_id = INVALID_PAGE;
+        f.pin_count = 0;
+        f.loading = false;
+        f.touched.store(false, std::memory_order_relaxed);
+        f.data = arenaSlot(frame_id);
+        replacer->remove(frame_id);
+        returnFrame(frame_id);
+    }
+
+    // Pins page `id`, loading it if necessary. I/O happens outside `mu`;
+    // concurrent fetchers of the same page wait until it has arrived.
+    // Throws if the page cannot be read.
+    size_t pinPage(uint32_t id, bool for_write) {
+        std::unique_lock<std::mutex> lock(mu);
+        size_t frame_id;
+        while (true) {
+            auto it = page_table.find(id);
+            if (it == page_table.end()) {
+                frame_id = acquireFrame(lock);
+                if (!page_table.count(id)) break;
+                returnFrame(frame_id); // loaded by someone else meanwhile
+                continue;
+            }
+            if (frames[it->second].loading) {
+                load_cv.wait(lock);
+                continue;
+            }
+            pool_stats.hits++;
+            pinFrame(it->second);
+            return it->second;
+        }
+        pool_stats.misses++;
+
+        Frame& f = frames[frame_id];
+        f.page_id = id;
+        f.dirty = false;
+        f.txn_pending = false;
+        f.log_end = 0;
+        page_table[id] = frame_id;
+        pinFrame(frame_id);
+
+        // With mmap_reads, a read-only fetch of a clean page returns a
+        // pointer into the mapping and copies nothing.
+        const char* mapped_src = nullptr;
+        if (mapping && id < file_pages && mapping->ensureMapped(id)) mapped_src = mapping->page(id);
+        if (mapped_src && !for_write) {
+            f.data = (char*)mapped_src;
+            f.mapped = true;
+            endChange(f);
+            publishHint(id, frame_id);
+            return frame_id;
+        }
+
+        useArenaSlot(frame_id);
+        f.loading = true;
+        lock.unlock();
+        bool ok = true;
+        if (mapped_src) std::memcpy(f.data, mapped_src, PAGE_SIZE);
+        else ok = io->readPage(id, f.data);
+        lock.lock();
+        if (!ok) {
+            abandonLoad(frame_id);
+            load_cv.notify_all();
+            throw std::runtime_error("BufferPool: cannot read page " + std::to_string(id));
+        }
+        f.loading = false;
+        endChange(f);
+        publishHint(id, frame_id);
+        load_cv.notify_all();
+        return frame_id;
+    }
+
+    // Appends one page image as its own committed txn. Used for writes made
+    // outside a TxnScope; the caller holds the page's X latch.
+    void logSinglePage(size_t frame_id) {
+        uint64_t txn_id = ++txn_counter;
+        char* data = frameData(frame_id);
+        uint32_t page_id = frames[frame_id].page_id;
+        uint64_t end_lsn = wal->append([&](uint64_t lsn, std::string& out) {
+            ((PageHeader*)data)->page_lsn = lsn;
+            LogManager::encode(out, LogRecordType::PageImage, lsn, txn_id, page_id, data, PAGE_SIZE);
+            lsn += LogManager::recordSize(PAGE_SIZE);
+            LogManager::encode(out, LogRecordType::Commit, lsn, txn_id, 0, nullptr, 0);
+        });
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            frames[frame_id].log_end = end_lsn;
+        }
+        if (options.sync_commit) wal->waitDurable(end_lsn);
+    }
+
+    // Pins and X-latches page `id` for a full rewrite and hands back its
+    // frame zeroed but for page_id. The old contents are not read: nothing
+    // reachable points at the page (an overflow run being written or
+    // freed). endRewrite() marks it dirty and unpins it.
+    size_t beginRewrite(uint32_t id) {
+        size_t frame_id;
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            frame_id = page_table.count(id) ? NO_FRAME : createFrame(id, lock);
+        }
+        if (frame_id == NO_FRAME) frame_id = pinPage(id, true);
+        Frame& f = frames[frame_id];
+        lockExclusive(f, nullptr);
+        materialize(frame_id);
+        std::memset(f.data, 0, PAGE_SIZE);
+        ((PageHeader*)f.data)->page_id = id;
+        return frame_id;
+    }
+
+    // `log_end`: the WAL must be durable up to here before write-back.
+    void endRewrite(size_t frame_id, uint64_t log_end) {
+        Frame& f = frames[frame_id];
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            f.dirty = true;
+            f.log_end = log_end;
+        }
+        unlockExclusive(f);
+        unpinFrame(frame_id);
+    }
+
+    // Rewrites a freed run as free pages, stamped with the LSN of its
+    // FreeRun record, and puts it on the free list.
+    void clearRun(uint32_t first, uint32_t count, uint64_t lsn, uint64_t log_end) {
+        for (uint32_t id = first; id < first + count; ++id) {
+            size_t frame_id = beginRewrite(id);
+            ((PageHeader*)frameData(frame_id))->page_lsn = lsn;
+            endRewrite(frame_id, log_end);
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        for (uint32_t id = first; id < first + count; ++id) free_list.insert(id);
+        free_list_changed = true;
+    }
+
+    void releaseGuard(PageGuard& g) {
+        Frame& f = frames[g.frame_id];
+        TxnState* txn = activeTxn();
+
+        if (!g.writable) {
+            if (g.owns_latch) f.latch.unlock_shared();
+            unpinFrame(g.frame_id);
+            return;
+        }
+
+        if (txn) {
+            if (g.dirty) {
+                std::lock_guard<std::mutex> lock(mu);
+                assert(!f.mapped && "dirty pages must be copied out of the mapping");
+                f.dirty = true;
+                if (wal && !f.txn_pending) {
+                    f.txn_pending = true;
+                    txn->dirty.push_back(g.frame_id);
+                }
+            }
+            if (g.owns_latch && f.txn_pending) {
+                txn->held.push_back(g.frame_id); // pin and latch now belong to the txn
+                if (txn->held.size() > txn->reserved) {
+                    std::lock_guard<std::mutex> lock(mu);
+                    txn_frames++;
+                    txn->reserved++;
+                }
+                return;
+            }
+            if (g.owns_latch) unlockExclusive(f);
+            unpinFrame(g.frame_id);
+            return;
+        }
+
+        if (g.dirty) {
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                f.dirty = true;
+            }
+            if (wal) logSinglePage(g.frame_id);
+        }
+        unlockExclusive(f);
+        unpinFrame(g.frame_id);
+        if (g.implicit_txn) checkpoint_gate.unlock_shared();
+    }
+
+    // Latches a pinned frame and wraps it in a guard. A txn that already
+    // holds the frame's X latch (it modified the page earlier) re-enters
+    // without latching again.
+    PageGuard latchFrame(size_t frame_id, bool for_write, TxnState* txn, bool implicit_txn) {
+        Frame& f = frames[frame_id];
+        bool reentrant = txn && f.x_owner.load(std::memory_order_relaxed) == txn;
+        if (!reentrant) {
+            if (for_write) lockExclusive(f, txn);
+            else f.latch.lock_shared();
+        }
+        if (for_write) materialize(frame_id);
+
+        PageGuard g;
+        g.pool = this;
+        g.page_id = f.page_id;
+        g.frame_id = frame_id;
+        g.page_data = f.data;
+        g.writable = for_write;
+        g.owns_latch = !reentrant;
+        g.implicit_txn = implicit_txn;
+        return g;
+    }
+
+    PageGuard fetch(uint32_t id, bool for_write) {
+        TxnState* txn = activeTxn();
+        bool implicit_txn = for_write && !txn && wal;
+        if (implicit_txn) checkpoint_gate.lock_shared();
+        size_t frame_id;
+        try {
+            frame_id = pinPage(id, for_write);
+        } catch (...) {
+            if (implicit_txn) checkpoint_gate.unlock_shared();
+            throw;
+        }
+        return latchFrame(frame_id, for_write, txn, implicit_txn);
+    }
+
+    static bool isImage(const LogRecord& rec) {
+        return rec.type == LogRecordType::PageImage || rec.type == LogRecordType::NewPage;
+    }
+
+    // Recovery: rewrites page `id` as a free page stamped `lsn`, unless a
+    // change logged after `lsn` has reached it.
+    void freeRecovered(uint32_t id, uint64_t lsn) {
+        if (id >= next_page_id) next_page_id = id + 1;
+        size_t frame_id = pinPage(id, true);
+        char* data = frameData(frame_id);
+        if (((PageHeader*)data)->page_lsn <= lsn) {
+            std::memset(data, 0, PAGE_SIZE);
+            ((PageHeader*)data)->page_id = id;
+            ((PageHeader*)data)->page_lsn = lsn;
+            frames[frame_id].dirty = true;
+        }
+        unpinFrame(frame_id);
+    }
+
+    // Analysis + redo. Besides complete commit groups and a torn tail, the
+    // log holds the NewPage images of overflow runs written by txns still
+    // open at the crash. Every image followed by its commit record is
+    // replayed when it is newer than the page on disk, and every committed
+    // FreeRun frees its pages again. No undo pass is needed because
+    // uncommitted pages are never written back (no-steal); the only
+    // exception are the NewPage runs, which nothing reachable points at
+    // until their txn commits, so those of txns that never did are freed.
+    // Records are matched to their commit by txn_id, so new txns number on
+    // from the highest id in the log: if the checkpoint at the end fails,
+    // the log is kept, and a commit reusing the id of a txn that never
+    // committed would have its records redone by the next recovery.
+    // Runs single-threaded from the constructor.
+    void recover() {
+        std::vector<LogRecord> records = wal->readAll();
+        std::unordered_set<uint64_t> committed;
+        for (const auto& rec : records) {
+            if (rec.type == LogRecordType::Commit) committed.insert(rec.txn_id);
+            if (rec.txn_id > txn_counter) txn_counter = rec.txn_id;
+        }
+
+        std::vector<uint32_t> redo_pages;
+        for (const auto& rec : records) {
+            if (isImage(rec) && committed.count(rec.txn_id)) redo_pages.push_back(rec.page_id);
+        }
+        std::sort(redo_pages.begin(), redo_pages.end());
+        redo_pages.erase(std::unique(redo_pages.begin(), redo_pages.end()), redo_pages.end());
+        prefetchPages(redo_pages);
+
+        std::vector<uint32_t> freed;
+        for (const auto& rec : records) {
+            if (!committed.count(rec.txn_id)) continue;
+            if (rec.type == LogRecordType::FreeRun && rec.payload.size() == sizeof(uint32_t)) {
+                uint32_t count;
+                std::memcpy(&count, rec.payload.data(), sizeof(count));
+                for (uint32_t id = rec.page_id; id < rec.page_id + count; ++id) {
+                    freeRecovered(id, rec.lsn);
+                    freed.push_back(id);
+                }
+                continue;
+            }
+            if (!isImage(rec) || rec.payload.size() != PAGE_SIZE) continue;
+            if (rec.page_id >= next_page_id) next_page_id = rec.page_id + 1;
+            if (isFreePage(rec.payload.data(), rec.page_id)) freed.push_back(rec.page_id);
+
+            size_t frame_id = pinPage(rec.page_id, true);
+            char* data = frameData(frame_id);
+            if (((PageHeader*)data)->page_lsn < rec.lsn) {
+                std::memcpy(data, rec.payload.data(), PAGE_SIZE);
+                frames[frame_id].dirty = true;
+            }
+            unpinFrame(frame_id);
+        }
+        for (const auto& rec : records) {
+            if (rec.type != LogRecordType::NewPage || committed.count(rec.txn_id) || rec.page_id >= next_page_id) continue;
+            freeRecovered(rec.page_id, rec.lsn);
+            freed.push_back(rec.page_id);
+        }
+        if (!records.empty()) {
+            verifyFreeList(freed);
+            flushAllPages();
+        }
+    }
+
+    // Reads the free list saved by the last checkpoint. Runs from the
+    // constructor before any frame is in use, so frame 0's slot is scratch.
+    void loadFreeList() {
+        char* page = arenaSlot(0);
+        if (!io->readPage(0, page)) throw std::runtime_error("BufferPool: cannot read the meta page");
+        uint32_t id = ((MetaPage*)page)->free_list_page;
+        while (id != 0 && id < next_page_id && free_list_pages.size() < next_page_id) {
+            if (!io->readPage(id, page)) throw std::runtime_error("BufferPool: cannot read the free list");
+            const PageHeader* h = (const PageHeader*)page;
+            if (h->page_id != id) break;
+            free_list_pages.push_back(id);
+            const uint32_t* ids = (const uint32_t*)(page + sizeof(PageHeader));
+            for (size_t i = 0; i < std::min<size_t>(h->num_slots, FREE_IDS_PER_PAGE); ++i) {
+                if (ids[i] != 0 && ids[i] < next_page_id) free_list.insert(ids[i]);
+            }
+            id = h->next_sibling;
+        }
+    }
+
+    // Highest LSN stamped on a page of the file. Reads every page; runs
+    // from the constructor, like loadFreeList(), when the log has to be
+    // restarted from scratch.
+    uint64_t maxPageLsn() {
+        char* page = arenaSlot(0);
+        uint64_t lsn = 0;
+        for (uint32_t id = 0; id < next_page_id; ++id) {
+            if (!io->readPage(id, page)) throw std::runtime_error("BufferPool: cannot read page " + std::to_string(id));
+            uint64_t page_lsn = ((const PageHeader*)page)->page_lsn; // copied: the packed field is misaligned
+            lsn = std::max(lsn, page_lsn);
+        }
+        return lsn;
+    }
+
+    // After a crash the saved list may name pages reused since the
+    // checkpoint and lacks the pages freed since. Keeps every listed or
+    // freshly freed page that the recovered file still marks as free.
+    void verifyFreeList(std::vector<uint32_t> candidates) {
+        candidates.insert(candidates.end(), free_list.begin(), free_list.end());
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        prefetchPages(candidates);
+        free_list.clear();
+        for (uint32_t id : candidates) {
+            if (std::find(free_list_pages.begin(), free_list_pages.end(), id) != free_list_pages.end()) continue;
+            size_t frame_id = pinPage(id, false);
+            if (isFreePage(frameData(frame_id), id)) free_list.insert(id);
+            unpinFrame(frame_id);
+        }
+        free_list_changed = true;
+    }
+
+    // Rewrites a page without logging it; for checkpoints, which write it
+    // back right away.
+    template <typename Fill>
+    void rewritePage(uint32_t id, Fill fill) {
+        size_t frame_id = pinPage(id, true);
+        Frame& f = frames[frame_id];
+        lockExclusive(f, nullptr);
+        materialize(frame_id);
+        fill(f.data);
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            f.dirty = true;
+        }
+        unlockExclusive(f);
+        unpinFrame(frame_id);
+    }
+
+    // Writes the free list to its page chain, which grows with the highest
+    // pages on the list, so a vacuum finds the low ids free for its leaves,
+    // and links the chain from page 0. Checkpoints call it
+    // holding the gate exclusively, so no txn has these pages latched.
+    // Without the WAL the saved list is exact only if no writer runs
+    // concurrently, as during the final checkpoint.
+    void saveFreeList() {
+        std::vector<uint32_t> ids, chain;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (!free_list_changed) return;
+            free_list_changed = false;
+            while (free_list_pages.size() * FREE_IDS_PER_PAGE < free_list.size()) {
+                free_list_pages.push_back(*free_list.rbegin());
+                free_list.erase(std::prev(free_list.end()));
+            }
+            ids.assign(free_list.begin(), free_list.end());
+            chain = free_list_pages;
+        }
+        for (size_t k = 0; k < chain.size(); ++k) {
+            rewritePage(chain[k], [&](char* page) {
+                size_t begin = std::min(ids.size(), k * FREE_IDS_PER_PAGE);
+                size_t n = std::min(ids.size() - begin, FREE_IDS_PER_PAGE);
+                std::memset(page, 0, PAGE_SIZE);
+                PageHeader* h = (PageHeader*)page;
+                h->page_id = chain[k];
+                h->next_sibling = k + 1 < chain.size() ? chain[k + 1] : 0;
+                h->num_slots = (uint32_t)n;
+                h->free_space_offset = PAGE_SIZE;
+                if (n > 0) std::memcpy(page + sizeof(PageHeader), ids.data() + begin, n * sizeof(uint32_t));
+            });
+        }
+        rewritePage(0, [&](char* page) { ((MetaPage*)page)->free_list_page = chain.empty() ? 0 : chain[0]; });
+    }
+
+    // Body of a checkpoint; the caller holds the gate (with the WAL on).
+    // If a page cannot be written or db.bin cannot be synced, the log is
+    // kept for redo and false is returned.
+    bool writeCheckpoint() {
+        saveFreeList();
+
+        std::vector<size_t> dirty;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (size_t i = 0; i < frames.size(); ++i) {
+                const Frame& f = frames[i];
+                if (f.page_id == INVALID_PAGE || !f.dirty || f.txn_pending || f.loading) continue;
+                pinFrame(i);
+                dirty.push_back(i);
+            }
+        }
+        std::sort(dirty.begin(), dirty.end(), [&](size_t a, size_t b) {
+            return frames[a].page_id < frames[b].page_id;
+        });
+
+        // Frames are S-latched a batch at a time. Blocking on a latch only
+        // happens with nothing else held, so a writer running without the
+        // WAL (and thus without the gate) cannot deadlock against us.
+        std::vector<size_t> batch;
+        bool written = true;
+        auto writeBatch = [&] {
+            std::unique_lock<std::mutex> lock(mu);
+            std::vector<size_t> still_dirty;
+            for (size_t fid : batch) {
+                if (frames[fid].dirty) still_dirty.push_back(fid);
+            }
+            written = writeFrames(still_dirty, lock) && written;
+            for (size_t fid : batch) {
+                frames[fid].latch.unlock_shared();
+                frames[fid].pin_count--;
+                updateEvictable(fid);
+            }
+            batch.clear();
+        };
+        for (size_t fid : dirty) {
+            if (!frames[fid].latch.try_lock_shared()) {
+                writeBatch();
+                frames[fid].latch.lock_shared();
+            }
+            batch.push_back(fid);
+        }
+        writeBatch();
+        if (!syncDataFile() || !written) {
+            std::cerr << "BufferPool: checkpoint failed, the log is kept" << std::endl;
+            return false;
+        }
+        if (wal) wal->truncate();
+        return true;
+    }
+
+    // Forgets the cached copy of a free page without writing it back, for
+    // truncation. False if someone is using the frame. Requires mu.
+    bool dropFrame(size_t frame_id) {
+        Frame& f = frames[frame_id];
+        if (f.pin_count > 0 || f.loading || f.txn_pending) return false;
+        replacer->remove(frame_id);
+        beginChange(f);
+        page_table.erase(f.page_id);
+        f.page_id = INVALID_PAGE;
+        f.dirty = false;
+        f.mapped = false;
+        f.touched.store(false, std::memory_order_relaxed);
+        f.data = arenaSlot(frame_id);
+        endChange(f);
+        free_frames.push_back(frame_id);
+        return true;
+    }
+
+public:
+    BufferPool(std::string path, const PoolOptions& opts = PoolOptions())
+        : options(opts), arena(std::max<size_t>(opts.pool_size, 1) * PAGE_SIZE), frames(opts.pool_size) {
+        size_t pool_size = options.pool_size;
+        if (pool_size == 0) throw std::invalid_argument("BufferPool: pool_size must be positive");
+        if (options.mmap_reads && options.direct_io) {
+            std::cerr << "BufferPool: mmap_reads needs the page cache, ignoring direct_io" << std::endl;
+            options.direct_io = false;
+        }
+        for (size_t i = 0; i < pool_size; ++i) frames[i].data = arenaSlot(i);
+        size_t hint_slots = 1;
+        while (hint_slots < 2 * pool_size) hint_slots <<= 1;
+        frame_hints = std::vector<std::atomic<uint64_t>>(hint_slots);
+        for (auto& h : frame_hints) h.store(UINT64_MAX, std::memory_order_relaxed);
+        hint_mask = hint_slots - 1;
+        if (options.policy == ReplacementPolicy::LRUK) replacer = std::make_unique<LRUKReplacer>(pool_size, 2);
+        else replacer = std::make_unique<ClockReplacer>(pool_size);
+        for (size_t i = pool_size; i > 0; --i) free_frames.push_back(i - 1);
+
+        io = makePageIO(options.io_backend, path, options.direct_io);
+        next_page_id = io->pageCount();
+
+        if (next_page_id == 0) {
+            next_page_id = 1;
+            char* empty_meta = arenaSlot(0); // aligned scratch; no frame is in use yet
+            std::memset(empty_meta, 0, PAGE_SIZE);
+            if (!io->writePage(0, empty_meta) || !io->sync()) {
+                throw std::runtime_error("BufferPool: cannot initialize " + path);
+            }
+        }
+        file_pages = next_page_id;
+
+        if (options.mmap_reads) {
+            mapping = std::make_unique<PageMapping>(path);
+            if (!mapping->valid() || !mapping->ensureMapped(next_page_id)) mapping.reset();
+        }
+
+        loadFreeList();
+        if (options.enable_wal) {
+            // A lost log restarts above every page's LSN, or redo would
+            // skip the records logged from then on.
+            wal = std::make_unique<LogManager>(path + ".wal", [&] { return maxPageLsn() + 1; });
+            recover();
+        }
+    }
+
+    ~BufferPool() { flushAllPages(); }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PageGuard fetchPage(uint32_t id) { return fetch(id, false); }
+    PageGuard fetchPageForWrite(uint32_t id) { return fetch(id, true); }
+
+    // Optimistic access for latch-free readers: readOptimistic() snapshots
+    // a resident page's frame version without pinning or latching it, and
+    // everything read from `data` is only trustworthy once validate()
+    // confirms that no writer or eviction touched the frame in between.
+    // Returns false if the page is not resident or is being modified.
+    bool readOptimistic(uint32_t id, OptimisticRead& r) {
+        uint64_t hint = frame_hints[id & hint_mask].load(std::memory_order_relaxed);
+        if ((uint32_t)(hint >> 32) != id) return false;
+        r.frame_id = (size_t)(hint & 0xFFFFFFFFu);
+        Frame& f = frames[r.frame_id];
+        r.version = f.version.load(std::memory_order_acquire);
+        if (r.version & 1) return false;
+        if (f.page_id != id) return false;
+        r.page_id = id;
+        r.data = f.data;
+        if (!f.touched.load(std::memory_order_relaxed)) f.touched.store(true, std::memory_order_relaxed);
+        optimistic_hits[hit_shard].n.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool validate(const OptimisticRead& r) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return frames[r.frame_id].version.load(std::memory_order_relaxed) == r.version;
+    }
+
+    // Bulk loading: reserves `count` consecutive page ids that bypass the
+    // frames and the WAL. The caller writes them with writeExtent() and
+    // syncs before logging the page that makes them reachable.
+    uint32_t reservePages(uint32_t count) {
+        std::lock_guard<std::mutex> lock(mu);
+        uint32_t first = next_page_id;
+        next_page_id += count;
+        if (mapping) mapping->ensureMapped(next_page_id - 1);
+        return first;
+    }
+
+    bool writeExtent(uint32_t first_id, const char* buf, uint32_t count) {
+        if (!io->writeExtent(first_id, buf, count)) return false;
+        std::lock_guard<std::mutex> lock(mu);
+        noteWritten(first_id + count - 1);
+        pool_stats.pages_written += count;
+        return true;
+    }
+
+    // Hands back reserved ids that were never made reachable: they are
+    // written out as free pages and join the free list. Ids that cannot be
+    // written as free pages are left out of it (false).
+    bool releasePages(uint32_t first_id, uint32_t count) {
+        const uint32_t chunk = std::min<uint32_t>(count, 64);
+        FrameArena buf((size_t)chunk * PAGE_SIZE);
+        for (uint32_t done = 0; done < count; done += chunk) {
+            uint32_t n = std::min(chunk, count - done);
+            std::memset(buf.data(), 0, (size_t)n * PAGE_SIZE);
+            for (uint32_t i = 0; i < n; ++i) ((PageHeader*)(buf.data() + (size_t)i * PAGE_SIZE))->page_id = first_id + done + i;
+            if (!writeExtent(first_id + done, buf.data(), n)) return false;
+        }
+        if (!io->sync()) return false;
+        std::lock_guard<std::mutex> lock(mu);
+        for (uint32_t i = 0; i < count; ++i) free_list.insert(first_id + i);
+        free_list_changed = true;
+        return true;
+    }
+
+    bool syncDataFile() { return io->sync(); }
+
+    // madvise hint for the mapping: range scans switch it to sequential
+    // read-ahead while they run, point lookups want no read-ahead at all.
+    void beginSequentialAccess() {
+        std::lock_guard<std::mutex> lock(mu);
+        if (mapping && sequential_scans++ == 0) mapping->setPattern(AccessPattern::Sequential);
+    }
+
+    void endSequentialAccess() {
+        std::lock_guard<std::mutex> lock(mu);
+        if (mapping && --sequential_scans == 0) mapping->setPattern(AccessPattern::Random);
+    }
+
+    // Read-ahead: loads the non-resident pages among `ids` with one batch
+    // submission and leaves them unpinned. At most a quarter of the pool is
+    // used so read-ahead cannot flush the working set.
+    void prefetchPages(const std::vector<uint32_t>& ids) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (mapping) {
+            for (uint32_t id : ids) {
+                if (id < file_pages) mapping->willNeed(id);
+            }
+            return;
+        }
+        std::vector<PageRead> batch;
+        std::vector<size_t> batch_frames;
+        size_t limit = std::max<size_t>(1, frames.size() / 4);
+        for (uint32_t id : ids) {
+            if (batch.size() >= limit) break;
+            if (id == 0 || id >= next_page_id || page_table.count(id)) continue;
+            size_t frame_id;
+            try {
+                frame_id = acquireFrame(lock, false);
+            } catch (const std::runtime_error&) {
+                break;
+            }
+            if (page_table.count(id)) {
+                returnFrame(frame_id);
+                continue;
+            }
+            Frame& f = frames[frame_id];
+            useArenaSlot(frame_id);
+            f.page_id = id;
+            f.dirty = false;
+            f.txn_pending = false;
+            f.log_end = 0;
+            f.loading = true;
+            page_table[id] = frame_id;
+            batch.push_back({id, f.data});
+            batch_frames.push_back(frame_id);
+        }
+        lock.unlock();
+        bool ok = io->readPages(batch);
+        lock.lock();
+        for (size_t frame_id : batch_frames) {
+            if (!ok) { // read-ahead only: the fetch that needs the page reports the error
+                abandonLoad(frame_id);
+                continue;
+            }
+            frames[frame_id].loading = false;
+            endChange(frames[frame_id]);
+            publishHint(frames[frame_id].page_id, frame_id);
+            replacer->recordAccess(frame_id);
+            updateEvictable(frame_id);
+        }
+        load_cv.notify_all();
+    }
+
+
+    // New pages are created directly in a frame and returned X-latched and
+    // dirty; they reach the file on eviction or at the next checkpoint.
+    // Inside a txn the page is logged at commit like any other it modified.
+    // Freed pages are reused before the file grows.
+    PageGuard newPage() {
+        TxnState* txn = activeTxn();
+        bool implicit_txn = !txn && wal;
+        if (implicit_txn) checkpoint_gate.lock_shared();
+
+        uint32_t id;
+        std::vector<size_t> frame_ids;
+        std::vector<bool> resident;
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            id = findFreeRun(1);
+            if (id == 0) id = next_page_id;
+            claimPages(id, 1, frame_ids, resident, lock);
+        }
+        return latchNewPage(id, frame_ids[0], resident[0], txn, implicit_txn);
+    }
+
+    // Overflow runs: `count` new pages with consecutive ids, so that they
+    // can be read back with one batch. fill(page, first, i) fills page i,
+    // handed over zeroed but for page_id. Each page is logged and unpinned
+    // before the next one is created, so a run does not have to fit in the
+    // pool: with the WAL on the image is a NewPage record of the caller's
+    // TxnScope, redone only if the txn commits. Nothing reachable points
+    // at the run before then, so its pages may be written back early.
+    // `first` asks for the run at that id (0: the lowest free run, else
+    // the end of the file). Returns the first id, or 0 if one of the
+    // requested ids has been taken.
+    template <typename Fill>
+    uint32_t newRun(uint32_t count, Fill fill, uint32_t first = 0) {
+        TxnState* txn = activeTxn();
+        assert((txn || !wal) && "new pages outside a TxnScope");
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (first != 0 && !pagesFree(first, count)) return 0;
+            if (first == 0) first = findFreeRun(count);
+            if (first == 0) first = next_page_id;
+            takePageIds(first, count);
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            size_t frame_id = beginRewrite(first + i);
+            char* data = frameData(frame_id);
+            ((PageHeader*)data)->free_space_offset = PAGE_SIZE;
+            fill(data, first, i);
+            uint64_t end_lsn = 0;
+            if (wal) {
+                uint64_t txn_id = txnId(*txn);
+                end_lsn = wal->append([&](uint64_t lsn, std::string& out) {
+                    ((PageHeader*)data)->page_lsn = lsn;
+                    LogManager::encode(out, LogRecordType::NewPage, lsn, txn_id, first + i, data, PAGE_SIZE);
+                });
+            }
+            endRewrite(frame_id, end_lsn);
+        }
+        return first;
+    }
+
+    // Frees a run from newRun() without pinning it. Inside a txn the run
+    // is logged at commit and joins the free list after it.
+    void freeRun(uint32_t first, uint32_t count) {
+        if (TxnState* txn = activeTxn()) {
+            txn->freed_runs.emplace_back(first, count);
+            return;
+        }
+        assert(!wal && "freeRun outside a TxnScope");
+        clearRun(first, count, 0, 0);
+    }
+
+    // Vacuum: new pages at chosen ids, which must be free or past the end
+    // of the file (see nextFreePage()); empty if another thread has taken
+    // one of them since. Like newPage() they are X-latched and dirty; with
+    // the WAL on they must belong to a TxnScope, which logs them at commit.
+    std::vector<PageGuard> newPagesAt(uint32_t first, uint32_t count) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (!pagesFree(first, count)) return {};
+        return latchNewPages(first, count, lock);
+    }
+
+    // The lowest free id at or above `from`; ids past the end of the file
+    // count as free.
+    uint32_t nextFreePage(uint32_t from) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = free_list.lower_bound(from);
+        return it != free_list.end() ? *it : std::max(from, next_page_id);
+    }
+
+    // The lowest run of `count` free ids inside the file, 0 if none.
+    uint32_t lowestFreeRun(uint32_t count) {
+        std::lock_guard<std::mutex> lock(mu);
+        return findFreeRun(count);
+    }
+
+    // Pages in use or free, i.e. the size db.bin grows to.
+    uint32_t pageCount() {
+        std::lock_guard<std::mutex> lock(mu);
+        return next_page_id;
+    }
+
+    // Returns a page to the free list. It is rewritten as a free page, and
+    // inside a txn its id becomes reusable once the txn has committed.
+    void freePage(PageGuard page) {
+        uint32_t id = page.id();
+        std::memset(page.data(), 0, PAGE_SIZE);
+        page.header()->page_id = id;
+        page.markDirty();
+        if (TxnState* txn = activeTxn()) {
+            txn->freed.push_back(id);
+            return;
+        }
+        page.release();
+        std::lock_guard<std::mutex> lock(mu);
+        free_list.insert(id);
+        free_list_changed = true;
+    }
+
+    uint32_t allocatePage() { return newPage().id(); }
+
+    // Frames a txn reserves unless it asks for more: a leaf split with its
+    // parents, in a tree a few levels deep.
+    static constexpr size_t TXN_FRAMES = 8;
+
+    // Share of the pool open txns may reserve between them.
+    size_t txnFrameBudget() const { return std::max<size_t>(1, frames.size() - frames.size() / 4); }
+
+    // Opens the thread's txn, reserving between `at_least` and `at_most`
+    // frames (see admission control above): as many as the budget has
+    // spare, after waiting, holding nothing, until `at_least` fit or no
+    // other txn has a reservation. Nested calls join the open txn.
+    void beginTxn(TxnState& state, size_t at_least = TXN_FRAMES, size_t at_most = TXN_FRAMES) {
+        if (TxnState* txn = activeTxn()) {
+            txn->depth++;
+            return;
+        }
+        assert(!current_txn && "one open txn per thread");
+        state = TxnState();
+        state.pool = this;
+        state.depth = 1;
+        const size_t budget = txnFrameBudget();
+        at_most = std::min(at_most, budget);
+        at_least = std::min(at_least, at_most);
+        state.reserved = at_most;
+        if (wal) {
+            std::unique_lock<std::mutex> lock(mu);
+            frame_waiters++;
+            frame_cv.wait(lock, [&] { return txn_frames == 0 || txn_frames + at_least <= budget; });
+            frame_waiters--;
+            size_t spare = budget - std::min(txn_frames, budget);
+            state.reserved = std::max(at_least, std::min(at_most, spare));
+            txn_frames += state.reserved;
+            lock.unlock();
+            checkpoint_gate.lock_shared();
+        }
+        current_txn = &state;
+    }
+
+    // Frames reserved by the thread's open txn, 0 outside of one. Without
+    // the WAL nothing is pinned until commit; a txn is granted all it asked
+    // for.
+    size_t txnReserved() const {
+        TxnState* txn = activeTxn();
+        return txn ? txn->reserved : 0;
+    }
+
+    // Ends the outermost txn: appends the after-image of every page it
+    // dirtied, a FreeRun record per overflow run it freed and a commit
+    // record as one batch, releases the latches it kept, then (with
+    // sync_commit) waits until the group-commit thread has made the batch
+    // durable. The freed runs are rewritten as free pages in between.
+    // Returns false if the log has failed: the txn's changes are visible
+    // but will not survive a restart.
+    bool commitTxn() {
+        TxnState* txn = activeTxn();
+        if (!txn || --txn->depth > 0) return true;
+
+        uint64_t end_lsn = 0;
+        std::vector<uint64_t> run_lsns;
+        if (wal && (!txn->dirty.empty() || !txn->freed_runs.empty() || txn->txn_id != 0)) {
+            uint64_t txn_id = txnId(*txn);
+            end_lsn = wal->append([&](uint64_t lsn, std::string& out) {
+                for (size_t fid : txn->dirty) {
+                    char* data = frameData(fid);
+                    ((PageHeader*)data)->page_lsn = lsn;
+                    LogManager::encode(out, LogRecordType::PageImage, lsn, txn_id, frames[fid].page_id, data, PAGE_SIZE);
+                    lsn += LogManager::recordSize(PAGE_SIZE);
+                }
+                for (const auto& run : txn->freed_runs) {
+                    run_lsns.push_back(lsn);
+                    LogManager::encode(out, LogRecordType::FreeRun, lsn, txn_id, run.first, (const char*)&run.second, sizeof(uint32_t));
+                    lsn += LogManager::recordSize(sizeof(uint32_t));
+                }
+                LogManager::encode(out, LogRecordType::Commit, lsn, txn_id, 0, nullptr, 0);
+            });
+        }
+
+        // txn_pending is cleared before the latches go: the next X holder
+        // must not mistake these pages for its own pending ones.
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (size_t fid : txn->dirty) {
+                frames[fid].txn_pending = false;
+                frames[fid].log_end = end_lsn;
+                updateEvictable(fid);
+            }
+        }
+        for (size_t fid : txn->held) unlockExclusive(frames[fid]);
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (size_t fid : txn->held) {
+                frames[fid].pin_count--;
+                updateEvictable(fid);
+            }
+            txn_frames -= txn->reserved;
+            frameReleased();
+            if (!txn->freed.empty()) {
+                free_list.insert(txn->freed.begin(), txn->freed.end());
+                free_list_changed = true;
+            }
+        }
+        current_txn = nullptr;
+        // Still inside the gate, so no checkpoint drops a FreeRun record
+        // before its pages are marked free.
+        for (size_t k = 0; k < txn->freed_runs.size(); ++k) {
+            clearRun(txn->freed_runs[k].first, txn->freed_runs[k].second, wal ? run_lsns[k] : 0, end_lsn);
+        }
+        if (wal) checkpoint_gate.unlock_shared();
+
+        bool durable = true;
+        if (end_lsn && options.sync_commit) durable = wal->waitDurable(end_lsn);
+        else if (end_lsn) durable = !wal->hasFailed();
+        if (wal && wal->sizeBytes() > options.checkpoint_bytes) flushAllPages();
+        return durable;
     }
 
     void flushPage(uint32_t id) {
-        if (!cache.count(id)) return;
-        file.seekp(id * PAGE_SIZE);
-        file.write(cache[id].data(), PAGE_SIZE);
-        file.flush(); 
+        PageGuard g;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            auto it = page_table.find(id);
+            if (it == page_table.end() || frames[it->second].loading) return;
+            pinFrame(it->second);
+            g.pool = this; // unpinned by the guard even if the latch is skipped
+            g.page_id = id;
+            g.frame_id = it->second;
+        }
+        frames[g.frame_id].latch.lock_shared();
+        g.owns_latch = true;
+        g.page_data = frames[g.frame_id].data;
+        std::unique_lock<std::mutex> lock(mu);
+        const Frame& f = frames[g.frame_id];
+        if (f.dirty && !f.txn_pending) writeFrames({g.frame_id}, lock);
+    }
+
+    // Checkpoint: saves the free list, writes back every committed dirty
+    // frame, syncs db.bin and then resets the log, whose records are no
+    // longer needed for redo.
+    // Holding the gate exclusively waits out every open txn, so no frame
+    // has unlogged changes while the log is truncated. False if the
+    // checkpoint failed; the log then still covers the dirty pages.
+    bool flushAllPages() {
+        assert(!activeTxn() && "checkpoint inside a txn would wait on itself");
+        std::unique_lock<std::shared_mutex> gate(checkpoint_gate, std::defer_lock);
+        if (wal) {
+            gate.lock();
+            wal->flush();
+        }
+        return writeCheckpoint();
+    }
+
+    // Vacuum: a checkpoint that also hands the free pages at the end of
+    // db.bin back to the file system. The free-list chain is rebuilt once
+    // the tail is cut, so it never holds the tail. Returns the new
+    // page count. If the checkpoint fails, or db.bin cannot be truncated
+    // and synced, the tail goes back on the free list and the old page
+    // count is kept and returned.
+    uint32_t truncateFreeTail() {
+        assert(!activeTxn() && "checkpoint inside a txn would wait on itself");
+        std::unique_lock<std::shared_mutex> gate(checkpoint_gate, std::defer_lock);
+        if (wal) {
+            gate.lock();
+            wal->flush();
+        }
+        uint32_t old_count;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            old_count = next_page_id;
+            free_list.insert(free_list_pages.begin(), free_list_pages.end());
+            free_list_pages.clear();
+            free_list_changed = true;
+            while (next_page_id > 1 && free_list.count(next_page_id - 1)) {
+                auto it = page_table.find(next_page_id - 1);
+                if (it != page_table.end() && !dropFrame(it->second)) break;
+                free_list.erase(next_page_id - 1);
+                next_page_id--;
+            }
+        }
+        // Pages allocated since the tail was cut are in use; the rest of it
+        // is free again. Requires mu.
+        auto restoreTail = [&] {
+            for (uint32_t id = next_page_id; id < old_count; ++id) free_list.insert(id);
+            next_page_id = std::max(next_page_id, old_count);
+            free_list_changed = true;
+        };
+        if (!writeCheckpoint()) {
+            std::lock_guard<std::mutex> lock(mu);
+            restoreTail();
+            return next_page_id;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mu); // write-back runs under mu
+            bool truncated = io->truncate(next_page_id);
+            file_pages = std::min(file_pages, next_page_id); // the file may be shorter even if the sync fails
+            if (truncated && io->sync()) return next_page_id;
+            restoreTail();
+        }
+        std::cerr << "BufferPool: truncating db.bin failed, its size is kept" << std::endl;
+        writeCheckpoint(); // saves the restored free list
+        std::lock_guard<std::mutex> lock(mu);
+        return next_page_id;
+    }
+
+    size_t capacity() const { return frames.size(); }
+
+    PoolStats stats() {
+        std::lock_guard<std::mutex> lock(mu);
+        PoolStats st = pool_stats;
+        for (const auto& c : optimistic_hits) st.hits += c.n.load(std::memory_order_relaxed);
+        st.free_pages = free_list.size();
+        return st;
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(mu);
+        pool_stats = PoolStats();
+        for (auto& c : optimistic_hits) c.n.store(0, std::memory_order_relaxed);
     }
 };
 
-#endif // BUFFERPOOL_H
\ No newline at end of file
+// Groups every page modification made during its lifetime into one WAL
+// transaction of the calling thread. Scopes nest; only the outermost one
+// commits. Declare it before the guards it covers. The outermost scope
+// reserves frames of the pool until it commits, which may wait for other
+// txns: `reserve` of them, or with the second form as many as are spare
+// within [at_least, at_most] (see BufferPool::beginTxn()). Writes that
+// report success call commit() once their guards are gone; the
+// destructor commits otherwise and cannot tell anyone the log failed.
+class TxnScope {
+    BufferPool& pool;
+    TxnState state;
+    bool open = true;
+
+public:
+    explicit TxnScope(BufferPool& bp, size_t reserve = BufferPool::TXN_FRAMES) : pool(bp) {
+        pool.beginTxn(state, reserve, reserve);
+    }
+    TxnScope(BufferPool& bp, size_t at_least, size_t at_most) : pool(bp) { pool.beginTxn(state, at_least, at_most); }
+    ~TxnScope() {
+        if (open) pool.commitTxn();
+    }
+
+    // Frames reserved by the open txn.
+    size_t reserved() const { return pool.txnReserved(); }
+
+    // False if the txn's changes will not survive a restart.
+    bool commit() {
+        open = false;
+        return pool.commitTxn();
+    }
+
+    TxnScope(const TxnScope&) = delete;
+    TxnScope& operator=(const TxnScope&) = delete;
+};
+
+inline void PageGuard::release() {
+    if (pool) pool->releaseGuard(*this);
+    pool = nullptr;
+    page_data = nullptr;
+    dirty = false;
+}
+
+#endif // BUFFERPOOL_H
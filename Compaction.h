@@ -0,0 +1,200 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "InternalKey.h"
+#include "SSTable.h"
+
+// K-way merge of sorted inputs into one run in internal key order. Every
+// record of every input is returned; which versions survive is up to the
+// caller. The inputs are given newest first, which only breaks ties. An
+// input is anything that walks records like SSTable::Iterator does.
+template <typename Input = SSTable::Iterator>
+class MergingIterator {
+    std::vector<Input> inputs;
+    std::vector<size_t> heap; // inputs that are still valid, min-heap on (internal key, age)
+
+    // Heap order is inverted: "greater" entries sink.
+    bool after(size_t a, size_t b) const {
+        int cmp = compareInternal(inputs[a].key(), inputs[a].seq(), inputs[b].key(), inputs[b].seq());
+        return cmp != 0 ? cmp > 0 : a > b;
+    }
+
+    void push(size_t i) {
+        heap.push_back(i);
+        std::push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+    }
+
+    size_t pop() {
+        std::pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+        size_t i = heap.back();
+        heap.pop_back();
+        return i;
+    }
+
+public:
+    explicit MergingIterator(std::vector<Input> its) : inputs(std::move(its)) {}
+
+    void seekToFirst() {
+        heap.clear();
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            inputs[i].seekToFirst();
+            if (inputs[i].valid()) push(i);
+        }
+    }
+
+    // Every input at its first record of `key` or a larger key.
+    void seek(std::string_view key) {
+        heap.clear();
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            inputs[i].seek(key);
+            if (inputs[i].valid()) push(i);
+        }
+    }
+
+    bool valid() const { return !heap.empty(); }
+    std::string_view key() const { return inputs[heap.front()].key(); }
+    std::string_view value() const { return inputs[heap.front()].value(); }
+    uint64_t seq() const { return inputs[heap.front()].seq(); }
+    ValueType type() const { return inputs[heap.front()].type(); }
+
+    void next() {
+        size_t i = pop();
+        inputs[i].next();
+        if (inputs[i].valid()) push(i);
+    }
+};
+
+// Combines the older value of `key` (none if the key has no value) with
+// one merge operand into the new value.
+using MergeOperator = std::function<std::string(const std::string& key, const std::optional<std::string>& existing,
+                                                const std::string& operand)>;
+
+// One record, as flushes, compactions and scans pass it around.
+struct Record {
+    std::string key;
+    uint64_t seq;
+    ValueType type;
+    std::string value;
+};
+
+// Computes what a reader sees for one key from its records, fed newest
+// first: the newest value or delete, with the merge operands above it
+// applied oldest first. add() returns true once older records cannot
+// matter.
+class ValueResolver {
+    std::vector<std::string> operands; // newest first
+    std::optional<std::string> base;
+    bool resolved = false;
+
+public:
+    bool add(ValueType type, std::string_view value) {
+        if (type == ValueType::Merge) {
+            operands.emplace_back(value);
+            return false;
+        }
+        if (type == ValueType::Value) base.emplace(value);
+        return resolved = true;
+    }
+
+    bool done() const { return resolved; }
+    bool empty() const { return !resolved && operands.empty(); }
+
+    std::optional<std::string> result(const std::string& key, const MergeOperator& merge) {
+        if (operands.empty()) return std::move(base);
+        if (!merge) {
+            std::cerr << "LSM: " << key << " has merge operands but no merge operator is set" << std::endl;
+            return std::move(base);
+        }
+        std::optional<std::string> value = std::move(base);
+        for (auto it = operands.rbegin(); it != operands.rend(); ++it) value = merge(key, value, *it);
+        return value;
+    }
+};
+
+// Drops the records of one key that no reader can see any more and folds
+// merge operands into the value below them where no reader needs them
+// apart. `records` are newest first. A reader at snapshot S sees the
+// newest record <= S, so the records are cut into stripes, one per
+// snapshot (ascending in `snapshots`) plus one above them all; in each
+// stripe everything below the first value or delete is hidden. `bottom`
+// tells whether no record of the key exists outside `records`, in which
+// case deletes at the end and operands with nothing below them are
+// resolved too. A fold whose result would be over `max_value` bytes is
+// not done; the operands stay and reads keep resolving them.
+inline void collapseVersions(std::vector<Record>& records, const std::vector<uint64_t>& snapshots,
+                             const std::function<bool()>& bottom, const MergeOperator& merge, size_t max_value) {
+    auto stripe = [&](uint64_t seq) {
+        return std::lower_bound(snapshots.begin(), snapshots.end(), seq) - snapshots.begin();
+    };
+    std::vector<Record> out;
+    size_t i = 0;
+    while (i < records.size()) {
+        auto s = stripe(records[i].seq);
+        size_t first = out.size();
+        bool terminated = false;
+        for (; i < records.size() && stripe(records[i].seq) == s; ++i) {
+            if (terminated) continue; // hidden
+            terminated = records[i].type != ValueType::Merge;
+            out.push_back(std::move(records[i]));
+        }
+        bool last = i == records.size();
+        // Operands over a value or delete, or over nothing at all, fold
+        // into one value.
+        if (merge && out.size() - first > 1 && (terminated || (last && bottom()))) {
+            ValueResolver r;
+            for (size_t k = first; k < out.size(); ++k) r.add(out[k].type, out[k].value);
+            std::string value = *r.result(out[first].key, merge);
+            if (value.size() <= max_value) {
+                Record folded{std::move(out[first].key), out[first].seq, ValueType::Value, std::move(value)};
+                out.resize(first);
+                out.push_back(std::move(folded));
+            }
+        }
+    }
+    // Nobody can tell a trailing delete from no record at all.
+    while (!out.empty() && out.back().type == ValueType::Delete && bottom()) out.pop_back();
+    records = std::move(out);
+}
+
+// Token bucket shared by the compaction threads. request() takes the
+// bytes from the budget and, if that overdraws it, sleeps until the rate
+// has paid the debt back. Bursts are capped at a tenth of a second of
+// budget.
+class RateLimiter {
+    std::mutex mu;
+    double bytes_per_sec;
+    double available = 0;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+public:
+    // 0 means unlimited.
+    explicit RateLimiter(uint64_t rate) : bytes_per_sec((double)rate) {}
+
+    void request(size_t bytes) {
+        if (bytes_per_sec <= 0) return;
+        double wait;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - last).count();
+            last = now;
+            available = std::min(available + elapsed * bytes_per_sec, bytes_per_sec / 10);
+            available -= (double)bytes;
+            wait = available < 0 ? -available / bytes_per_sec : 0;
+        }
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+};
+
+#endif // COMPACTION_H
@@ -0,0 +1,156 @@
+#ifndef CONCURRENT_SKIPLIST_H
+#define CONCURRENT_SKIPLIST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "Arena.h"
+#include "InternalKey.h"
+
+// Skip list for several writers and readers without a lock, ordered by
+// internal key (InternalKey.h). Nodes are never unlinked or changed once
+// published: every write adds a node with the sequence number the caller
+// gave it, and the versions of a key sit newest first. Writers link a node
+// bottom-up with a CAS per level and retry a level only if another writer
+// got there first. Readers never wait, they follow acquire loads of the
+// next pointers.
+//
+// Memory comes from a shared arena, so growth is bounded by what was
+// written, older versions included, until the whole list is dropped.
+class ConcurrentSkipList {
+public:
+    static constexpr int MAX_HEIGHT = 12;
+
+    struct Node {
+        uint32_t key_len;
+        uint32_t value_len;
+        uint64_t seq;
+        ValueType type;
+        int height;
+        std::atomic<Node*> links[1]; // `height` entries, then the key and value bytes
+
+        std::string_view key() const { return std::string_view((const char*)(links + height), key_len); }
+        std::string_view value() const { return std::string_view((const char*)(links + height) + key_len, value_len); }
+        const Node* next(int level = 0) const { return links[level].load(std::memory_order_acquire); }
+    };
+
+private:
+    ConcurrentArena arena;
+    Node* head;
+    std::atomic<int> max_height{1};
+    std::atomic<size_t> element_count{0};
+
+    // Height with P(h) = 4^-(h-1), from a per-thread generator.
+    static int randomHeight() {
+        thread_local std::minstd_rand rng(
+            (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) ^ std::random_device()());
+        int height = 1;
+        while (height < MAX_HEIGHT && (rng() & 3) == 0) height++;
+        return height;
+    }
+
+    Node* newNode(std::string_view key, uint64_t seq, ValueType type, std::string_view value, int height) {
+        size_t tower = offsetof(Node, links) + height * sizeof(std::atomic<Node*>);
+        char* mem = arena.allocate(tower + key.size() + value.size(), alignof(Node));
+        Node* node = (Node*)mem;
+        node->key_len = (uint32_t)key.size();
+        node->value_len = (uint32_t)value.size();
+        node->seq = seq;
+        node->type = type;
+        node->height = height;
+        for (int i = 0; i < height; ++i) new (&node->links[i]) std::atomic<Node*>(nullptr);
+        std::memcpy(mem + tower, key.data(), key.size());
+        std::memcpy(mem + tower + key.size(), value.data(), value.size());
+        return node;
+    }
+
+    static bool before(const Node* a, std::string_view key, uint64_t seq) {
+        return compareInternal(a->key(), a->seq, key, seq) < 0;
+    }
+
+    // Advances `prev` on `level` to the last node before (key, seq) and
+    // returns its successor.
+    static Node* splice(Node*& prev, int level, std::string_view key, uint64_t seq) {
+        Node* next = prev->links[level].load(std::memory_order_acquire);
+        while (next && before(next, key, seq)) {
+            prev = next;
+            next = next->links[level].load(std::memory_order_acquire);
+        }
+        return next;
+    }
+
+public:
+    ConcurrentSkipList() { head = newNode("", 0, ValueType::Value, "", MAX_HEIGHT); }
+
+    // Nodes are released with the arena.
+    ~ConcurrentSkipList() = default;
+
+    ConcurrentSkipList(const ConcurrentSkipList&) = delete;
+    ConcurrentSkipList& operator=(const ConcurrentSkipList&) = delete;
+
+    // Safe to call from several threads, also during reads. (key, seq)
+    // must be new to the list.
+    void add(std::string_view key, uint64_t seq, ValueType type, std::string_view value) {
+        int height = randomHeight();
+        Node* node = newNode(key, seq, type, value, height);
+
+        int top = max_height.load(std::memory_order_relaxed);
+        while (height > top && !max_height.compare_exchange_weak(top, height, std::memory_order_relaxed)) {
+        }
+
+        Node* prev[MAX_HEIGHT];
+        Node* next[MAX_HEIGHT];
+        Node* curr = head;
+        for (int i = std::max(top, height) - 1; i >= 0; --i) {
+            next[i] = splice(curr, i, key, seq);
+            prev[i] = curr;
+        }
+
+        // Bottom-up, so that a node reachable on a level is reachable on
+        // every level below it.
+        for (int i = 0; i < height; ++i) {
+            while (true) {
+                node->links[i].store(next[i], std::memory_order_relaxed);
+                if (prev[i]->links[i].compare_exchange_strong(next[i], node, std::memory_order_release)) break;
+                // Someone linked in between: search on from the old
+                // predecessor, nodes never move.
+                next[i] = splice(prev[i], i, key, seq);
+            }
+        }
+        element_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The newest record of `key` with a sequence number <= seq, or nullptr.
+    const Node* find(std::string_view key, uint64_t seq = MAX_SEQUENCE) const {
+        const Node* n = seek(key, seq);
+        return n && n->key() == key ? n : nullptr;
+    }
+
+    // First node at or after (key, seq), or nullptr. Walk on with next().
+    const Node* seek(std::string_view key, uint64_t seq = MAX_SEQUENCE) const {
+        // The successor splice() saw on level 0, not a fresh load: a node
+        // smaller than `key` may have been linked after `curr` since.
+        Node* curr = head;
+        Node* next = nullptr;
+        for (int i = max_height.load(std::memory_order_relaxed) - 1; i >= 0; --i) {
+            next = splice(curr, i, key, seq);
+        }
+        return next;
+    }
+
+    const Node* first() const { return head->next(0); }
+
+    // Versions included.
+    size_t size() const { return element_count.load(std::memory_order_relaxed); }
+    size_t memoryUsage() const { return arena.memoryUsage(); }
+};
+
+#endif // CONCURRENT_SKIPLIST_H
@@ -2,5 +2,6 @@
 #define FLINT_KV_H
 
 #include "BPlusTree.h"
+#include "LSMTree.h"
 
 #endif // "FLINT_KV_H
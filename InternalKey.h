@@ -0,0 +1,32 @@
+#ifndef INTERNAL_KEY_H
+#define INTERNAL_KEY_H
+
+#include <cstdint>
+#include <string_view>
+
+// Records of the LSM engine are versioned. Every write gets the next
+// sequence number, and a record is stored under its internal key: the
+// user key, the sequence number and what the record does. Internal keys
+// sort by user key and then newest first, so a reader at sequence number
+// S sees, for each key, the first record with a sequence number <= S.
+enum class ValueType : uint8_t {
+    Delete = 0, // the key has no value
+    Value = 1,  // the key has this value
+    Merge = 2,  // an operand for LSMOptions::merge_operator, applied to the older value
+};
+
+const uint64_t MAX_SEQUENCE = (1ull << 56) - 1;
+
+// Sequence number and type packed into the 8 bytes stored on disk.
+inline uint64_t packTag(uint64_t seq, ValueType type) { return seq << 8 | (uint8_t)type; }
+inline uint64_t tagSequence(uint64_t tag) { return tag >> 8; }
+inline ValueType tagType(uint64_t tag) { return (ValueType)(tag & 0xff); }
+
+// < 0, 0 or > 0 as (a, a_seq) sorts before, with or after (b, b_seq).
+inline int compareInternal(std::string_view a, uint64_t a_seq, std::string_view b, uint64_t b_seq) {
+    int cmp = a.compare(b);
+    if (cmp != 0) return cmp;
+    return a_seq > b_seq ? -1 : a_seq < b_seq ? 1 : 0;
+}
+
+#endif // INTERNAL_KEY_H
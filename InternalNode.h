@@ -0,0 +1,243 @@
+#ifndef INTERNAL_NODE_H
+#define INTERNAL_NODE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "Page.h"
+
+// Layout of internal nodes:
+//
+//   PageHeader | InternalHeader | heads[n] | IndexSlot[n] | free | suffixes, prefix
+//
+// Separators are sorted. The prefix they all share is stored once; each
+// slot points at the rest (the suffix). heads[i] holds the first four
+// suffix bytes of separator i as a big-endian integer, so comparing heads
+// orders separators like comparing them in full, except that equal heads
+// tie. Searches scan the heads with SIMD compares and touch the suffix
+// bytes only to break ties.
+//
+// Nodes are re-encoded from their entry list whenever they change. Every
+// accessor used on the search path is bounds-checked so that it can run
+// on a page read optimistically: a torn page yields a wrong answer, which
+// validation rejects, but never a read outside the page.
+class InternalNode {
+public:
+    struct Entry {
+        std::string key;
+        uint32_t child;
+    };
+
+    static constexpr size_t DATA_START = sizeof(PageHeader) + sizeof(InternalHeader);
+    static constexpr size_t ENTRY_OVERHEAD = sizeof(uint32_t) + sizeof(IndexSlot); // head + slot
+
+    static size_t capacity() { return PAGE_SIZE - DATA_START; }
+
+    static const InternalHeader* header(const char* node) {
+        return (const InternalHeader*)(node + sizeof(PageHeader));
+    }
+
+    // Clamped, so optimistic readers stay within the head and slot arrays.
+    static int size(const char* node) {
+        size_t n = ((const PageHeader*)node)->num_slots;
+        return (int)std::min(n, capacity() / ENTRY_OVERHEAD);
+    }
+
+    static const uint32_t* heads(const char* node) { return (const uint32_t*)(node + DATA_START); }
+
+    static const IndexSlot* slots(const char* node) {
+        return (const IndexSlot*)(node + DATA_START + size(node) * sizeof(uint32_t));
+    }
+
+    static std::string_view prefix(const char* node) {
+        const InternalHeader* ih = header(node);
+        return clamped(node, ih->prefix_offset, ih->prefix_len);
+    }
+
+    static std::string_view suffix(const char* node, int i) {
+        const IndexSlot& s = slots(node)[i];
+        return clamped(node, s.offset, s.length);
+    }
+
+    static std::string separator(const char* node, int i) {
+        std::string key(prefix(node));
+        key.append(suffix(node, i));
+        return key;
+    }
+
+    // Child left of every separator for i < 0.
+    static uint32_t child(const char* node, int i) {
+        return i < 0 ? ((const PageHeader*)node)->lower_bound_child : slots(node)[i].child_page_id;
+    }
+
+    // Repoints child i in place (the separators stay as they are). Latched
+    // pages only.
+    static void setChild(char* node, int i, uint32_t id) {
+        if (i < 0) ((PageHeader*)node)->lower_bound_child = id;
+        else ((IndexSlot*)slots(node))[i].child_page_id = id;
+    }
+
+    // Big-endian first four bytes of `s`, zero-padded.
+    static uint32_t head(std::string_view s) {
+        uint32_t h = 0;
+        for (size_t i = 0; i < 4; ++i) h = (h << 8) | (i < s.size() ? (uint8_t)s[i] : 0);
+        return h;
+    }
+
+    // Index of the last separator <= key (< key when `strict`), -1 if
+    // there is none.
+    static int find(const char* node, std::string_view key, bool strict = false) {
+        int n = size(node);
+        if (n == 0) return -1;
+
+        // Every separator starts with the node prefix.
+        std::string_view pre = prefix(node);
+        int c = key.compare(0, pre.size(), pre);
+        if (c < 0) return -1;
+        if (c > 0) return n - 1;
+        std::string_view rest = key.substr(pre.size());
+
+        // Heads below the key's are separators below the key, heads above
+        // it separators above; only the tied run needs full compares.
+        int lt = 0, eq = 0;
+        countHeads(heads(node), n, head(rest), lt, eq);
+        int lo = lt, hi = lt + eq;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            int cmp = suffix(node, mid).compare(rest);
+            if (cmp < 0 || (cmp == 0 && !strict)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo - 1;
+    }
+
+    // Latched pages only.
+    static std::vector<Entry> entries(const char* node) {
+        std::vector<Entry> out;
+        for (int i = 0; i < size(node); ++i) out.push_back({separator(node, i), child(node, i)});
+        return out;
+    }
+
+    static size_t commonPrefix(std::string_view a, std::string_view b) {
+        size_t n = 0;
+        while (n < a.size() && n < b.size() && a[n] == b[n]) n++;
+        return n;
+    }
+
+    // The separators are sorted, so the prefix they all share is the common
+    // prefix of the first and the last.
+    static size_t encodedSize(const std::vector<Entry>& e, size_t begin, size_t end) {
+        if (begin == end) return 0;
+        size_t pre = commonPrefix(e[begin].key, e[end - 1].key);
+        size_t bytes = pre;
+        for (size_t i = begin; i < end; ++i) bytes += e[i].key.size() - pre + ENTRY_OVERHEAD;
+        return bytes;
+    }
+
+    // Size of the node's separators without prefix compression; no later
+    // re-encoding of them (with one more) can need more than that.
+    static size_t uncompressedSize(const char* node) {
+        const PageHeader* h = (const PageHeader*)node;
+        const InternalHeader* ih = header(node);
+        return h->num_slots * (ih->prefix_len + ENTRY_OVERHEAD) + (PAGE_SIZE - h->free_space_offset - ih->prefix_len);
+    }
+
+    // Rewrites a node from entries [begin, end), which must fit.
+    static void write(char* node, uint32_t lower_bound_child, const std::vector<Entry>& e, size_t begin, size_t end) {
+        assert(encodedSize(e, begin, end) <= capacity());
+        size_t n = end - begin;
+        size_t pre = n == 0 ? 0 : commonPrefix(e[begin].key, e[end - 1].key);
+        PageHeader* h = (PageHeader*)node;
+        InternalHeader* ih = (InternalHeader*)(node + sizeof(PageHeader));
+        uint32_t* hd = (uint32_t*)(node + DATA_START);
+        IndexSlot* sl = (IndexSlot*)(node + DATA_START + n * sizeof(uint32_t));
+        std::memset(node + sizeof(PageHeader), 0, PAGE_SIZE - sizeof(PageHeader));
+        h->is_leaf = false;
+        h->lower_bound_child = lower_bound_child;
+        h->num_slots = (uint32_t)n;
+
+        uint32_t offset = PAGE_SIZE - (uint32_t)pre;
+        if (n > 0) std::memcpy(node + offset, e[begin].key.data(), pre);
+        ih->prefix_offset = (uint16_t)offset;
+        ih->prefix_len = (uint16_t)pre;
+        for (size_t i = begin; i < end; ++i) {
+            std::string_view rest = std::string_view(e[i].key).substr(pre);
+            offset -= (uint32_t)rest.size();
+            std::memcpy(node + offset, rest.data(), rest.size());
+            hd[i - begin] = head(rest);
+            sl[i - begin] = {(uint16_t)offset, (uint16_t)rest.size(), e[i].child};
+        }
+        h->free_space_offset = offset;
+    }
+
+    // Suffix truncation: the shortest key above `left` that does not
+    // exceed `right`, so separators stay short whatever the key length.
+    static std::string shortestSeparator(const std::string& left, const std::string& right) {
+        size_t n = commonPrefix(left, right);
+        return n < right.size() ? right.substr(0, n + 1) : right;
+    }
+
+private:
+    static std::string_view clamped(const char* page, size_t offset, size_t length) {
+        if (offset >= PAGE_SIZE) return std::string_view();
+        return std::string_view(page + offset, std::min(length, PAGE_SIZE - offset));
+    }
+
+    // Counts the heads below `key` (lt) and equal to it (eq). The heads are
+    // sorted, but a branch-free pass over a few hundred of them is cheaper
+    // than the mispredicted branches of a binary search. Compare masks (-1
+    // per lane) are summed per lane; flipping the sign bits gives unsigned
+    // order.
+    static void countHeads(const uint32_t* hd, int n, uint32_t key, int& lt, int& eq) {
+        int i = 0;
+        lt = eq = 0;
+#if defined(__AVX2__)
+        const __m256i flip8 = _mm256_set1_epi32((int)0x80000000u);
+        const __m256i k8 = _mm256_set1_epi32((int)(key ^ 0x80000000u));
+        __m256i lt8 = _mm256_setzero_si256(), eq8 = _mm256_setzero_si256();
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(hd + i)), flip8);
+            lt8 = _mm256_sub_epi32(lt8, _mm256_cmpgt_epi32(k8, v));
+            eq8 = _mm256_sub_epi32(eq8, _mm256_cmpeq_epi32(k8, v));
+        }
+        alignas(32) int32_t lanes[16];
+        _mm256_store_si256((__m256i*)lanes, lt8);
+        _mm256_store_si256((__m256i*)(lanes + 8), eq8);
+        for (int l = 0; l < 8; ++l) {
+            lt += lanes[l];
+            eq += lanes[8 + l];
+        }
+#elif defined(__SSE2__)
+        const __m128i flip = _mm_set1_epi32((int)0x80000000u);
+        const __m128i k = _mm_set1_epi32((int)(key ^ 0x80000000u));
+        __m128i lt4 = _mm_setzero_si128(), eq4 = _mm_setzero_si128();
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(hd + i)), flip);
+            lt4 = _mm_sub_epi32(lt4, _mm_cmplt_epi32(v, k));
+            eq4 = _mm_sub_epi32(eq4, _mm_cmpeq_epi32(v, k));
+        }
+        alignas(16) int32_t lanes[8];
+        _mm_store_si128((__m128i*)lanes, lt4);
+        _mm_store_si128((__m128i*)(lanes + 4), eq4);
+        for (int l = 0; l < 4; ++l) {
+            lt += lanes[l];
+            eq += lanes[4 + l];
+        }
+#endif
+        for (; i < n; ++i) {
+            uint32_t v;
+            std::memcpy(&v, hd + i, sizeof(v));
+            lt += v < key;
+            eq += v == key;
+        }
+    }
+};
+
+#endif // INTERNAL_NODE_H
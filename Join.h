@@ -0,0 +1,206 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BPlusTree.h"
+#include "SkipList.h"
+
+// Joins over ordered key/value sources. A source is anything with
+// cursor() (seek, valid, next, key, value) and splitKeys(start, end,
+// parts): SkipList and BPlusTree. Each holds a key at most once. Ranges
+// are [start, end], both inclusive, like rangeScan.
+
+// One side of a joined pair. The views point into the source (or into the
+// hash join's table) and are valid only during the callback.
+struct JoinRow {
+    std::string_view key;
+    std::string_view value;
+};
+
+// A joined pair, copied out. For a hash join, `key` is the probe row's key.
+struct JoinedResult {
+    std::string key;
+    std::string user_info;  // left (build) value
+    std::string order_info; // right (probe) value
+};
+
+// Column a hash join matches on, as a view into the row's key or value.
+using JoinKey = std::function<std::string_view(std::string_view key, std::string_view value)>;
+
+inline std::string_view rowKey(std::string_view key, std::string_view) { return key; }
+
+namespace join_detail {
+
+// Merge join of [lo, hi], or [lo, hi) unless `inclusive`.
+template <typename Left, typename Right, typename Emit>
+void mergeRange(Left& left, Right& right, const std::string& lo, const std::string& hi, bool inclusive, Emit& emit) {
+    auto lc = left.cursor();
+    auto rc = right.cursor();
+    lc.seek(lo);
+    rc.seek(lo);
+    while (lc.valid() && rc.valid()) {
+        std::string_view lk = lc.key(), rk = rc.key();
+        // Past the range on either side, nothing further can match.
+        if (inclusive ? (lk > hi || rk > hi) : (lk >= hi || rk >= hi)) break;
+        int cmp = lk.compare(rk);
+        if (cmp < 0) {
+            lc.next();
+        } else if (cmp > 0) {
+            rc.next();
+        } else {
+            emit(JoinRow{lk, lc.value()}, JoinRow{rk, rc.value()});
+            lc.next();
+            rc.next();
+        }
+    }
+}
+
+// Splits [start, end] at `source`'s split keys into up to `threads`
+// pieces and runs job(part, lo, hi, inclusive) for each on its own
+// thread. Piece i covers [lo, hi); the last one includes `end`. Returns
+// the number of pieces, in key order.
+template <typename Source, typename Job>
+size_t runPartitioned(Source& source, const std::string& start, const std::string& end, int threads, Job job) {
+    std::vector<std::string> bounds{start};
+    if (threads > 1 && start < end) {
+        std::vector<std::string> keys = source.splitKeys(start, end, threads);
+        // Evenly spaced picks when the level offered more than needed.
+        size_t parts = std::min(keys.size() + 1, (size_t)threads);
+        for (size_t i = 1; i < parts; ++i) {
+            const std::string& key = keys[i * keys.size() / parts];
+            if (key > bounds.back()) bounds.push_back(key);
+        }
+    }
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        bool last = i + 1 == bounds.size();
+        workers.emplace_back(job, i, bounds[i], last ? end : bounds[i + 1], last);
+    }
+    for (auto& w : workers) w.join();
+    return bounds.size();
+}
+
+inline std::vector<JoinedResult> concat(std::vector<std::vector<JoinedResult>>& parts) {
+    size_t total = 0;
+    for (auto& p : parts) total += p.size();
+    std::vector<JoinedResult> res;
+    res.reserve(total);
+    for (auto& p : parts) std::move(p.begin(), p.end(), std::back_inserter(res));
+    return res;
+}
+
+} // namespace join_detail
+
+// Streaming sort-merge join on the key: walks both sources once, in
+// order, side by side, and calls emit(left, right) for every key in
+// [start, end] that both hold. No lookups and no copies.
+template <typename Left, typename Right, typename Emit>
+void mergeJoin(Left& left, Right& right, const std::string& start, const std::string& end, Emit emit) {
+    join_detail::mergeRange(left, right, start, end, true, emit);
+}
+
+// mergeJoin with [start, end] split into up to `threads` key ranges at
+// `left`'s split keys, each joined on its own thread with its own
+// cursors. The sources must not be written meanwhile (a BPlusTree may be,
+// from other threads). Results come back in key order.
+template <typename Left, typename Right>
+std::vector<JoinedResult> parallelMergeJoin(Left& left, Right& right, const std::string& start, const std::string& end,
+                                            int threads) {
+    std::vector<std::vector<JoinedResult>> parts(std::max(threads, 1));
+    join_detail::runPartitioned(left, start, end, threads,
+                                [&](size_t part, std::string lo, std::string hi, bool inclusive) {
+                                    auto emit = [&](const JoinRow& l, const JoinRow& r) {
+                                        parts[part].push_back({std::string(l.key), std::string(l.value), std::string(r.value)});
+                                    };
+                                    join_detail::mergeRange(left, right, lo, hi, inclusive, emit);
+                                });
+    return join_detail::concat(parts);
+}
+
+// Build/probe hash join, for inputs that are not ordered on the join
+// column: build() copies one input into a hash table on its join column,
+// then probe() streams the other and matches each row against it, so the
+// probe side is read once and in order. Several threads may probe a
+// built table at once.
+class HashJoin {
+    JoinKey build_on;
+    std::deque<std::pair<std::string, std::string>> rows; // stable, the table views into it
+    std::unordered_multimap<std::string_view, const std::pair<std::string, std::string>*> table;
+
+public:
+    explicit HashJoin(JoinKey on = rowKey) : build_on(std::move(on)) {}
+
+    HashJoin(const HashJoin&) = delete;
+    HashJoin& operator=(const HashJoin&) = delete;
+
+    template <typename Source>
+    void build(Source& source, const std::string& start = "", const std::string& end = "\xff") {
+        auto c = source.cursor();
+        for (c.seek(start); c.valid() && c.key() <= end; c.next()) {
+            rows.emplace_back(c.key(), c.value());
+            const auto& row = rows.back();
+            table.emplace(build_on(row.first, row.second), &row);
+        }
+    }
+
+    // Calls emit(build row, probe row) for each pair whose join columns
+    // are equal, probe rows in key order.
+    template <typename Source, typename Emit>
+    void probe(Source& source, const std::string& start, const std::string& end, const JoinKey& on, Emit emit) const {
+        probeRange(source, start, end, true, on, emit);
+    }
+
+    // probe() with [start, end] split into up to `threads` key ranges at
+    // `source`'s split keys, one thread each. Results come back in probe
+    // key order, keyed by the probe row.
+    template <typename Source>
+    std::vector<JoinedResult> parallelProbe(Source& source, const std::string& start, const std::string& end,
+                                            const JoinKey& on, int threads) const {
+        std::vector<std::vector<JoinedResult>> parts(std::max(threads, 1));
+        join_detail::runPartitioned(source, start, end, threads,
+                                    [&](size_t part, std::string lo, std::string hi, bool inclusive) {
+                                        auto emit = [&](const JoinRow& b, const JoinRow& p) {
+                                            parts[part].push_back({std::string(p.key), std::string(b.value), std::string(p.value)});
+                                        };
+                                        probeRange(source, lo, hi, inclusive, on, emit);
+                                    });
+        return join_detail::concat(parts);
+    }
+
+    size_t size() const { return rows.size(); }
+
+private:
+    template <typename Source, typename Emit>
+    void probeRange(Source& source, const std::string& lo, const std::string& hi, bool inclusive, const JoinKey& on,
+                    Emit& emit) const {
+        auto c = source.cursor();
+        for (c.seek(lo); c.valid() && (inclusive ? c.key() <= hi : c.key() < hi); c.next()) {
+            std::string_view key = c.key(), value = c.value();
+            auto range = table.equal_range(on(key, value));
+            for (auto it = range.first; it != range.second; ++it) {
+                emit(JoinRow{it->second->first, it->second->second}, JoinRow{key, value});
+            }
+        }
+    }
+};
+
+// Users joined with their orders by id, over [start_id, end_id].
+template <typename Users, typename Orders>
+std::vector<JoinedResult> joinDicts(Users& users, Orders& orders, const std::string& start_id, const std::string& end_id) {
+    std::vector<JoinedResult> final_report;
+    mergeJoin(users, orders, start_id, end_id, [&](const JoinRow& user, const JoinRow& order) {
+        final_report.push_back({std::string(user.key), std::string(user.value), std::string(order.value)});
+    });
+    return final_report;
+}
+
+#endif // JOIN_H
@@ -0,0 +1,916 @@
+#ifndef LSM_TREE_H
+#define LSM_TREE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Compaction.h"
+#include "SSTable.h"
+#include "ConcurrentSkipList.h"
+#include "SkipList.h" // FlintQuery
+
+struct LSMOptions {
+    // The memtable is frozen and flushed once it takes this much memory.
+    size_t memtable_bytes = 4 << 20;
+    SSTableOptions table;
+
+    // Level 0 is compacted into level 1 once it has this many tables;
+    // flushes wait while it has l0_stop_trigger.
+    size_t l0_compaction_trigger = 4;
+    size_t l0_stop_trigger = 12;
+    // Level 1 may hold this many bytes, every deeper level
+    // level_multiplier times as many.
+    uint64_t level_base_bytes = 10 << 20;
+    int level_multiplier = 10;
+    // Compactions start a new output table once one reaches this size.
+    uint64_t target_file_bytes = 2 << 20;
+    int compaction_threads = 2;
+    // Write budget shared by all compactions; 0 means unlimited.
+    uint64_t compaction_bytes_per_sec = 0;
+    // Needed for LSMTree::merge().
+    MergeOperator merge_operator;
+};
+
+// A consistent view of an LSMTree: reads at a snapshot see the writes
+// made before it was taken and none made after. Taken with
+// LSMTree::snapshot(); the tree keeps the records it needs until the last
+// handle is gone. Must not outlive the tree.
+class Snapshot {
+    uint64_t seq;
+
+public:
+    explicit Snapshot(uint64_t sequence) : seq(sequence) {}
+    uint64_t sequence() const { return seq; }
+};
+
+using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+// Log-structured engine with the put/get/remove/rangeScan surface of
+// BPlusTree, for write-heavy workloads.
+//
+// Every write gets the next sequence number and is stored as a record
+// under its internal key (InternalKey.h): a value, a delete, or a merge
+// operand that merge_operator later combines with the older value. Writes
+// go to an in-memory ConcurrentSkipList, the memtable, which writers fill
+// in parallel. A full memtable is frozen as the immutable memtable and a
+// fresh one takes the writes while a background thread writes the frozen
+// one out as a new SSTable in level 0. Reads merge the memtable, the
+// immutable memtable and the tables of every level, newest data first:
+// level 0 tables may overlap and are searched newest first; the tables of
+// deeper levels are sorted and disjoint. A read at a snapshot ignores
+// records newer than the snapshot.
+//
+// A pool of compaction threads keeps the levels in shape. When level 0
+// has l0_compaction_trigger tables, all of them are merged with the level
+// 1 tables they overlap; when a deeper level outgrows its target size,
+// one of its tables (round-robin over the key space) is merged with the
+// tables it overlaps one level down. The merge is a k-way heap merge that
+// keeps, per key, the records the latest data and the live snapshots
+// still need (collapseVersions), cuts its output at target_file_bytes
+// between keys, and drops a delete only if no deeper level may still hold
+// the key.
+// Compactions whose tables are disjoint run in parallel; level 0
+// compactions run one at a time so that newer data never lands below
+// older data.
+//
+// dir/MANIFEST lists the live tables; it is rewritten (write, fsync,
+// rename) whenever they change. On open, tables it does not list are
+// left-overs of an interrupted flush or compaction and are deleted.
+// Writes that were not flushed yet live only in memory: flush(), or
+// closing the tree, persists them.
+class LSMTree {
+    struct TableFile {
+        uint64_t number;
+        std::string smallest, largest;
+        std::shared_ptr<SSTable> table;
+    };
+    using TablePtr = std::shared_ptr<const TableFile>;
+    using Levels = std::vector<std::vector<TablePtr>>;
+
+    // One sorted input of a scan: a memtable, or tables of one level in
+    // key order (disjoint), opened one at a time as the scan reaches them.
+    class ScanInput {
+        std::shared_ptr<const ConcurrentSkipList> list;
+        const ConcurrentSkipList::Node* node = nullptr;
+        std::vector<TablePtr> tables;
+        size_t table_idx = 0;
+        std::optional<SSTable::Iterator> it;
+
+        // Moves on to the first record of the next table that has one.
+        void skipEmpty() {
+            while (!it->valid() && ++table_idx < tables.size()) {
+                it.emplace(*tables[table_idx]->table);
+                it->seekToFirst();
+            }
+        }
+
+    public:
+        explicit ScanInput(std::shared_ptr<const ConcurrentSkipList> memtable) : list(std::move(memtable)) {}
+        explicit ScanInput(std::vector<TablePtr> level) : tables(std::move(level)) {}
+
+        void seek(std::string_view key) {
+            if (list) {
+                node = list->seek(key);
+                return;
+            }
+            it.reset();
+            for (table_idx = 0; table_idx < tables.size() && tables[table_idx]->largest < key; ++table_idx) {}
+            if (table_idx == tables.size()) return;
+            it.emplace(*tables[table_idx]->table);
+            it->seek(key);
+            skipEmpty();
+        }
+
+        bool valid() const { return list ? node != nullptr : it && it->valid(); }
+
+        void next() {
+            if (list) {
+                node = node->next();
+            } else {
+                it->next();
+                skipEmpty();
+            }
+        }
+
+        std::string_view key() const { return list ? node->key() : it->key(); }
+        std::string_view value() const { return list ? node->value() : it->value(); }
+        uint64_t seq() const { return list ? node->seq : it->seq(); }
+        ValueType type() const { return list ? node->type : it->type(); }
+    };
+
+    struct Compaction {
+        size_t level;                   // inputs[0] are from level, inputs[1] from level + 1
+        std::vector<TablePtr> inputs[2]; // newest first
+        std::shared_ptr<const Levels> version; // when it was picked
+        std::vector<uint64_t> snapshots;       // live when it was picked, ascending
+    };
+
+    static constexpr uint64_t MANIFEST_MAGIC = 0x32534E4D544E4C46ull; // "FLNTMNS2"
+    static constexpr size_t NUM_LEVELS = 7;
+    static constexpr size_t MAX_KEY_SIZE = 65535;
+    static constexpr size_t MAX_VALUE_SIZE = 65535;
+
+    std::string dir;
+    LSMOptions options;
+
+    // Exclusive for replacing any of the pointers below. Writers insert
+    // into the memtable under a shared lock. Readers copy what they need
+    // under a shared lock and search the immutable parts after releasing
+    // it.
+    std::shared_mutex mu;
+    std::condition_variable_any cv; // imm handed over or flushed, stopping
+    std::shared_ptr<ConcurrentSkipList> mem;
+    std::shared_ptr<const ConcurrentSkipList> imm;
+    std::shared_ptr<const Levels> levels;
+    uint64_t next_file = 1;
+    // Writers take sequence numbers under the shared lock, so under the
+    // exclusive one every number up to last_sequence is in the memtable.
+    std::atomic<uint64_t> last_sequence{0};
+    std::multiset<uint64_t> snapshots; // live snapshots
+    bool stopping = false;
+    uint64_t flush_failures = 0; // failed attempts to flush imm
+    std::set<uint64_t> busy;   // tables taken by a running compaction
+    bool l0_busy = false;      // a level 0 compaction runs
+    size_t running = 0;
+    std::vector<std::string> compact_pointer; // per level: largest key of the last table compacted
+    std::thread flusher;
+    std::vector<std::thread> compactors;
+
+    std::mutex install_mu; // serializes new versions and their manifest writes
+    RateLimiter limiter;
+
+    std::string tablePath(uint64_t number) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%06llu.sst", (unsigned long long)number);
+        return dir + name;
+    }
+
+    void syncDir() {
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd < 0 || ::fsync(fd) != 0) std::cerr << "LSM: cannot sync " << dir << std::endl;
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool checkRecord(const std::string& key, const std::string& value) {
+        if (key.length() > MAX_KEY_SIZE || value.length() > MAX_VALUE_SIZE) {
+            std::cerr << "Error: Record too large (key " << key.length() << ", value " << value.length()
+                      << " bytes). Max allowed is " << MAX_KEY_SIZE << " bytes each." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // --- Manifest ---
+    // [magic u64][next file u64][last sequence u64][tables u32], then per table
+    // [level u8][number u64][smallest: len u16, bytes][largest: len u16, bytes]
+
+    static void putString(std::string& out, const std::string& s) {
+        uint16_t len = (uint16_t)s.size();
+        out.append((const char*)&len, sizeof(len));
+        out.append(s);
+    }
+
+    static bool getString(const std::string& in, size_t& pos, std::string& s) {
+        uint16_t len;
+        if (pos + sizeof(len) > in.size()) return false;
+        std::memcpy(&len, in.data() + pos, sizeof(len));
+        if (pos + sizeof(len) + len > in.size()) return false;
+        s.assign(in, pos + sizeof(len), len);
+        pos += sizeof(len) + len;
+        return true;
+    }
+
+    bool writeManifest(const Levels& lv, uint64_t next_number) {
+        std::string out;
+        uint32_t count = 0;
+        for (const auto& level : lv) count += (uint32_t)level.size();
+        out.append((const char*)&MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+        // Every record in the tables is numbered at most this.
+        uint64_t sequence = last_sequence.load();
+        out.append((const char*)&next_number, sizeof(next_number));
+        out.append((const char*)&sequence, sizeof(sequence));
+        out.append((const char*)&count, sizeof(count));
+        for (size_t l = 0; l < lv.size(); ++l) {
+            for (const TablePtr& t : lv[l]) {
+                out.push_back((char)l);
+                out.append((const char*)&t->number, sizeof(t->number));
+                putString(out, t->smallest);
+                putString(out, t->largest);
+            }
+        }
+
+        std::string tmp = dir + "/MANIFEST.tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0 && ::write(fd, out.data(), out.size()) == (ssize_t)out.size() && ::fsync(fd) == 0;
+        if (fd >= 0) ::close(fd);
+        ok = ok && ::rename(tmp.c_str(), (dir + "/MANIFEST").c_str()) == 0;
+        if (!ok) {
+            std::cerr << "LSM: failed to write the manifest" << std::endl;
+            return false;
+        }
+        syncDir();
+        return true;
+    }
+
+    // Opens the tables the manifest lists and deletes any other table.
+    // A manifest that cannot be read, or a listed table that cannot be
+    // opened, stops the open with nothing deleted.
+    void recover() {
+        auto lv = std::make_shared<Levels>(NUM_LEVELS);
+        std::set<uint64_t> listed;
+        std::string manifest = dir + "/MANIFEST";
+        std::string in;
+        FILE* f = std::fopen(manifest.c_str(), "rb");
+        if (!f && errno != ENOENT) throw std::runtime_error("LSM: cannot read " + manifest);
+        bool have_manifest = f != nullptr;
+        if (f) {
+            char chunk[4096];
+            size_t n;
+            while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) in.append(chunk, n);
+            bool failed = std::ferror(f);
+            std::fclose(f);
+            if (failed) throw std::runtime_error("LSM: cannot read " + manifest);
+        }
+
+        uint64_t magic = 0, sequence = 0;
+        uint32_t count = 0;
+        size_t pos = sizeof(magic) + sizeof(next_file) + sizeof(sequence) + sizeof(count);
+        if (have_manifest) {
+            if (in.size() >= sizeof(magic)) std::memcpy(&magic, in.data(), sizeof(magic));
+            if (magic != MANIFEST_MAGIC) throw std::runtime_error("LSM: " + manifest + " is not a manifest");
+            if (in.size() < pos) throw std::runtime_error("LSM: " + manifest + " is truncated");
+            std::memcpy(&next_file, in.data() + sizeof(magic), sizeof(next_file));
+            std::memcpy(&sequence, in.data() + sizeof(magic) + sizeof(next_file), sizeof(sequence));
+            std::memcpy(&count, in.data() + sizeof(magic) + sizeof(next_file) + sizeof(sequence), sizeof(count));
+        }
+        last_sequence = sequence;
+        for (uint32_t i = 0; i < count; ++i) {
+            auto t = std::make_shared<TableFile>();
+            uint8_t level = pos < in.size() ? (uint8_t)in[pos] : 0;
+            pos += 1;
+            bool ok = pos + sizeof(t->number) <= in.size() && level < NUM_LEVELS;
+            if (ok) {
+                std::memcpy(&t->number, in.data() + pos, sizeof(t->number));
+                pos += sizeof(t->number);
+                ok = getString(in, pos, t->smallest) && getString(in, pos, t->largest);
+            }
+            if (!ok) throw std::runtime_error("LSM: " + manifest + " is truncated");
+            t->table = SSTable::open(tablePath(t->number));
+            if (!t->table) throw std::runtime_error("LSM: cannot open " + tablePath(t->number) + ", listed in " + manifest);
+            listed.insert(t->number);
+            (*lv)[level].push_back(t);
+        }
+        levels = lv;
+
+        // Without a manifest nothing is known to be a left-over: tables are
+        // kept, and new ones are numbered past them.
+        if (DIR* d = ::opendir(dir.c_str())) {
+            while (dirent* e = ::readdir(d)) {
+                std::string name = e->d_name;
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".sst") == 0) {
+                    uint64_t number = std::strtoull(name.c_str(), nullptr, 10);
+                    if (!have_manifest) {
+                        next_file = std::max(next_file, number + 1);
+                    } else if (!listed.count(number)) {
+                        ::unlink((dir + "/" + name).c_str());
+                    }
+                } else if (name == "MANIFEST.tmp") {
+                    ::unlink((dir + "/" + name).c_str());
+                }
+            }
+            ::closedir(d);
+        }
+    }
+
+    // --- Flushing ---
+
+    TablePtr writeTable(const ConcurrentSkipList& memtable, uint64_t number, const std::vector<uint64_t>& snaps) {
+        std::string path = tablePath(number);
+        SSTableWriter writer(path, options.table);
+        std::vector<const ConcurrentSkipList::Node*> nodes;
+        std::vector<Record> records;
+        for (const ConcurrentSkipList::Node* n = memtable.first(); n;) {
+            nodes.clear();
+            std::string_view key = n->key();
+            for (; n && n->key() == key; n = n->next()) nodes.push_back(n);
+            if (nodes.size() == 1) {
+                writer.add(key, nodes[0]->seq, nodes[0]->type, nodes[0]->value());
+                continue;
+            }
+            records.clear();
+            for (const auto* v : nodes) records.push_back({std::string(key), v->seq, v->type, std::string(v->value())});
+            // Older tables may hold the key, so deletes stay.
+            collapseVersions(records, snaps, [] { return false; }, options.merge_operator, MAX_VALUE_SIZE);
+            for (const Record& r : records) writer.add(r.key, r.seq, r.type, r.value);
+        }
+        std::shared_ptr<SSTable> table = writer.finish() ? SSTable::open(path) : nullptr;
+        if (!table) {
+            ::unlink(path.c_str());
+            return nullptr;
+        }
+        return std::make_shared<TableFile>(TableFile{number, writer.smallest(), writer.largest(), table});
+    }
+
+    // Requires mu exclusively and no immutable memtable.
+    void freezeMemtable() {
+        imm = mem;
+        mem = std::make_shared<ConcurrentSkipList>();
+        cv.notify_all();
+    }
+
+    uint64_t newFileNumber() {
+        std::lock_guard<std::shared_mutex> lock(mu);
+        return next_file++;
+    }
+
+    // Publishes a version with `removed` replaced by `added` (level,
+    // table), after recording it in the manifest. `flushed` retires the
+    // immutable memtable in the same step.
+    bool install(const std::vector<TablePtr>& removed, const std::vector<std::pair<size_t, TablePtr>>& added,
+                 bool flushed) {
+        std::lock_guard<std::mutex> guard(install_mu);
+        std::shared_ptr<Levels> next;
+        uint64_t next_number;
+        {
+            std::shared_lock<std::shared_mutex> lock(mu);
+            next = std::make_shared<Levels>(*levels);
+            next_number = next_file;
+        }
+        for (auto& level : *next) {
+            level.erase(std::remove_if(level.begin(), level.end(),
+                                       [&](const TablePtr& t) {
+                                           return std::find(removed.begin(), removed.end(), t) != removed.end();
+                                       }),
+                        level.end());
+        }
+        for (const auto& [l, t] : added) {
+            auto& level = (*next)[l];
+            if (l == 0) {
+                level.insert(level.begin(), t);
+            } else {
+                auto by_start = [](const TablePtr& a, const TablePtr& b) { return a->smallest < b->smallest; };
+                level.insert(std::upper_bound(level.begin(), level.end(), t, by_start), t);
+            }
+        }
+        if (!writeManifest(*next, next_number)) return false;
+
+        std::lock_guard<std::shared_mutex> lock(mu);
+        levels = next;
+        if (flushed) imm.reset();
+        cv.notify_all();
+        return true;
+    }
+
+    // Writes each frozen memtable to a level 0 table. While level 0 is at
+    // l0_stop_trigger the flush waits for compaction, and writers stall
+    // once the next memtable is full too.
+    void flushLoop() {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        while (true) {
+            cv.wait(lock, [&] { return stopping || (imm && (*levels)[0].size() < options.l0_stop_trigger); });
+            if (!imm) return;
+            std::shared_ptr<const ConcurrentSkipList> frozen = imm;
+            uint64_t number = next_file++;
+            std::vector<uint64_t> snaps(snapshots.begin(), snapshots.end());
+            lock.unlock();
+
+            TablePtr table = writeTable(*frozen, number, snaps);
+            bool done = table && install({}, {{0, table}}, true);
+            if (table && !done) ::unlink(tablePath(number).c_str());
+
+            lock.lock();
+            if (!done) {
+                // The frozen memtable keeps serving reads; try again.
+                flush_failures++;
+                cv.notify_all();
+                if (stopping) {
+                    std::cerr << "LSM: giving up on flushing " << frozen->size() << " records" << std::endl;
+                    return;
+                }
+                cv.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    // --- Compaction ---
+
+    double score(const Levels& lv, size_t l) const {
+        if (l == 0) return (double)lv[0].size() / options.l0_compaction_trigger;
+        double target = (double)options.level_base_bytes;
+        for (size_t i = 1; i < l; ++i) target *= options.level_multiplier;
+        uint64_t bytes = 0;
+        for (const TablePtr& t : lv[l]) bytes += t->table->fileSize();
+        return bytes / target;
+    }
+
+    // Tables of a sorted level that overlap [lo, hi].
+    static std::vector<TablePtr> overlapping(const std::vector<TablePtr>& level, const std::string& lo,
+                                             const std::string& hi) {
+        std::vector<TablePtr> res;
+        auto it = std::lower_bound(level.begin(), level.end(), lo,
+                                   [](const TablePtr& t, const std::string& k) { return t->largest < k; });
+        for (; it != level.end() && (*it)->smallest <= hi; ++it) res.push_back(*it);
+        return res;
+    }
+
+    bool anyBusy(const std::vector<TablePtr>& tables) const {
+        for (const TablePtr& t : tables) {
+            if (busy.count(t->number)) return true;
+        }
+        return false;
+    }
+
+    // Picks the most urgent compaction whose tables are all free and marks
+    // them busy. Requires mu exclusively.
+    std::optional<Compaction> pickCompaction() {
+        const Levels& lv = *levels;
+        std::vector<std::pair<double, size_t>> due;
+        for (size_t l = 0; l + 1 < NUM_LEVELS; ++l) {
+            double sc = score(lv, l);
+            if (sc >= 1) due.push_back({sc, l});
+        }
+        std::sort(due.rbegin(), due.rend());
+
+        for (const auto& [sc, l] : due) {
+            Compaction c{l, {}, levels, std::vector<uint64_t>(snapshots.begin(), snapshots.end())};
+            if (l == 0) {
+                if (l0_busy) continue;
+                c.inputs[0] = lv[0];
+                std::string lo = lv[0][0]->smallest, hi = lv[0][0]->largest;
+                for (const TablePtr& t : lv[0]) {
+                    lo = std::min(lo, t->smallest);
+                    hi = std::max(hi, t->largest);
+                }
+                c.inputs[1] = overlapping(lv[1], lo, hi);
+                if (anyBusy(c.inputs[1])) continue;
+                l0_busy = true;
+            } else {
+                // The first free table after the last one compacted, wrapping around.
+                const auto& level = lv[l];
+                size_t first = std::upper_bound(level.begin(), level.end(), compact_pointer[l],
+                                                [](const std::string& k, const TablePtr& t) { return k < t->smallest; }) -
+                               level.begin();
+                for (size_t k = 0; k < level.size() && c.inputs[0].empty(); ++k) {
+                    const TablePtr& t = level[(first + k) % level.size()];
+                    if (busy.count(t->number)) continue;
+                    std::vector<TablePtr> below = overlapping(lv[l + 1], t->smallest, t->largest);
+                    if (anyBusy(below)) continue;
+                    c.inputs[0] = {t};
+                    c.inputs[1] = std::move(below);
+                }
+                if (c.inputs[0].empty()) continue;
+                compact_pointer[l] = c.inputs[0][0]->largest;
+            }
+            for (const auto& in : c.inputs) {
+                for (const TablePtr& t : in) busy.insert(t->number);
+            }
+            running++;
+            return c;
+        }
+        return std::nullopt;
+    }
+
+    // Whether a level below `level` may hold `key`.
+    static bool deeperMayHold(const Levels& lv, size_t level, std::string_view key) {
+        std::string k(key);
+        std::vector<const TableFile*> tables;
+        for (size_t l = level + 1; l < lv.size(); ++l) candidates(lv[l], false, k, tables);
+        return !tables.empty();
+    }
+
+    bool runCompaction(const Compaction& c) {
+        size_t out_level = c.level + 1;
+        std::vector<TablePtr> removed;
+        for (const auto& in : c.inputs) removed.insert(removed.end(), in.begin(), in.end());
+        // A table that overlaps nothing below just moves down.
+        if (c.level > 0 && c.inputs[1].empty()) return install(removed, {{out_level, c.inputs[0][0]}}, false);
+
+        std::vector<SSTable::Iterator> its;
+        for (const TablePtr& t : removed) its.emplace_back(*t->table);
+        MergingIterator merge(std::move(its));
+
+        std::vector<std::pair<size_t, TablePtr>> outputs;
+        std::unique_ptr<SSTableWriter> writer;
+        uint64_t number = 0, charged = 0;
+        bool ok = true;
+        auto finishOutput = [&] {
+            if (!writer) return;
+            std::string path = tablePath(number);
+            std::shared_ptr<SSTable> table = writer->finish() ? SSTable::open(path) : nullptr;
+            limiter.request(writer->fileSize() - charged);
+            if (table) {
+                outputs.push_back({out_level, std::make_shared<TableFile>(
+                                                  TableFile{number, writer->smallest(), writer->largest(), table})});
+            } else {
+                ::unlink(path.c_str());
+                ok = false;
+            }
+            writer.reset();
+        };
+        // The records of one key, newest first. Outputs are cut between
+        // keys only, so that the tables of a level stay disjoint.
+        std::vector<Record> records;
+        auto writeKey = [&] {
+            std::string key = records.front().key;
+            std::optional<bool> bottom;
+            auto isBottom = [&] {
+                if (!bottom) bottom = !deeperMayHold(*c.version, out_level, key);
+                return *bottom;
+            };
+            collapseVersions(records, c.snapshots, isBottom, options.merge_operator, MAX_VALUE_SIZE);
+            for (const Record& r : records) {
+                if (!writer) {
+                    number = newFileNumber();
+                    writer = std::make_unique<SSTableWriter>(tablePath(number), options.table);
+                    charged = 0;
+                }
+                writer->add(r.key, r.seq, r.type, r.value);
+                if (writer->fileSize() - charged >= (1 << 16)) {
+                    limiter.request(writer->fileSize() - charged);
+                    charged = writer->fileSize();
+                }
+            }
+            records.clear();
+            if (writer && writer->fileSize() >= options.target_file_bytes) finishOutput();
+        };
+        for (merge.seekToFirst(); ok && merge.valid(); merge.next()) {
+            if (!records.empty() && records.front().key != merge.key()) writeKey();
+            records.push_back({std::string(merge.key()), merge.seq(), merge.type(), std::string(merge.value())});
+        }
+        if (ok && !records.empty()) writeKey();
+        finishOutput();
+
+        if (!ok || !install(removed, outputs, false)) {
+            for (const auto& out : outputs) ::unlink(tablePath(out.second->number).c_str());
+            return false;
+        }
+        // Readers of older versions keep the files open; unlinking is safe.
+        for (const TablePtr& t : removed) ::unlink(tablePath(t->number).c_str());
+        return true;
+    }
+
+    void compactionLoop() {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        while (true) {
+            std::optional<Compaction> c;
+            cv.wait(lock, [&] { return stopping || (c = pickCompaction()).has_value(); });
+            if (!c) return;
+            lock.unlock();
+            bool ok = runCompaction(*c);
+            lock.lock();
+            for (const auto& in : c->inputs) {
+                for (const TablePtr& t : in) busy.erase(t->number);
+            }
+            if (c->level == 0) l0_busy = false;
+            running--;
+            cv.notify_all();
+            if (!ok) cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+
+    bool compactionDue() const {
+        for (size_t l = 0; l + 1 < NUM_LEVELS; ++l) {
+            if (score(*levels, l) >= 1) return true;
+        }
+        return false;
+    }
+
+    void write(const std::string& key, ValueType type, const std::string& value) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mu);
+            mem->add(key, last_sequence.fetch_add(1) + 1, type, value);
+            if (mem->memoryUsage() < options.memtable_bytes) return;
+        }
+        // A memtable that fills while the previous one is still being
+        // written stalls its writers until the flush is done.
+        std::unique_lock<std::shared_mutex> lock(mu);
+        cv.wait(lock, [&] { return !imm || mem->memoryUsage() < options.memtable_bytes; });
+        if (!imm && mem->memoryUsage() >= options.memtable_bytes) freezeMemtable();
+    }
+
+    // Tables of `level` whose key range includes `key`, newest first.
+    static void candidates(const std::vector<TablePtr>& level, bool overlapping, const std::string& key,
+                           std::vector<const TableFile*>& out) {
+        if (overlapping) {
+            for (const TablePtr& t : level) {
+                if (t->smallest <= key && key <= t->largest) out.push_back(t.get());
+            }
+            return;
+        }
+        auto it = std::lower_bound(level.begin(), level.end(), key,
+                                   [](const TablePtr& t, const std::string& k) { return t->largest < k; });
+        if (it != level.end() && (*it)->smallest <= key) out.push_back(it->get());
+    }
+
+public:
+    explicit LSMTree(const std::string& directory = "lsm", const LSMOptions& opts = LSMOptions())
+        : dir(directory), options(opts), mem(std::make_shared<ConcurrentSkipList>()),
+          compact_pointer(NUM_LEVELS), limiter(opts.compaction_bytes_per_sec) {
+        ::mkdir(dir.c_str(), 0755);
+        recover();
+        flusher = std::thread(&LSMTree::flushLoop, this);
+        for (int i = 0; i < std::max(1, options.compaction_threads); ++i) {
+            compactors.emplace_back(&LSMTree::compactionLoop, this);
+        }
+    }
+
+    // Running compactions are finished first. A flush that fails is
+    // reported and not waited for.
+    ~LSMTree() {
+        flush();
+        {
+            std::lock_guard<std::shared_mutex> lock(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (flusher.joinable()) flusher.join();
+        for (auto& t : compactors) t.join();
+    }
+
+    LSMTree(const LSMTree&) = delete;
+    LSMTree& operator=(const LSMTree&) = delete;
+
+    // Safe to call from several threads.
+    void put(const std::string& key, const std::string& value) {
+        if (!checkRecord(key, value)) return;
+        write(key, ValueType::Value, value);
+    }
+
+    // Records `operand` to be combined with the current value of `key` by
+    // options.merge_operator, lazily: reads apply it, compactions fold it
+    // in once no snapshot needs the two apart.
+    void merge(const std::string& key, const std::string& operand) {
+        if (!options.merge_operator) {
+            std::cerr << "Error: merge() needs LSMOptions::merge_operator." << std::endl;
+            return;
+        }
+        if (!checkRecord(key, operand)) return;
+        write(key, ValueType::Merge, operand);
+    }
+
+    // Pins the current contents for reads; see Snapshot.
+    SnapshotPtr snapshot() {
+        std::lock_guard<std::shared_mutex> lock(mu);
+        uint64_t seq = last_sequence.load();
+        snapshots.insert(seq);
+        return SnapshotPtr(new Snapshot(seq), [this](const Snapshot* snap) {
+            {
+                std::lock_guard<std::shared_mutex> lock(mu);
+                snapshots.erase(snapshots.find(snap->sequence()));
+            }
+            delete snap;
+        });
+    }
+
+    // Reads the latest data, or the data as of `snap`.
+    std::optional<std::string> get(const std::string& key, const SnapshotPtr& snap = nullptr) {
+        uint64_t seq = snap ? snap->sequence() : MAX_SEQUENCE;
+        ValueResolver resolver;
+        auto fromMemtable = [&](const ConcurrentSkipList& list) {
+            for (const ConcurrentSkipList::Node* n = list.seek(key, seq); n && n->key() == key; n = n->next()) {
+                if (resolver.add(n->type, n->value())) return true;
+            }
+            return false;
+        };
+        std::shared_ptr<const ConcurrentSkipList> frozen;
+        std::shared_ptr<const Levels> current;
+        {
+            std::shared_lock<std::shared_mutex> lock(mu);
+            if (fromMemtable(*mem)) return resolver.result(key, options.merge_operator);
+            frozen = imm;
+            current = levels;
+        }
+        if (frozen && fromMemtable(*frozen)) return resolver.result(key, options.merge_operator);
+        std::vector<const TableFile*> tables;
+        for (size_t l = 0; l < current->size(); ++l) {
+            tables.clear();
+            candidates((*current)[l], l == 0, key, tables);
+            for (const TableFile* t : tables) {
+                if (!t->table->mayContain(key)) continue;
+                SSTable::Iterator it(*t->table);
+                for (it.seek(key, seq); it.valid() && it.key() == key; it.next()) {
+                    if (resolver.add(it.type(), it.value())) return resolver.result(key, options.merge_operator);
+                }
+            }
+        }
+        return resolver.result(key, options.merge_operator);
+    }
+
+    // Writes a delete. Returns whether the key was present, which takes a
+    // lookup.
+    bool remove(const std::string& key) {
+        bool present = get(key).has_value();
+        write(key, ValueType::Delete, "");
+        return present;
+    }
+
+    // Reads [start, end] in key order, from the latest data or as of a
+    // snapshot, one key at a time: the memtables and tables are merged
+    // as the cursor moves and each key is resolved from its records,
+    // newest first, when the cursor reaches it. A reader that stops early
+    // reads no further. The cursor keeps the memtables, tables and
+    // snapshot it reads alive; the tree must outlive it. Opened with
+    // LSMTree::scan().
+    class Cursor {
+        MergingIterator<ScanInput> merged;
+        SnapshotPtr snap;
+        uint64_t seq;
+        std::string end;
+        const MergeOperator* merge;
+        std::string cur_key, cur_value;
+        bool is_valid = false;
+
+        // Resolves keys from the merge position on until one has a value.
+        void settle() {
+            is_valid = false;
+            while (merged.valid() && merged.key() <= end) {
+                cur_key.assign(merged.key());
+                ValueResolver resolver;
+                for (; merged.valid() && merged.key() == cur_key; merged.next()) {
+                    if (merged.seq() <= seq && !resolver.done()) resolver.add(merged.type(), merged.value());
+                }
+                if (resolver.empty()) continue;
+                if (auto value = resolver.result(cur_key, *merge)) {
+                    cur_value = std::move(*value);
+                    is_valid = true;
+                    return;
+                }
+            }
+        }
+
+    public:
+        Cursor(std::vector<ScanInput> inputs, SnapshotPtr at, const std::string& start, std::string last,
+               const MergeOperator& merge_operator)
+            : merged(std::move(inputs)), snap(std::move(at)), seq(snap ? snap->sequence() : MAX_SEQUENCE),
+              end(std::move(last)), merge(&merge_operator) {
+            merged.seek(start);
+            settle();
+        }
+
+        bool valid() const { return is_valid; }
+        void next() { settle(); }
+        // Valid until the next call to next().
+        std::string_view key() const { return cur_key; }
+        std::string_view value() const { return cur_value; }
+    };
+
+    // Cursor over [start, end] from the latest data, or as of `snap`.
+    Cursor scan(const std::string& start, const std::string& end, const SnapshotPtr& snap = nullptr) {
+        std::vector<ScanInput> inputs; // newest first
+        std::shared_ptr<const Levels> current;
+        {
+            std::shared_lock<std::shared_mutex> lock(mu);
+            inputs.emplace_back(mem);
+            if (imm) inputs.emplace_back(imm);
+            current = levels;
+        }
+        for (size_t l = 0; l < current->size(); ++l) {
+            std::vector<TablePtr> tables;
+            for (const TablePtr& t : (*current)[l]) {
+                if (t->largest < start || end < t->smallest) continue;
+                // Level 0 tables may overlap: one input each.
+                if (l == 0) inputs.emplace_back(std::vector<TablePtr>{t});
+                else tables.push_back(t);
+            }
+            if (!tables.empty()) inputs.emplace_back(std::move(tables));
+        }
+        return Cursor(std::move(inputs), snap, start, end, options.merge_operator);
+    }
+
+    // Materializes [start, end] from the latest data, or as of `snap`.
+    std::vector<std::pair<std::string, std::string>> rangeScan(const std::string& start, const std::string& end,
+                                                               const SnapshotPtr& snap = nullptr) {
+        std::vector<std::pair<std::string, std::string>> res;
+        for (Cursor c = scan(start, end, snap); c.valid(); c.next()) res.emplace_back(c.key(), c.value());
+        return res;
+    }
+
+    // FlintQuery over this tree: reads at `snap`, or at the latest data
+    // when the query runs. The query keeps the snapshot alive.
+    FlintQuery query(SnapshotPtr snap = nullptr) {
+        return FlintQuery([this, snap](const std::string& start, const std::string& end) -> FlintQuery::Next {
+            auto c = std::make_shared<Cursor>(scan(start, end, snap));
+            return [c](std::pair<std::string, std::string>& record) {
+                if (!c->valid()) return false;
+                record.first.assign(c->key());
+                record.second.assign(c->value());
+                c->next();
+                return true;
+            };
+        });
+    }
+
+    // Writes the memtable out and waits until every write made so far is
+    // in a table. Returns false once a flush attempt fails; the records
+    // stay in memory and the flush keeps being retried.
+    bool flush() {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        uint64_t failures = flush_failures;
+        auto settled = [&] { return !imm || flush_failures != failures; };
+        cv.wait(lock, settled);
+        if (!imm && mem->size() > 0) {
+            freezeMemtable();
+            cv.wait(lock, settled);
+        }
+        if (!imm) return true;
+        std::cerr << "LSM: flush failed, " << imm->size() + mem->size() << " records are only in memory" << std::endl;
+        return false;
+    }
+
+    // Waits until no flush or compaction is running or due.
+    void waitForCompactions() {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        cv.wait(lock, [&] { return !imm && running == 0 && !compactionDue(); });
+    }
+
+    // The tables of every level below 0 are sorted and disjoint, and the
+    // key ranges recorded for each table match the table.
+    bool checkInvariants() {
+        std::shared_ptr<const Levels> current;
+        {
+            std::shared_lock<std::shared_mutex> lock(mu);
+            current = levels;
+        }
+        for (size_t l = 0; l < current->size(); ++l) {
+            const auto& level = (*current)[l];
+            for (size_t i = 0; i < level.size(); ++i) {
+                const TableFile& t = *level[i];
+                if (t.smallest != t.table->smallest() || t.largest != t.table->largest() || t.smallest > t.largest) {
+                    std::cerr << "LSM: key range of table " << t.number << " does not match" << std::endl;
+                    return false;
+                }
+                if (l > 0 && i > 0 && !(level[i - 1]->largest < t.smallest)) {
+                    std::cerr << "LSM: tables " << level[i - 1]->number << " and " << t.number << " overlap in level "
+                              << l << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Number of tables in each level.
+    std::vector<size_t> tablesPerLevel() {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        std::vector<size_t> res;
+        for (const auto& level : *levels) res.push_back(level.size());
+        return res;
+    }
+};
+
+#endif // LSM_TREE_H
@@ -0,0 +1,163 @@
+#ifndef LEAF_NODE_H
+#define LEAF_NODE_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "Page.h"
+
+// Layout of leaves:
+//
+//   PageHeader | Slot[n] | free gap | records
+//
+// Slots are sorted by key; each points at a record (format in Page.h).
+// Records sit between free_space_offset and the end of the page in no
+// particular order. Erasing a record only drops its slot: the bytes it
+// leaves behind are counted in PageHeader::fragmented and reclaimed by
+// compact(), which runs only when a record has to be added and the free
+// gap is too small. Structural changes move whole slot ranges; nothing
+// is re-inserted record by record.
+class LeafNode {
+public:
+    struct Slot {
+        uint16_t offset;
+        uint16_t length; // of the whole record
+    };
+
+    // Records: [key length u8][key][value field u16][stored value].
+    static size_t recordSize(size_t key_len, size_t stored_len) {
+        return 1 + key_len + sizeof(uint16_t) + stored_len;
+    }
+
+    static uint16_t valueField(const char* rec) {
+        uint16_t field;
+        std::memcpy(&field, rec + 1 + (uint8_t)rec[0], sizeof(field));
+        return field;
+    }
+
+    static size_t recordSize(const char* rec) { return recordSize((uint8_t)rec[0], valueField(rec) & ~OVERFLOW_FLAG); }
+    static bool isOverflow(const char* rec) { return valueField(rec) & OVERFLOW_FLAG; }
+
+    static std::string_view recordKey(const char* rec) { return std::string_view(rec + 1, (uint8_t)*rec); }
+
+    static std::string_view storedValue(const char* rec) {
+        return std::string_view(rec + 1 + (uint8_t)rec[0] + sizeof(uint16_t), valueField(rec) & ~OVERFLOW_FLAG);
+    }
+
+    static void writeRecord(char* dst, std::string_view key, std::string_view stored, bool overflow) {
+        uint16_t field = (uint16_t)stored.size() | (overflow ? OVERFLOW_FLAG : 0);
+        dst[0] = (uint8_t)key.size();
+        std::memcpy(dst + 1, key.data(), key.size());
+        std::memcpy(dst + 1 + key.size(), &field, sizeof(field));
+        std::memcpy(dst + 1 + key.size() + sizeof(field), stored.data(), stored.size());
+    }
+
+    static Slot* slots(char* page) { return (Slot*)(page + sizeof(PageHeader)); }
+    static const Slot* slots(const char* page) { return (const Slot*)(page + sizeof(PageHeader)); }
+
+    // Bytes taken by slots and live records.
+    static size_t used(const char* page) {
+        const PageHeader* h = (const PageHeader*)page;
+        return h->num_slots * sizeof(Slot) + (PAGE_SIZE - h->free_space_offset) - h->fragmented;
+    }
+
+    // Whether a record of `size` bytes fits, after compaction if need be.
+    static bool hasRoom(const char* page, size_t size) {
+        return sizeof(PageHeader) + used(page) + sizeof(Slot) + size <= PAGE_SIZE;
+    }
+
+    // Packs the live records against the end of the page.
+    static void compact(char* page) {
+        PageHeader* h = (PageHeader*)page;
+        Slot* sl = slots(page);
+        char buffer[PAGE_SIZE];
+        uint32_t offset = PAGE_SIZE;
+        for (uint32_t i = 0; i < h->num_slots; ++i) {
+            offset -= sl[i].length;
+            std::memcpy(buffer + offset, page + sl[i].offset, sl[i].length);
+            sl[i].offset = (uint16_t)offset;
+        }
+        std::memcpy(page + offset, buffer + offset, PAGE_SIZE - offset);
+        h->free_space_offset = offset;
+        h->fragmented = 0;
+    }
+
+    // Inserts a record at slot `idx`. hasRoom() must hold.
+    static void insert(char* page, int idx, std::string_view key, std::string_view stored, bool overflow) {
+        size_t size = recordSize(key.size(), stored.size());
+        char* dst = reserve(page, size);
+        writeRecord(dst, key, stored, overflow);
+        addSlot(page, idx, dst, size);
+    }
+
+    // Copies record `rec` in behind the last slot. hasRoom() must hold.
+    static void append(char* page, const char* rec) {
+        size_t size = recordSize(rec);
+        char* dst = reserve(page, size);
+        std::memcpy(dst, rec, size);
+        addSlot(page, (int)((PageHeader*)page)->num_slots, dst, size);
+    }
+
+    // Drops slot `idx`. The record at the edge of the gap is given back at
+    // once; any other leaves a hole.
+    static void erase(char* page, int idx) {
+        PageHeader* h = (PageHeader*)page;
+        Slot* sl = slots(page);
+        Slot gone = sl[idx];
+        std::memmove(&sl[idx], &sl[idx + 1], (h->num_slots - idx - 1) * sizeof(Slot));
+        h->num_slots--;
+        if (gone.offset == h->free_space_offset) h->free_space_offset += gone.length;
+        else h->fragmented += gone.length;
+    }
+
+    static void clear(char* page) {
+        PageHeader* h = (PageHeader*)page;
+        h->num_slots = 0;
+        h->free_space_offset = PAGE_SIZE;
+        h->fragmented = 0;
+    }
+
+    // Split: moves slots [from, n) of `src` to the empty leaf `dst`, packed.
+    // `src` keeps the other slots and counts the moved records as holes.
+    static void moveUpper(char* src, uint32_t from, char* dst) {
+        PageHeader* sh = (PageHeader*)src;
+        PageHeader* dh = (PageHeader*)dst;
+        const Slot* ss = slots(src);
+        Slot* ds = slots(dst);
+        uint32_t offset = PAGE_SIZE, moved = 0;
+        for (uint32_t i = from; i < sh->num_slots; ++i) {
+            offset -= ss[i].length;
+            std::memcpy(dst + offset, src + ss[i].offset, ss[i].length);
+            ds[i - from] = {(uint16_t)offset, ss[i].length};
+            moved += ss[i].length;
+        }
+        dh->num_slots = sh->num_slots - from;
+        dh->free_space_offset = offset;
+        dh->fragmented = 0;
+        sh->num_slots = from;
+        sh->fragmented += moved;
+    }
+
+private:
+    // Room for `size` more record bytes and one more slot, compacting only
+    // if the gap is too small.
+    static char* reserve(char* page, size_t size) {
+        assert(hasRoom(page, size));
+        PageHeader* h = (PageHeader*)page;
+        size_t slot_end = sizeof(PageHeader) + (h->num_slots + 1) * sizeof(Slot);
+        if (h->free_space_offset < slot_end + size) compact(page);
+        h->free_space_offset -= (uint32_t)size;
+        return page + h->free_space_offset;
+    }
+
+    static void addSlot(char* page, int idx, const char* rec, size_t size) {
+        PageHeader* h = (PageHeader*)page;
+        Slot* sl = slots(page);
+        std::memmove(&sl[idx + 1], &sl[idx], (h->num_slots - idx) * sizeof(Slot));
+        sl[idx] = {(uint16_t)(rec - page), (uint16_t)size};
+        h->num_slots++;
+    }
+};
+
+#endif // LEAF_NODE_H
@@ -8,21 +8,63 @@
 #pragma pack(push, 1)
 struct PageHeader {
     uint32_t page_id;
-    uint32_t parent_id;         // Needed for Bottom-Up Splitting
     uint32_t next_sibling;      // Needed for Horizontal Range Scans
     uint32_t lower_bound_child; // The pointer for values < entries[0].key
     bool is_leaf;
     uint32_t num_slots;
     uint32_t free_space_offset;
+    uint16_t fragmented;        // leaves: bytes of erased records not yet compacted away
+    uint64_t page_lsn;          // LSN of the last logged image (WAL redo check)
+    uint8_t reserved;           // pads the header to 32 bytes, so the slot arrays behind it are aligned
 };
 
-// Internal nodes store Key + Child PageID
-struct IndexEntry {
-    char key[16]; // Simplified fixed-length keys for the split logic
-    uint32_t child_page_id;
+// Page 0. Starts with a regular header so it is logged like any other page.
+struct MetaPage {
+    PageHeader header;
+    uint32_t root_id;
+    uint32_t free_list_page; // first page of the persisted free list, 0 if none
+};
+
+// Freed pages are zeroed apart from page_id. free_space_offset == 0 marks
+// them: no live page has it. At a checkpoint the free page ids are written
+// to a chain of free-list pages (next_sibling links them, num_slots counts
+// the ids that follow the header).
+
+// Internal nodes are slotted like leaves: a slot per separator holds the
+// child and points at the separator's suffix, stored from the end of the
+// page. The prefix shared by every separator in the node is stored once.
+struct InternalHeader { // follows the PageHeader of internal nodes
+    uint16_t prefix_offset;
+    uint16_t prefix_len;
+};
+
+struct IndexSlot {
+    uint16_t offset; // suffix of the separator, without the node prefix
+    uint16_t length;
+    uint32_t child_page_id; // subtree with keys >= the separator
+};
+
+// Leaf records are [key length u8][key][value length u16][value]. Values
+// above INLINE_VALUE_MAX are written to a run of consecutive overflow
+// pages; the record then stores an OverflowRef instead, and its length
+// field has OVERFLOW_FLAG set.
+struct OverflowRef {
+    uint32_t first_page;
+    uint32_t length; // of the value
 };
 #pragma pack(pop)
 
+static_assert(sizeof(PageHeader) % 8 == 0, "slot arrays follow the page header");
+
 const size_t PAGE_SIZE = 4096;
+const uint16_t OVERFLOW_FLAG = 0x8000;
+const size_t INLINE_VALUE_MAX = PAGE_SIZE / 8;
+// Overflow pages hold a PageHeader (num_slots: payload bytes, next_sibling:
+// next page of the run, 0 on the last) followed by the payload.
+const size_t OVERFLOW_PAYLOAD = PAGE_SIZE - sizeof(PageHeader);
+// Largest value a record can hold. Overflow runs are written a page at a
+// time, so it does not depend on the size of the buffer pool.
+const size_t MAX_VALUE_SIZE = 16u << 20;
+const size_t FREE_IDS_PER_PAGE = (PAGE_SIZE - sizeof(PageHeader)) / sizeof(uint32_t);
 
 #endif // PAGE_H
\ No newline at end of file
@@ -0,0 +1,522 @@
+#ifndef PAGEIO_H
+#define PAGEIO_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define FLINTKV_HAVE_IO_URING 1
+#endif
+
+#include "Page.h"
+
+enum class IoBackend { FStream, Pread, IoUring };
+
+struct PageRead {
+    uint32_t page_id;
+    char* buf;
+};
+
+struct PageWrite {
+    uint32_t page_id;
+    const char* buf;
+};
+
+// Page-granular access to db.bin. Reads past the end of the file return
+// zeroed pages; writes past the end extend it. Reads return false on an
+// I/O error or a page cut short by the end of the file, writes and sync()
+// if the data may not have reached the file, truncate() if the file kept
+// its size. The batch calls let a
+// backend keep several requests in flight; the defaults just loop.
+class PageIO {
+public:
+    virtual ~PageIO() = default;
+
+    virtual bool readPage(uint32_t id, char* buf) = 0;
+    virtual bool writePage(uint32_t id, const char* buf) = 0;
+    virtual uint32_t pageCount() = 0;
+    virtual bool sync() = 0;
+    virtual bool truncate(uint32_t pages) = 0; // drops every page >= pages
+
+    virtual bool readPages(const std::vector<PageRead>& reqs) {
+        bool ok = true;
+        for (const auto& r : reqs) ok = readPage(r.page_id, r.buf) && ok;
+        return ok;
+    }
+
+    virtual bool writePages(const std::vector<PageWrite>& reqs) {
+        bool ok = true;
+        for (const auto& w : reqs) ok = writePage(w.page_id, w.buf) && ok;
+        return ok;
+    }
+
+    // Writes `count` consecutive pages starting at first_id from one
+    // contiguous buffer (bulk loading).
+    virtual bool writeExtent(uint32_t first_id, const char* buf, uint32_t count) {
+        bool ok = true;
+        for (uint32_t i = 0; i < count; ++i) ok = writePage(first_id + i, buf + (size_t)i * PAGE_SIZE) && ok;
+        return ok;
+    }
+};
+
+// The original single-stream backend, kept for portability. One shared
+// file position, so every call is serialized.
+class FStreamPageIO : public PageIO {
+    std::fstream file;
+    std::mutex mu;
+    int sync_fd = -1;
+
+public:
+    explicit FStreamPageIO(const std::string& path) {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file.is_open()) {
+            std::ofstream create(path, std::ios::binary);
+            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        }
+        sync_fd = ::open(path.c_str(), O_RDWR);
+    }
+
+    ~FStreamPageIO() override {
+        if (sync_fd >= 0) ::close(sync_fd);
+    }
+
+    bool readPage(uint32_t id, char* buf) override {
+        std::lock_guard<std::mutex> lock(mu);
+        std::memset(buf, 0, PAGE_SIZE);
+        file.clear();
+        file.seekg((std::streamoff)id * PAGE_SIZE);
+        file.read(buf, PAGE_SIZE);
+        std::streamsize n = file.gcount();
+        bool ok = n == (std::streamsize)PAGE_SIZE || (n == 0 && file.eof() && !file.bad());
+        file.clear(); // a read past EOF leaves the zeroed page
+        if (!ok) std::cerr << "PageIO: read of page " << id << " failed" << std::endl;
+        return ok;
+    }
+
+    bool writePage(uint32_t id, const char* buf) override {
+        std::lock_guard<std::mutex> lock(mu);
+        file.clear();
+        file.seekp((std::streamoff)id * PAGE_SIZE);
+        file.write(buf, PAGE_SIZE);
+        if (file.good()) return true;
+        std::cerr << "PageIO: write of page " << id << " failed" << std::endl;
+        return false;
+    }
+
+    uint32_t pageCount() override {
+        std::lock_guard<std::mutex> lock(mu);
+        file.clear();
+        file.seekg(0, std::ios::end);
+        return (uint32_t)(file.tellg() / PAGE_SIZE);
+    }
+
+    bool sync() override {
+        std::lock_guard<std::mutex> lock(mu);
+        file.clear();
+        file.flush();
+        if (file.good() && sync_fd >= 0 && ::fdatasync(sync_fd) == 0) return true;
+        std::cerr << "PageIO: sync failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool truncate(uint32_t pages) override {
+        std::lock_guard<std::mutex> lock(mu);
+        file.flush();
+        if (sync_fd >= 0 && ::ftruncate(sync_fd, (off_t)pages * PAGE_SIZE) == 0) return true;
+        std::cerr << "PageIO: truncate failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+};
+
+// Positional I/O: no shared file offset, so concurrent callers never
+// serialize on the descriptor.
+class PosixPageIO : public PageIO {
+protected:
+    int fd = -1;
+    bool direct = false;
+
+public:
+    // With O_DIRECT in extra_flags every buffer passed in must be
+    // PAGE_SIZE-aligned. File systems that reject O_DIRECT (e.g. tmpfs)
+    // get a buffered descriptor instead.
+    explicit PosixPageIO(const std::string& path, int extra_flags = 0) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | extra_flags, 0644);
+        direct = fd >= 0 && (extra_flags & O_DIRECT);
+        if (fd < 0 && (extra_flags & O_DIRECT)) {
+            std::cerr << "PageIO: O_DIRECT rejected for " << path << " (" << std::strerror(errno)
+                      << "), using buffered I/O" << std::endl;
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | (extra_flags & ~O_DIRECT), 0644);
+        }
+        if (fd < 0) std::cerr << "PageIO: cannot open " << path << ": " << std::strerror(errno) << std::endl;
+    }
+
+    bool isDirect() const { return direct; }
+
+    ~PosixPageIO() override {
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool readPage(uint32_t id, char* buf) override {
+        off_t off = (off_t)id * PAGE_SIZE;
+        size_t done = 0;
+        while (done < PAGE_SIZE) {
+            ssize_t n = ::pread(fd, buf + done, PAGE_SIZE - done, off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                std::cerr << "PageIO: read of page " << id << " failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            if (n == 0) break;
+            done += n;
+        }
+        if (done > 0 && done < PAGE_SIZE) {
+            std::cerr << "PageIO: page " << id << " is cut short by the end of the file" << std::endl;
+            return false;
+        }
+        if (done == 0) std::memset(buf, 0, PAGE_SIZE);
+        return true;
+    }
+
+    bool writePage(uint32_t id, const char* buf) override {
+        off_t off = (off_t)id * PAGE_SIZE;
+        size_t done = 0;
+        while (done < PAGE_SIZE) {
+            ssize_t n = ::pwrite(fd, buf + done, PAGE_SIZE - done, off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "PageIO: write of page " << id << " failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    bool writeExtent(uint32_t first_id, const char* buf, uint32_t count) override {
+        off_t off = (off_t)first_id * PAGE_SIZE;
+        size_t len = (size_t)count * PAGE_SIZE;
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = ::pwrite(fd, buf + done, len - done, off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::cerr << "PageIO: write of pages " << first_id << ".." << first_id + count - 1
+                          << " failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    uint32_t pageCount() override {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return 0;
+        return (uint32_t)(st.st_size / PAGE_SIZE);
+    }
+
+    bool sync() override {
+        if (::fdatasync(fd) == 0) return true;
+        std::cerr << "PageIO: sync failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool truncate(uint32_t pages) override {
+        if (::ftruncate(fd, (off_t)pages * PAGE_SIZE) == 0) return true;
+        std::cerr << "PageIO: truncate failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+};
+
+#ifdef FLINTKV_HAVE_IO_URING
+// io_uring backend driven through the raw syscalls (no liburing needed).
+// Single-page calls stay synchronous pread/pwrite; batches are submitted
+// to the ring in one io_uring_enter so the device sees the whole queue.
+// Falls back to the positional path if the kernel refuses to set up a ring.
+class IoUringPageIO : public PosixPageIO {
+    int ring_fd = -1;
+    unsigned sq_entries = 0;
+
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    std::mutex ring_mu;
+
+    bool setupRing(unsigned depth) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        ring_fd = (int)::syscall(__NR_io_uring_setup, depth, &p);
+        if (ring_fd < 0) return false;
+        sq_entries = p.sq_entries;
+
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ptr = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) return false;
+        cq_ptr = single_mmap ? sq_ptr
+            : ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            sqes = nullptr;
+            return false;
+        }
+
+        char* sq = (char*)sq_ptr;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        char* cq = (char*)cq_ptr;
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    void teardownRing() {
+        if (sqes) ::munmap(sqes, sqes_len);
+        if (cq_ptr && cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_len);
+        if (sq_ptr && sq_ptr != MAP_FAILED) ::munmap(sq_ptr, sq_len);
+        if (ring_fd >= 0) ::close(ring_fd);
+        ring_fd = -1;
+        sqes = nullptr;
+        sq_ptr = cq_ptr = nullptr;
+    }
+
+    // Submits one chunk (at most sq_entries requests) and reaps all of its
+    // completions. Requests that fail or come back short are redone with
+    // the synchronous path. If the ring itself fails, the requests it
+    // already took still own their buffers: their completions are awaited
+    // before the ring is dropped, and only requests without one are redone.
+    // False if a redone request failed too.
+    bool submitChunk(uint8_t opcode, uint32_t* ids, char** bufs, size_t n) {
+        unsigned tail = *sq_tail;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned idx = tail & *sq_mask;
+            io_uring_sqe* sqe = &sqes[idx];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)bufs[i];
+            sqe->len = PAGE_SIZE;
+            sqe->off = (uint64_t)ids[i] * PAGE_SIZE;
+            sqe->user_data = i;
+            sq_array[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+        bool ok = true;
+        auto redo = [&](size_t i) {
+            if (opcode == IORING_OP_READ) ok = PosixPageIO::readPage(ids[i], bufs[i]) && ok;
+            else ok = PosixPageIO::writePage(ids[i], bufs[i]) && ok;
+        };
+        std::vector<bool> done(n, false);
+        size_t completed = 0;
+        auto reap = [&] {
+            unsigned head = *cq_head;
+            while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe* cqe = &cqes[head & *cq_mask];
+                size_t i = (size_t)cqe->user_data;
+                if (cqe->res != (int)PAGE_SIZE) redo(i);
+                done[i] = true;
+                head++;
+                completed++;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        };
+
+        size_t to_submit = n;
+        while (completed < n) {
+            int ret = (int)::syscall(__NR_io_uring_enter, ring_fd, (unsigned)to_submit,
+                                     (unsigned)(n - completed), IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0 && errno != EINTR) break;
+            if (ret > 0) to_submit -= std::min<size_t>(to_submit, (size_t)ret);
+            reap();
+        }
+        if (completed < n) {
+            // The ring is unusable. Requests it never took cannot run any
+            // more; the ones it did are waited for, by polling the
+            // completion queue if waiting in the kernel fails too.
+            size_t submitted = n - to_submit;
+            reap();
+            while (completed < submitted) {
+                if (::syscall(__NR_io_uring_enter, ring_fd, 0u, (unsigned)(submitted - completed),
+                              IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                reap();
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (!done[i]) redo(i);
+            }
+            teardownRing();
+        }
+        return ok;
+    }
+
+    template <typename Req>
+    bool submitBatch(uint8_t opcode, const std::vector<Req>& reqs) {
+        std::lock_guard<std::mutex> lock(ring_mu);
+        bool ok = true;
+        std::vector<uint32_t> ids(sq_entries);
+        std::vector<char*> bufs(sq_entries);
+        for (size_t start = 0; start < reqs.size(); start += sq_entries) {
+            size_t n = std::min<size_t>(sq_entries, reqs.size() - start);
+            for (size_t i = 0; i < n; ++i) {
+                ids[i] = reqs[start + i].page_id;
+                bufs[i] = (char*)reqs[start + i].buf;
+            }
+            if (ring_fd < 0) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (opcode == IORING_OP_READ) ok = PosixPageIO::readPage(ids[i], bufs[i]) && ok;
+                    else ok = PosixPageIO::writePage(ids[i], bufs[i]) && ok;
+                }
+            } else {
+                ok = submitChunk(opcode, ids.data(), bufs.data(), n) && ok;
+            }
+        }
+        return ok;
+    }
+
+public:
+    explicit IoUringPageIO(const std::string& path, unsigned queue_depth = 64, int extra_flags = 0)
+        : PosixPageIO(path, extra_flags) {
+        if (!setupRing(queue_depth)) {
+            std::cerr << "PageIO: io_uring unavailable (" << std::strerror(errno)
+                      << "), using pread/pwrite" << std::endl;
+            teardownRing();
+        }
+    }
+
+    ~IoUringPageIO() override { teardownRing(); }
+
+    bool usingRing() const { return ring_fd >= 0; }
+
+    bool readPages(const std::vector<PageRead>& reqs) override {
+        if (reqs.size() < 2 || ring_fd < 0) return PosixPageIO::readPages(reqs);
+        return submitBatch(IORING_OP_READ, reqs);
+    }
+
+    bool writePages(const std::vector<PageWrite>& reqs) override {
+        if (reqs.size() < 2 || ring_fd < 0) return PosixPageIO::writePages(reqs);
+        return submitBatch(IORING_OP_WRITE, reqs);
+    }
+};
+#endif // FLINTKV_HAVE_IO_URING
+
+enum class AccessPattern { Random, Sequential };
+
+// Read-only MAP_SHARED view of db.bin. Pages are read straight from the
+// kernel page cache; writes still go through PageIO, which keeps the
+// mapping coherent. Growing the view creates a new, larger mapping and
+// retires the old one instead of unmapping it, so pointers handed out
+// earlier stay valid until the mapping object is destroyed.
+class PageMapping {
+    struct Region {
+        char* base;
+        size_t length;
+    };
+
+    int fd = -1;
+    std::vector<Region> regions; // back() is the current view
+    AccessPattern pattern = AccessPattern::Random;
+
+    void applyAdvice() {
+        if (regions.empty()) return;
+        int advice = pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM;
+        ::madvise(regions.back().base, regions.back().length, advice);
+    }
+
+public:
+    static constexpr size_t MIN_MAPPING = 64u << 20;
+
+    explicit PageMapping(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) std::cerr << "PageMapping: cannot open " << path << ": " << std::strerror(errno) << std::endl;
+    }
+
+    ~PageMapping() {
+        for (const auto& r : regions) ::munmap(r.base, r.length);
+        if (fd >= 0) ::close(fd);
+    }
+
+    PageMapping(const PageMapping&) = delete;
+    PageMapping& operator=(const PageMapping&) = delete;
+
+    bool valid() const { return fd >= 0; }
+
+    size_t mappedPages() const { return regions.empty() ? 0 : regions.back().length / PAGE_SIZE; }
+
+    // Makes sure page `id` lies inside the current view. The caller must
+    // only dereference pages that exist in the file (SIGBUS otherwise).
+    bool ensureMapped(uint32_t id) {
+        if (id < mappedPages()) return true;
+        size_t needed = ((size_t)id + 1) * PAGE_SIZE;
+        size_t length = std::max(MIN_MAPPING, regions.empty() ? needed : regions.back().length * 2);
+        while (length < needed) length *= 2;
+        void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        regions.push_back({(char*)p, length});
+        applyAdvice();
+        return true;
+    }
+
+    const char* page(uint32_t id) const { return regions.back().base + (size_t)id * PAGE_SIZE; }
+
+    void setPattern(AccessPattern p) {
+        if (p == pattern) return;
+        pattern = p;
+        applyAdvice();
+    }
+
+    void willNeed(uint32_t id) {
+        if (id < mappedPages()) ::madvise((void*)page(id), PAGE_SIZE, MADV_WILLNEED);
+    }
+};
+
+inline std::unique_ptr<PageIO> makePageIO(IoBackend backend, const std::string& path, bool direct_io = false) {
+    int flags = direct_io ? O_DIRECT : 0;
+    switch (backend) {
+    case IoBackend::FStream:
+        if (direct_io) std::cerr << "PageIO: the fstream backend cannot bypass the page cache" << std::endl;
+        return std::make_unique<FStreamPageIO>(path);
+    case IoBackend::IoUring:
+#ifdef FLINTKV_HAVE_IO_URING
+        return std::make_unique<IoUringPageIO>(path, 64, flags);
+#else
+        std::cerr << "PageIO: built without io_uring support, using pread/pwrite" << std::endl;
+        return std::make_unique<PosixPageIO>(path, flags);
+#endif
+    case IoBackend::Pread:
+    default:
+        return std::make_unique<PosixPageIO>(path, flags);
+    }
+}
+
+#endif // PAGEIO_H
@@ -3,7 +3,87 @@
 
 #include "BPlusTree.h"
 #include <functional>
-#include <algorithm>
+#include <memory>
+
+struct Row {
+    std::string key;
+    std::string value;
+};
+
+// Pull-based operator: every next() produces one row and pulls from its
+// input only as far as that takes, so a satisfied limit stops the scan.
+class Operator {
+public:
+    virtual ~Operator() = default;
+    // Fills `row` and returns true, or returns false once exhausted.
+    virtual bool next(Row& row) = 0;
+};
+
+// Reads [start, end] from the leaves in either direction. The cursor keeps
+// the current leaf S-latched while the pipeline is alive.
+class ScanOperator : public Operator {
+    BPlusTree::Cursor cursor;
+    std::string start_key;
+    std::string end_key;
+    bool descending;
+    bool started = false;
+
+public:
+    ScanOperator(BPlusTree& db, std::string start, std::string end, bool desc)
+        : cursor(db.cursor()), start_key(std::move(start)), end_key(std::move(end)), descending(desc) {}
+
+    bool next(Row& row) override {
+        if (!started) {
+            started = true;
+            if (descending) cursor.seekForPrev(end_key);
+            else cursor.seek(start_key);
+        } else if (descending) {
+            cursor.prev();
+        } else {
+            cursor.next();
+        }
+        if (!cursor.valid()) return false;
+        if (descending ? cursor.key() < start_key : cursor.key() > end_key) {
+            cursor.close();
+            return false;
+        }
+        row.key.assign(cursor.key());
+        row.value.assign(cursor.value());
+        return true;
+    }
+};
+
+class FilterOperator : public Operator {
+    std::unique_ptr<Operator> input;
+    std::vector<std::function<bool(const std::string&, const std::string&)>> predicates;
+
+public:
+    FilterOperator(std::unique_ptr<Operator> in, std::vector<std::function<bool(const std::string&, const std::string&)>> preds)
+        : input(std::move(in)), predicates(std::move(preds)) {}
+
+    bool next(Row& row) override {
+        while (input->next(row)) {
+            bool match = true;
+            for (auto& p : predicates) if (!p(row.key, row.value)) { match = false; break; }
+            if (match) return true;
+        }
+        return false;
+    }
+};
+
+class LimitOperator : public Operator {
+    std::unique_ptr<Operator> input;
+    int remaining;
+
+public:
+    LimitOperator(std::unique_ptr<Operator> in, int n) : input(std::move(in)), remaining(n) {}
+
+    bool next(Row& row) override {
+        if (remaining <= 0 || !input->next(row)) return false;
+        remaining--;
+        return true;
+    }
+};
 
 class QueryBuilder {
 private:
@@ -28,44 +108,34 @@ public:
         return *this;
     }
 
-    // New: Limit the number of results
+    // Stops the scan after `n` matching rows
     QueryBuilder& limit(int n) {
         limit_val = n;
         return *this;
     }
 
-    // New: Reverse the order
+    // Scans the range backwards
     QueryBuilder& desc() {
         sort_descending = true;
         return *this;
     }
 
-    std::vector<std::pair<std::string, std::string>> execute() {
-        auto results = db.rangeScan(start_key, end_key);
-        
-        // 1. Filter
-        if (!filters.empty()) {
-            std::vector<std::pair<std::string, std::string>> filtered;
-            for (const auto& pair : results) {
-                bool match = true;
-                for (auto& f : filters) if (!f(pair.first, pair.second)) { match = false; break; }
-                if (match) filtered.push_back(pair);
-            }
-            results = std::move(filtered);
-        }
-
-        // 2. Sort (B+ Tree is already sorted ASC, so we only handle DESC)
-        if (sort_descending) {
-            std::reverse(results.begin(), results.end());
-        }
-
-        // 3. Limit
-        if (limit_val >= 0 && limit_val < (int)results.size()) {
-            results.resize(limit_val);
-        }
+    // Scan -> filter -> limit. Rows are pulled one at a time; predicates run
+    // while the scanned leaf is latched, so they must not write to the tree.
+    std::unique_ptr<Operator> plan() {
+        std::unique_ptr<Operator> op = std::make_unique<ScanOperator>(db, start_key, end_key, sort_descending);
+        if (!filters.empty()) op = std::make_unique<FilterOperator>(std::move(op), filters);
+        if (limit_val >= 0) op = std::make_unique<LimitOperator>(std::move(op), limit_val);
+        return op;
+    }
 
+    std::vector<std::pair<std::string, std::string>> execute() {
+        std::vector<std::pair<std::string, std::string>> results;
+        std::unique_ptr<Operator> op = plan();
+        Row row;
+        while (op->next(row)) results.emplace_back(row.key, row.value);
         return results;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,138 @@
+#ifndef REPLACER_H
+#define REPLACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <vector>
+
+// Replacement policy used by the BufferPool to pick a victim frame.
+// Frames are identified by their index in the pool; only frames that were
+// marked evictable (pin count dropped to zero) may be returned by evict().
+// evict() only takes the victim out of the evictable set; the pool calls
+// remove() once it actually reuses the frame, so a victim it decides to
+// keep (see BufferPool::acquireFrame) retains its history.
+class Replacer {
+public:
+    virtual ~Replacer() = default;
+
+    virtual void recordAccess(size_t frame_id) = 0;
+    virtual void setEvictable(size_t frame_id, bool evictable) = 0;
+    virtual bool evict(size_t& frame_id) = 0;
+    virtual void remove(size_t frame_id) = 0;
+    virtual size_t size() const = 0;
+};
+
+// Second-chance CLOCK: every access sets a reference bit, the hand clears
+// bits as it sweeps and evicts the first evictable frame without one.
+class ClockReplacer : public Replacer {
+    std::vector<bool> ref_bit;
+    std::vector<bool> evictable;
+    size_t hand = 0;
+    size_t evictable_count = 0;
+
+public:
+    explicit ClockReplacer(size_t num_frames)
+        : ref_bit(num_frames, false), evictable(num_frames, false) {}
+
+    void recordAccess(size_t frame_id) override { ref_bit[frame_id] = true; }
+
+    void setEvictable(size_t frame_id, bool value) override {
+        if (evictable[frame_id] == value) return;
+        evictable[frame_id] = value;
+        if (value) evictable_count++;
+        else evictable_count--;
+    }
+
+    bool evict(size_t& frame_id) override {
+        if (evictable_count == 0) return false;
+        // Two full sweeps are enough: the first clears every reference bit.
+        for (size_t step = 0; step < 2 * ref_bit.size(); ++step) {
+            size_t f = hand;
+            hand = (hand + 1) % ref_bit.size();
+            if (!evictable[f]) continue;
+            if (ref_bit[f]) {
+                ref_bit[f] = false;
+                continue;
+            }
+            evictable[f] = false;
+            evictable_count--;
+            frame_id = f;
+            return true;
+        }
+        return false;
+    }
+
+    void remove(size_t frame_id) override {
+        setEvictable(frame_id, false);
+        ref_bit[frame_id] = false;
+    }
+
+    size_t size() const override { return evictable_count; }
+};
+
+// LRU-K: evicts the frame whose K-th most recent access is the oldest.
+// Frames with fewer than K recorded accesses have an infinite backward
+// distance and are preferred, oldest first access first.
+class LRUKReplacer : public Replacer {
+    size_t k;
+    uint64_t clock = 0;
+    std::vector<std::deque<uint64_t>> history;
+    std::vector<bool> evictable;
+    size_t evictable_count = 0;
+
+public:
+    LRUKReplacer(size_t num_frames, size_t k_value = 2)
+        : k(k_value == 0 ? 1 : k_value), history(num_frames), evictable(num_frames, false) {}
+
+    void recordAccess(size_t frame_id) override {
+        auto& h = history[frame_id];
+        h.push_back(++clock);
+        if (h.size() > k) h.pop_front();
+    }
+
+    void setEvictable(size_t frame_id, bool value) override {
+        if (evictable[frame_id] == value) return;
+        evictable[frame_id] = value;
+        if (value) evictable_count++;
+        else evictable_count--;
+    }
+
+    bool evict(size_t& frame_id) override {
+        if (evictable_count == 0) return false;
+
+        bool found = false;
+        bool best_infinite = false;
+        uint64_t best_ts = std::numeric_limits<uint64_t>::max();
+
+        for (size_t f = 0; f < history.size(); ++f) {
+            if (!evictable[f]) continue;
+            const auto& h = history[f];
+            bool infinite = h.size() < k;
+            uint64_t ts = h.empty() ? 0 : h.front();
+
+            bool better = !found
+                || (infinite && !best_infinite)
+                || (infinite == best_infinite && ts < best_ts);
+            if (better) {
+                found = true;
+                best_infinite = infinite;
+                best_ts = ts;
+                frame_id = f;
+            }
+        }
+        if (!found) return false;
+        setEvictable(frame_id, false);
+        return true;
+    }
+
+    void remove(size_t frame_id) override {
+        setEvictable(frame_id, false);
+        history[frame_id].clear();
+    }
+
+    size_t size() const override { return evictable_count; }
+};
+
+#endif // REPLACER_H
@@ -0,0 +1,522 @@
+#ifndef SSTABLE_H
+#define SSTABLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "InternalKey.h"
+
+// Sorted string tables: immutable files of records in internal key order
+// (see InternalKey.h), written when a memtable is flushed. A key may have
+// several records, newest first.
+//
+//   [data block]...[filter][index][min key][max key][SSTableFooter]
+//
+// Data blocks hold about block_size bytes of records:
+//
+//   entry:  [shared u16][unshared u16][value length u32][key suffix][tag u64][value]
+//   tail:   [restart offset u32]...[restart count u32]
+//
+// An entry stores only the part of its key after the bytes it shares with
+// the previous key. Every restart_interval-th entry is a restart point: it
+// stores its whole key and its offset goes in the restart array, so a
+// block is binary-searched over its restarts and scanned from the closest
+// one. The tag is the record's sequence number and type (packTag).
+//
+// The index has one entry per data block, [key length u16][last key of the
+// block][its tag u64][offset u64][size u32], and is kept in memory with the
+// filter (a bloom filter over every user key: [probes u8][bits]) and the
+// min/max user keys. A point lookup that passes the key range and the
+// filter reads one data block, more only if the versions of the key
+// straddle a block boundary.
+
+struct SSTableOptions {
+    size_t block_size = 4096; // 4-16 KB
+    int restart_interval = 16;
+    int bloom_bits_per_key = 10; // ~1% false positives
+};
+
+#pragma pack(push, 1)
+struct SSTableEntryHeader {
+    uint16_t shared;
+    uint16_t unshared;
+    uint32_t value_len;
+};
+
+struct SSTableFooter {
+    uint64_t filter_offset;
+    uint32_t filter_size;
+    uint64_t index_offset;
+    uint32_t index_size;
+    uint32_t min_key_size; // the keys follow the index
+    uint32_t max_key_size;
+    uint64_t entries;
+    uint64_t magic;
+};
+#pragma pack(pop)
+
+const uint64_t SSTABLE_MAGIC = 0x3342545354544C46ull; // "FLTTSTB3"
+
+// Both probe hashes come from one 64-bit FNV-1a pass (double hashing).
+inline uint64_t bloomHash(std::string_view key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : key) {
+        h ^= (uint8_t)c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+class SSTableWriter {
+    int fd = -1;
+    SSTableOptions options;
+    std::string buffer;       // written but not yet handed to the file
+    std::string block;        // data block being built
+    std::vector<uint32_t> restarts;
+    int since_restart = 0;
+    std::string last_key;
+    uint64_t last_tag = 0;
+    std::string index;
+    std::vector<uint64_t> hashes;
+    std::string smallest_key;
+    uint64_t file_bytes = 0;
+    uint64_t entries = 0;
+    bool failed = false;
+
+    void drain() {
+        size_t done = 0;
+        while (!failed && done < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n <= 0) {
+                std::cerr << "SSTable: write failed" << std::endl;
+                failed = true;
+            } else {
+                done += n;
+            }
+        }
+        buffer.clear();
+    }
+
+    void emit(const std::string& bytes) {
+        buffer += bytes;
+        file_bytes += bytes.size();
+        if (buffer.size() >= (1 << 16)) drain();
+    }
+
+    void finishBlock() {
+        if (block.empty()) return;
+        for (uint32_t r : restarts) block.append((const char*)&r, sizeof(r));
+        uint32_t count = (uint32_t)restarts.size();
+        block.append((const char*)&count, sizeof(count));
+
+        uint16_t k_len = (uint16_t)last_key.size();
+        uint64_t offset = file_bytes;
+        uint32_t size = (uint32_t)block.size();
+        index.append((const char*)&k_len, sizeof(k_len));
+        index.append(last_key);
+        index.append((const char*)&last_tag, sizeof(last_tag));
+        index.append((const char*)&offset, sizeof(offset));
+        index.append((const char*)&size, sizeof(size));
+
+        emit(block);
+        block.clear();
+        restarts.clear();
+        since_restart = 0;
+    }
+
+    std::string buildFilter() const {
+        size_t bits = std::max<size_t>(64, hashes.size() * options.bloom_bits_per_key);
+        bits = (bits + 7) / 8 * 8;
+        // k = bits per key * ln 2 minimizes the false positive rate.
+        uint8_t probes = (uint8_t)std::clamp((int)(options.bloom_bits_per_key * 0.69), 1, 30);
+        std::string filter(1 + bits / 8, '\0');
+        filter[0] = (char)probes;
+        for (uint64_t h : hashes) {
+            uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+            for (uint8_t i = 0; i < probes; ++i) {
+                size_t bit = (h1 + (uint64_t)i * h2) % bits;
+                filter[1 + bit / 8] |= (char)(1 << (bit % 8));
+            }
+        }
+        return filter;
+    }
+
+public:
+    explicit SSTableWriter(const std::string& path, const SSTableOptions& opts = SSTableOptions())
+        : options(opts) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "SSTable: cannot create " << path << std::endl;
+            failed = true;
+        }
+    }
+
+    ~SSTableWriter() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    SSTableWriter(const SSTableWriter&) = delete;
+    SSTableWriter& operator=(const SSTableWriter&) = delete;
+
+    // Records must arrive in internal key order: by key, then by
+    // decreasing sequence number. A key over 64 KB or a value over 4 GB
+    // cannot be stored; the record is refused and the table fails.
+    bool add(std::string_view key, uint64_t seq, ValueType type, std::string_view value) {
+        if (key.size() > UINT16_MAX || value.size() > UINT32_MAX) {
+            std::cerr << "SSTable: record too large (key " << key.size() << ", value " << value.size() << " bytes)"
+                      << std::endl;
+            failed = true;
+            return false;
+        }
+        size_t shared = 0;
+        if (since_restart == options.restart_interval || block.empty()) {
+            restarts.push_back((uint32_t)block.size());
+            since_restart = 0;
+        } else {
+            size_t limit = std::min(last_key.size(), key.size());
+            while (shared < limit && last_key[shared] == key[shared]) shared++;
+        }
+        SSTableEntryHeader header{(uint16_t)shared, (uint16_t)(key.size() - shared), (uint32_t)value.size()};
+        block.append((const char*)&header, sizeof(header));
+        block.append(key.data() + shared, key.size() - shared);
+        uint64_t tag = packTag(seq, type);
+        block.append((const char*)&tag, sizeof(tag));
+        block.append(value.data(), value.size());
+        since_restart++;
+
+        if (entries == 0 || key != last_key) hashes.push_back(bloomHash(key));
+        if (entries++ == 0) smallest_key.assign(key);
+        last_key.assign(key);
+        last_tag = tag;
+        if (block.size() >= options.block_size) finishBlock();
+        return true;
+    }
+
+    // Writes the last block and the metadata, then syncs the file.
+    bool finish() {
+        finishBlock();
+        SSTableFooter footer{};
+        std::string filter = buildFilter();
+        footer.filter_offset = file_bytes;
+        footer.filter_size = (uint32_t)filter.size();
+        emit(filter);
+        footer.index_offset = file_bytes;
+        footer.index_size = (uint32_t)index.size();
+        emit(index);
+        footer.min_key_size = (uint32_t)smallest_key.size();
+        footer.max_key_size = (uint32_t)last_key.size();
+        emit(smallest_key);
+        emit(last_key);
+        footer.entries = entries;
+        footer.magic = SSTABLE_MAGIC;
+        emit(std::string((const char*)&footer, sizeof(footer)));
+
+        drain();
+        if (!failed && ::fsync(fd) != 0) {
+            std::cerr << "SSTable: fsync failed" << std::endl;
+            failed = true;
+        }
+        return !failed;
+    }
+
+    // Smallest and largest user keys so far.
+    const std::string& smallest() const { return smallest_key; }
+    const std::string& largest() const { return last_key; }
+    uint64_t fileSize() const { return file_bytes; }
+    uint64_t count() const { return entries; }
+};
+
+class SSTable {
+    struct IndexEntry {
+        std::string last_key;
+        uint64_t last_seq;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    int fd = -1;
+    uint64_t file_size = 0;
+    uint64_t entries = 0;
+    std::vector<IndexEntry> index;
+    std::string filter;
+    std::string min_key, max_key;
+    mutable std::atomic<uint64_t> block_reads{0};
+
+    SSTable() = default;
+
+    bool readAt(uint64_t offset, size_t size, std::string& out) const {
+        out.resize(size);
+        if (size > 0 && ::pread(fd, &out[0], size, (off_t)offset) != (ssize_t)size) {
+            std::cerr << "SSTable: read failed" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool load() {
+        SSTableFooter footer;
+        std::string tail;
+        if (file_size < sizeof(footer) || !readAt(file_size - sizeof(footer), sizeof(footer), tail)) return false;
+        std::memcpy(&footer, tail.data(), sizeof(footer));
+        // Filter, index and the keys are contiguous in front of the footer.
+        uint64_t meta_size = (uint64_t)footer.filter_size + footer.index_size + footer.min_key_size + footer.max_key_size;
+        if (footer.magic != SSTABLE_MAGIC || footer.filter_offset + meta_size + sizeof(footer) != file_size ||
+            footer.index_offset != footer.filter_offset + footer.filter_size) {
+            return false;
+        }
+        std::string meta;
+        if (!readAt(footer.filter_offset, meta_size, meta)) return false;
+
+        filter.assign(meta, 0, footer.filter_size);
+        size_t pos = footer.filter_size, index_end = pos + footer.index_size;
+        while (pos < index_end) {
+            IndexEntry e;
+            uint16_t k_len;
+            if (pos + sizeof(k_len) > index_end) return false;
+            std::memcpy(&k_len, meta.data() + pos, sizeof(k_len));
+            pos += sizeof(k_len);
+            uint64_t tag;
+            if (pos + k_len + sizeof(tag) + sizeof(e.offset) + sizeof(e.size) > index_end) return false;
+            e.last_key.assign(meta, pos, k_len);
+            std::memcpy(&tag, meta.data() + pos + k_len, sizeof(tag));
+            e.last_seq = tagSequence(tag);
+            pos += k_len + sizeof(tag);
+            std::memcpy(&e.offset, meta.data() + pos, sizeof(e.offset));
+            std::memcpy(&e.size, meta.data() + pos + sizeof(e.offset), sizeof(e.size));
+            pos += sizeof(e.offset) + sizeof(e.size);
+            index.push_back(std::move(e));
+        }
+        min_key.assign(meta, index_end, footer.min_key_size);
+        max_key.assign(meta, index_end + footer.min_key_size, footer.max_key_size);
+        entries = footer.entries;
+        return true;
+    }
+
+    // First block whose last record is at or after (key, seq), or
+    // index.size().
+    size_t findBlock(std::string_view key, uint64_t seq) const {
+        return std::lower_bound(index.begin(), index.end(), key,
+                                [seq](const IndexEntry& e, std::string_view k) {
+                                    return compareInternal(e.last_key, e.last_seq, k, seq) < 0;
+                                }) -
+               index.begin();
+    }
+
+    // Walks the entries of one data block.
+    class Block {
+        std::string data;
+        size_t entries_end = 0;
+        uint32_t num_restarts = 0;
+        size_t pos = 0;      // offset of the next entry
+        std::string cur_key;
+        uint64_t cur_tag = 0;
+        std::string_view cur_value;
+        bool is_valid = false;
+
+        uint32_t restart(uint32_t i) const {
+            uint32_t off;
+            std::memcpy(&off, data.data() + entries_end + i * sizeof(off), sizeof(off));
+            return off;
+        }
+
+        bool parse() {
+            SSTableEntryHeader h;
+            if (pos + sizeof(h) > entries_end) return is_valid = false;
+            std::memcpy(&h, data.data() + pos, sizeof(h));
+            size_t body = pos + sizeof(h);
+            size_t end = body + h.unshared + sizeof(cur_tag) + (size_t)h.value_len;
+            if (end > entries_end || h.shared > cur_key.size()) return is_valid = false;
+            cur_key.resize(h.shared);
+            cur_key.append(data.data() + body, h.unshared);
+            std::memcpy(&cur_tag, data.data() + body + h.unshared, sizeof(cur_tag));
+            cur_value = std::string_view(data.data() + body + h.unshared + sizeof(cur_tag), h.value_len);
+            pos = end;
+            return is_valid = true;
+        }
+
+        // Whether restart point i, which stores its whole key, sorts
+        // before (key, seq).
+        bool restartBefore(uint32_t i, std::string_view key, uint64_t seq) const {
+            SSTableEntryHeader h;
+            uint64_t tag;
+            const char* entry = data.data() + restart(i);
+            std::memcpy(&h, entry, sizeof(h));
+            std::memcpy(&tag, entry + sizeof(h) + h.unshared, sizeof(tag));
+            std::string_view k(entry + sizeof(h), h.unshared);
+            return compareInternal(k, tagSequence(tag), key, seq) < 0;
+        }
+
+    public:
+        bool reset(std::string bytes) {
+            data = std::move(bytes);
+            is_valid = false;
+            if (data.size() < sizeof(uint32_t)) return false;
+            std::memcpy(&num_restarts, data.data() + data.size() - sizeof(uint32_t), sizeof(uint32_t));
+            if ((uint64_t)(num_restarts + 1) * sizeof(uint32_t) > data.size() || num_restarts == 0) return false;
+            entries_end = data.size() - (num_restarts + 1) * sizeof(uint32_t);
+            return true;
+        }
+
+        void seekToFirst() {
+            pos = 0;
+            cur_key.clear();
+            parse();
+        }
+
+        // First record at or after (key, seq).
+        void seek(std::string_view key, uint64_t seq) {
+            uint32_t lo = 0, hi = num_restarts;
+            while (hi - lo > 1) { // last restart before (key, seq)
+                uint32_t mid = (lo + hi) / 2;
+                if (restartBefore(mid, key, seq)) lo = mid;
+                else hi = mid;
+            }
+            pos = restart(lo);
+            cur_key.clear();
+            while (parse() && compareInternal(cur_key, tagSequence(cur_tag), key, seq) < 0) {}
+        }
+
+        void next() { parse(); }
+        bool valid() const { return is_valid; }
+        const std::string& key() const { return cur_key; }
+        uint64_t tag() const { return cur_tag; }
+        std::string_view value() const { return cur_value; }
+    };
+
+    bool readBlock(size_t i, Block& block) const {
+        std::string bytes;
+        block_reads.fetch_add(1, std::memory_order_relaxed);
+        if (!readAt(index[i].offset, index[i].size, bytes)) return false;
+        if (!block.reset(std::move(bytes))) {
+            std::cerr << "SSTable: corrupt block" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    static std::shared_ptr<SSTable> open(const std::string& path) {
+        std::shared_ptr<SSTable> t(new SSTable());
+        t->fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (t->fd < 0 || ::fstat(t->fd, &st) != 0) {
+            std::cerr << "SSTable: cannot open " << path << std::endl;
+            return nullptr;
+        }
+        t->file_size = (uint64_t)st.st_size;
+        if (!t->load()) {
+            std::cerr << "SSTable: " << path << " is not a valid table" << std::endl;
+            return nullptr;
+        }
+        return t;
+    }
+
+    ~SSTable() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    SSTable(const SSTable&) = delete;
+    SSTable& operator=(const SSTable&) = delete;
+
+    uint64_t fileSize() const { return file_size; }
+    uint64_t count() const { return entries; }
+    const std::string& smallest() const { return min_key; }
+    const std::string& largest() const { return max_key; }
+    uint64_t blockReads() const { return block_reads.load(std::memory_order_relaxed); }
+
+    // False if the table certainly has no record of `key`.
+    bool mayContain(std::string_view key) const {
+        if (entries == 0 || key < min_key || key > max_key) return false;
+        size_t bits = (filter.size() - 1) * 8;
+        uint8_t probes = (uint8_t)filter[0];
+        uint64_t h = bloomHash(key);
+        uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+        for (uint8_t i = 0; i < probes; ++i) {
+            size_t bit = (h1 + (uint64_t)i * h2) % bits;
+            if (!(filter[1 + bit / 8] & (1 << (bit % 8)))) return false;
+        }
+        return true;
+    }
+
+    // Walks the table in internal key order, one data block in memory at a
+    // time. Several iterators may read one table concurrently.
+    class Iterator {
+        const SSTable* table;
+        size_t block_idx = 0;
+        Block block;
+        bool is_valid = false;
+
+        // Moves on to the first entry of the next block that has one.
+        void skipEmpty() {
+            while (!block.valid()) {
+                if (++block_idx >= table->index.size() || !table->readBlock(block_idx, block)) {
+                    is_valid = false;
+                    return;
+                }
+                block.seekToFirst();
+            }
+            is_valid = true;
+        }
+
+    public:
+        explicit Iterator(const SSTable& t) : table(&t) {}
+
+        void seekToFirst() {
+            block_idx = 0;
+            is_valid = false;
+            if (table->index.empty() || !table->readBlock(0, block)) return;
+            block.seekToFirst();
+            skipEmpty();
+        }
+
+        // First record at or after (key, seq): the newest record of `key`
+        // with a sequence number <= seq, or else the first record of a
+        // larger key.
+        void seek(std::string_view key, uint64_t seq = MAX_SEQUENCE) {
+            block_idx = table->findBlock(key, seq);
+            is_valid = false;
+            if (block_idx >= table->index.size() || !table->readBlock(block_idx, block)) return;
+            block.seek(key, seq);
+            skipEmpty();
+        }
+
+        bool valid() const { return is_valid; }
+
+        void next() {
+            if (!is_valid) return;
+            block.next();
+            skipEmpty();
+        }
+
+        // Valid until the next call to next() or seek().
+        std::string_view key() const { return block.key(); }
+        std::string_view value() const { return block.value(); }
+        uint64_t seq() const { return tagSequence(block.tag()); }
+        ValueType type() const { return tagType(block.tag()); }
+    };
+
+    // Returns whether the table has a record for `key` with a sequence
+    // number <= seq, and if so the newest one's type and value. Usually
+    // reads one data block, none if the key range or the filter rules the
+    // key out.
+    bool get(std::string_view key, uint64_t seq, ValueType& type, std::string& value) const {
+        if (!mayContain(key)) return false;
+        Iterator it(*this);
+        it.seek(key, seq);
+        if (!it.valid() || it.key() != key) return false;
+        type = it.type();
+        value.assign(it.value());
+        return true;
+    }
+};
+
+#endif // SSTABLE_H
@@ -4,31 +4,44 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cassert>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <string_view>
+#include "Arena.h"
 
 // Reserved marker for deletions in an LSM-style system
 const std::string TOMBSTONE = "<<TOMBSTONE_MARKER>>";
 
-class SkipNode {
-public:
-    std::string key;
-    std::string value;
-    std::vector<SkipNode*> next;
-
-    SkipNode(std::string k, std::string v, int level) 
-        : key(k), value(v), next(level + 1, nullptr) {}
+// Nodes live in the list's arena: the header, then a tower of `height`
+// next pointers, then the key and value bytes. An update points the node
+// at a new copy of the value, also in the arena.
+struct SkipNode {
+    uint32_t key_len;
+    uint32_t value_len;
+    const char* value_data;
+    int height;
+    SkipNode* next[1]; // `height` entries
+
+    std::string_view key() const { return std::string_view((const char*)(next + height), key_len); }
+    std::string_view value() const { return std::string_view(value_data, value_len); }
 };
 
 class SkipList {
 private:
+    static constexpr int MAX_HEIGHT = 64;
+
     int max_level;
     float probability;
     int current_level;
+    Arena arena;
     SkipNode* head;
     size_t element_count;
 
@@ -40,40 +53,56 @@ private:
         return lvl;
     }
 
+    SkipNode* newNode(std::string_view key, std::string_view value, int height) {
+        size_t tower = offsetof(SkipNode, next) + height * sizeof(SkipNode*);
+        char* mem = arena.allocate(tower + key.size() + value.size(), alignof(SkipNode));
+        SkipNode* node = (SkipNode*)mem;
+        node->key_len = (uint32_t)key.size();
+        node->value_len = (uint32_t)value.size();
+        node->height = height;
+        std::fill(node->next, node->next + height, nullptr);
+        std::memcpy(mem + tower, key.data(), key.size());
+        std::memcpy(mem + tower + key.size(), value.data(), value.size());
+        node->value_data = mem + tower + key.size();
+        return node;
+    }
+
+    // Last node with a key < `key` on every level, from the top down.
+    SkipNode* findLess(std::string_view key, SkipNode** update) const {
+        SkipNode* curr = head;
+        for (int i = current_level; i >= 0; i--) {
+            while (curr->next[i] != nullptr && curr->next[i]->key() < key) {
+                curr = curr->next[i];
+            }
+            if (update) update[i] = curr;
+        }
+        return curr;
+    }
+
 public:
     // Initializing with your preferred max_level of 24
     SkipList(int max_lvl = 24, float p = 0.5) 
         : max_level(max_lvl), probability(p), current_level(0), element_count(0) {
+        assert(max_level >= 1 && max_level <= MAX_HEIGHT);
         std::srand(std::time(0));
-        head = new SkipNode("", "", max_level);
-    }
-
-    ~SkipList() {
-        // Simple teardown (in production, use smart pointers or recursive delete)
-        SkipNode* curr = head->next[0];
-        while (curr) {
-            SkipNode* temp = curr;
-            curr = curr->next[0];
-            delete temp;
-        }
-        delete head;
+        head = newNode("", "", max_level);
     }
 
-    void put(std::string key, std::string value) {
-        std::vector<SkipNode*> update(max_level, nullptr);
-        SkipNode* curr = head;
+    // Nodes are released with the arena, not one by one.
+    ~SkipList() = default;
 
-        for (int i = current_level; i >= 0; i--) {
-            while (curr->next[i] != nullptr && curr->next[i]->key < key) {
-                curr = curr->next[i];
-            }
-            update[i] = curr;
-        }
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
 
-        curr = curr->next[0];
+    void put(std::string_view key, std::string_view value) {
+        SkipNode* update[MAX_HEIGHT];
+        SkipNode* curr = findLess(key, update)->next[0];
 
-        if (curr != nullptr && curr->key == key) {
-            curr->value = value;
+        if (curr != nullptr && curr->key() == key) {
+            char* copy = arena.allocate(value.size(), 1);
+            std::memcpy(copy, value.data(), value.size());
+            curr->value_data = copy;
+            curr->value_len = (uint32_t)value.size();
         } else {
             int rLevel = randomLevel();
             if (rLevel > current_level) {
@@ -83,49 +112,97 @@ public:
                 current_level = rLevel;
             }
 
-            SkipNode* newNode = new SkipNode(key, value, rLevel);
+            SkipNode* node = newNode(key, value, rLevel + 1);
             for (int i = 0; i <= rLevel; i++) {
-                newNode->next[i] = update[i]->next[i];
-                update[i]->next[i] = newNode;
+                node->next[i] = update[i]->next[i];
+                update[i]->next[i] = node;
             }
             element_count++;
         }
     }
 
-    void remove(std::string key) {
+    void remove(std::string_view key) {
         put(key, TOMBSTONE);
     }
 
-    std::string get(std::string key) {
-        SkipNode* curr = head;
-        for (int i = current_level; i >= 0; i--) {
-            while (curr->next[i] != nullptr && curr->next[i]->key < key) {
-                curr = curr->next[i];
-            }
-        }
-        curr = curr->next[0];
-        if (curr && curr->key == key) {
-            return (curr->value == TOMBSTONE) ? "Not Found" : curr->value;
+    std::string get(std::string_view key) const {
+        const SkipNode* curr = seek(key);
+        if (curr && curr->key() == key) {
+            return (curr->value() == TOMBSTONE) ? "Not Found" : std::string(curr->value());
         }
         return "Not Found";
     }
 
     void flush(const std::string& filename) {
         std::ofstream out(filename, std::ios::binary);
-        SkipNode* curr = head->next[0];
+        const SkipNode* curr = first();
         while (curr) {
-            uint16_t kLen = curr->key.length();
-            uint16_t vLen = curr->value.length();
+            uint16_t kLen = curr->key_len;
+            uint16_t vLen = curr->value_len;
             out.write((char*)&kLen, sizeof(kLen));
-            out.write(curr->key.data(), kLen);
+            out.write(curr->key().data(), kLen);
             out.write((char*)&vLen, sizeof(vLen));
-            out.write(curr->value.data(), vLen);
+            out.write(curr->value().data(), vLen);
             curr = curr->next[0];
         }
         out.close();
     }
 
     size_t size() const { return element_count; }
+    // Bytes held by the arena: nodes, keys, values and the unused tail of
+    // the current block.
+    size_t memoryUsage() const { return arena.memoryUsage(); }
+
+    // First node with a key >= `key`, or nullptr. Walk on with next[0].
+    // Tombstones are returned like any other value.
+    const SkipNode* seek(std::string_view key) const { return findLess(key, nullptr)->next[0]; }
+
+    const SkipNode* first() const { return head->next[0]; }
+
+    // Streaming scan in key order that steps over tombstones. key() and
+    // value() view the list and stay valid until it is next written.
+    class Cursor {
+        const SkipList* list;
+        const SkipNode* node = nullptr;
+
+        void settle() {
+            while (node && node->value() == TOMBSTONE) node = node->next[0];
+        }
+
+    public:
+        explicit Cursor(const SkipList& l) : list(&l) {}
+
+        void seek(std::string_view key) {
+            node = list->seek(key);
+            settle();
+        }
+        bool valid() const { return node != nullptr; }
+        void next() {
+            node = node->next[0];
+            settle();
+        }
+        std::string_view key() const { return node->key(); }
+        std::string_view value() const { return node->value(); }
+    };
+
+    Cursor cursor() const { return Cursor(*this); }
+
+    // Sorted keys in (start, end] that cut the range into pieces of about
+    // equal size, for scanning it from several threads: the keys on the
+    // highest level whose towers reach at least parts - 1 of them in the
+    // range (fewer if the range is too small). Walks only that level and
+    // the ones above it.
+    std::vector<std::string> splitKeys(std::string_view start, std::string_view end, size_t parts) const {
+        std::vector<std::string> keys;
+        const SkipNode* curr = head;
+        for (int level = current_level; level >= 0; --level) {
+            while (curr->next[level] && curr->next[level]->key() <= start) curr = curr->next[level];
+            keys.clear();
+            for (const SkipNode* n = curr->next[level]; n && n->key() <= end; n = n->next[level]) keys.emplace_back(n->key());
+            if (keys.size() + 1 >= parts) break;
+        }
+        return keys;
+    }
 
     // Standalone Static Helper for Disk-to-Disk Streaming Compaction
     static void compactFiles(const std::string& fileOld, const std::string& fileNewer, const std::string& fileOut) {
@@ -175,20 +252,14 @@ public:
 
     std::vector<std::pair<std::string, std::string>> rangeScan(std::string start, std::string end) {
         std::vector<std::pair<std::string, std::string>> results;
-        SkipNode* curr = head;
 
         // 1. Drop down to the start position (standard Skip List search)
-        for (int i = current_level; i >= 0; i--) {
-            while (curr->next[i] != nullptr && curr->next[i]->key < start) {
-                curr = curr->next[i];
-            }
-        }
-        curr = curr->next[0]; // Move to the first actual node >= start
+        const SkipNode* curr = seek(start);
 
         // 2. Linear scan along Level 0 until we hit the end key
-        while (curr != nullptr && curr->key <= end) {
-            if (curr->value != TOMBSTONE) {
-                results.push_back({curr->key, curr->value});
+        while (curr != nullptr && curr->key() <= end) {
+            if (curr->value() != TOMBSTONE) {
+                results.emplace_back(curr->key(), curr->value());
             }
             curr = curr->next[0];
         }
@@ -197,15 +268,36 @@ public:
 };
 
 class FlintQuery {
+public:
+    // Pulls the next record into its argument, or returns false after the
+    // last one.
+    using Next = std::function<bool(std::pair<std::string, std::string>& record)>;
+    // Opens a pull over the records of [start, end] in key order.
+    using Scan = std::function<Next(const std::string& start, const std::string& end)>;
+
 private:
-    SkipList& db;
+    Scan scan;
     std::string start_key = "";
     std::string end_key = "\xff";
     int limit_val = -1;
     std::vector<std::function<bool(const std::string&, const std::string&)>> filters;
 
 public:
-    FlintQuery(SkipList& database) : db(database) {}
+    FlintQuery(SkipList& database)
+        : scan([&database](const std::string& start, const std::string& end) -> Next {
+              auto c = std::make_shared<SkipList::Cursor>(database.cursor());
+              c->seek(start);
+              return [c, end](std::pair<std::string, std::string>& record) {
+                  if (!c->valid() || c->key() > end) return false;
+                  record.first.assign(c->key());
+                  record.second.assign(c->value());
+                  c->next();
+                  return true;
+              };
+          }) {}
+
+    // Any other ordered source, e.g. LSMTree::query() at a snapshot.
+    explicit FlintQuery(Scan source) : scan(std::move(source)) {}
 
     FlintQuery& select(std::string start, std::string end) {
         start_key = start;
@@ -223,12 +315,14 @@ public:
         return *this;
     }
 
+    // Pulls records only until the limit is reached.
     std::vector<std::pair<std::string, std::string>> execute() {
-        auto raw = db.rangeScan(start_key, end_key);
+        auto next = scan(start_key, end_key);
         std::vector<std::pair<std::string, std::string>> final_results;
 
-        for (auto& pair : raw) {
-            if (limit_val >= 0 && (int)final_results.size() >= limit_val) break;
+        std::pair<std::string, std::string> pair;
+        while (limit_val < 0 || (int)final_results.size() < limit_val) {
+            if (!next(pair)) break;
 
             bool match = true;
             for (auto& f : filters) {
@@ -243,34 +337,4 @@ public:
     }
 };
 
-#include <map>
-
-// A simple structure to represent our joined "Row"
-struct JoinedResult {
-    std::string key;
-    std::string user_info;
-    std::string order_info;
-};
-
-std::vector<JoinedResult> joinDicts(SkipList& users, SkipList& orders, std::string start_id, std::string end_id) {
-    std::vector<JoinedResult> final_report;
-
-    // 1. Get a range of users
-    auto user_list = users.rangeScan(start_id, end_id);
-
-    // 2. For each user, "Probe" the orders dictionary
-    for (auto& user_pair : user_list) {
-        std::string order_data = orders.get(user_pair.first); // O(log n) lookup
-        
-        if (order_data != "Not Found") {
-            final_report.push_back({
-                user_pair.first, 
-                user_pair.second, 
-                order_data
-            });
-        }
-    }
-    return final_report;
-}
-
 #endif // SKIPLIST_H
\ No newline at end of file
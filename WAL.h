@@ -0,0 +1,294 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Write-ahead log of page-level redo records.
+//
+// File layout: a 16-byte header (magic, base LSN) followed by records.
+// An LSN is the logical byte position of a record in the log stream, so it
+// stays monotonic when the file is reset after a checkpoint: the new file
+// simply starts at a higher base LSN. A new file is written beside the
+// log and renamed over it, so the header is never missing after a crash.
+// A log that is missing altogether restarts at the LSN the caller names,
+// above every LSN already stamped on a data page.
+//
+// Record layout: LogRecordHeader followed by `length` payload bytes. The
+// CRC covers everything after the crc field, so a torn tail is detected
+// and ignored during recovery.
+
+enum class LogRecordType : uint8_t {
+    PageImage = 1,  // payload: full after-image of page_id
+    Commit = 2,     // no payload; makes the txn's images redoable
+    NewPage = 3,    // payload: image of a page in a run the txn wrote; freed again if it never commits
+    FreeRun = 4,    // payload: u32 page count; the run from page_id on is free once the txn commits
+};
+
+#pragma pack(push, 1)
+struct LogRecordHeader {
+    uint32_t crc;
+    uint32_t length;
+    uint64_t lsn;
+    uint64_t txn_id;
+    uint8_t type;
+    uint32_t page_id;
+};
+
+struct LogFileHeader {
+    uint64_t magic;
+    uint64_t base_lsn;
+};
+#pragma pack(pop)
+
+struct LogRecord {
+    uint64_t lsn;
+    uint64_t txn_id;
+    LogRecordType type;
+    uint32_t page_id;
+    std::string payload;
+};
+
+inline uint32_t crc32(const char* data, size_t len, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+class LogManager {
+    static constexpr uint64_t LOG_MAGIC = 0x4C41574B544E4C46ull; // "FLNTKWAL"
+
+    std::string path;
+    int fd = -1;
+    uint64_t base_lsn = 0;
+
+    std::mutex mu;
+    std::condition_variable flush_cv;    // wakes the group-commit thread
+    std::condition_variable durable_cv;  // wakes committers waiting on fsync
+    std::string buffer;                  // appended but not yet written
+    uint64_t next_lsn = 0;               // LSN of the next appended byte
+    uint64_t durable_lsn = 0;            // everything below is on stable storage
+    bool failed = false;                 // a write or sync failed; nothing more becomes durable
+    bool stopping = false;
+    std::thread flusher;
+
+    // Replaces the log with an empty one starting at base_lsn: the header
+    // goes to a temporary file that is synced and renamed over the log.
+    bool resetFile() {
+        std::string tmp = path + ".tmp";
+        int new_fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        LogFileHeader hdr{LOG_MAGIC, base_lsn};
+        bool ok = new_fd >= 0 && ::pwrite(new_fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+                  ::fdatasync(new_fd) == 0 && ::rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            std::cerr << "WAL: failed to reset " << path << std::endl;
+            if (new_fd >= 0) ::close(new_fd);
+            return false;
+        }
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dir_fd = ::open(dir.c_str(), O_RDONLY);
+        if (dir_fd >= 0) {
+            ::fsync(dir_fd);
+            ::close(dir_fd);
+        }
+        if (fd >= 0) ::close(fd);
+        fd = new_fd;
+        return true;
+    }
+
+    // Group commit: whatever accumulated while the previous fsync was in
+    // flight is written and synced as one batch.
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(mu);
+        while (true) {
+            flush_cv.wait(lock, [&] { return stopping || !buffer.empty(); });
+            if (buffer.empty() && stopping) return;
+
+            std::string batch;
+            batch.swap(buffer);
+            // After a failure nothing is written: records past the failed
+            // batch would follow a gap, and a failed fsync may have dropped
+            // pages it will not report again.
+            if (failed) continue;
+            uint64_t batch_end = next_lsn;
+            uint64_t file_off = sizeof(LogFileHeader) + (batch_end - batch.size() - base_lsn);
+            int out = fd;
+            lock.unlock();
+
+            bool ok = true;
+            size_t done = 0;
+            while (ok && done < batch.size()) {
+                ssize_t n = ::pwrite(out, batch.data() + done, batch.size() - done, file_off + done);
+                if (n <= 0) ok = false;
+                else done += n;
+            }
+            if (ok && ::fdatasync(out) != 0) ok = false;
+
+            lock.lock();
+            if (ok) {
+                durable_lsn = batch_end;
+            } else {
+                std::cerr << "WAL: write failed, the log no longer accepts commits" << std::endl;
+                failed = true;
+            }
+            durable_cv.notify_all();
+        }
+    }
+
+public:
+    // `restart_lsn` is asked for the base LSN when the log has no valid
+    // header (a new or lost log); it must lie above every LSN the data
+    // file has seen.
+    explicit LogManager(const std::string& log_path, const std::function<uint64_t()>& restart_lsn = {})
+        : path(log_path) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            std::cerr << "WAL: cannot open " << path << std::endl;
+            return;
+        }
+        LogFileHeader hdr{};
+        if (::pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && hdr.magic == LOG_MAGIC) {
+            base_lsn = hdr.base_lsn;
+        } else {
+            base_lsn = restart_lsn ? restart_lsn() : 0;
+            if (!resetFile()) failed = true;
+        }
+        // Appends start at the base until readAll() has located the valid tail.
+        next_lsn = durable_lsn = base_lsn;
+        flusher = std::thread(&LogManager::flushLoop, this);
+    }
+
+    ~LogManager() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        flush_cv.notify_one();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) ::close(fd);
+    }
+
+    LogManager(const LogManager&) = delete;
+    LogManager& operator=(const LogManager&) = delete;
+
+    static void encode(std::string& out, LogRecordType type, uint64_t lsn, uint64_t txn_id,
+                       uint32_t page_id, const char* payload, uint32_t len) {
+        LogRecordHeader h{0, len, lsn, txn_id, (uint8_t)type, page_id};
+        size_t start = out.size();
+        out.append((const char*)&h, sizeof(h));
+        if (len > 0) out.append(payload, len);
+        uint32_t crc = crc32(out.data() + start + sizeof(uint32_t), sizeof(h) - sizeof(uint32_t) + len);
+        std::memcpy(&out[start], &crc, sizeof(crc));
+    }
+
+    static size_t recordSize(uint32_t payload_len) { return sizeof(LogRecordHeader) + payload_len; }
+
+    // Appends a batch of records atomically. `fill(start_lsn, out)` encodes
+    // the records; the first one is assigned start_lsn. Returns the end LSN
+    // to wait on for durability.
+    template <typename Fill>
+    uint64_t append(Fill&& fill) {
+        std::lock_guard<std::mutex> lock(mu);
+        size_t before = buffer.size();
+        fill(next_lsn, buffer);
+        next_lsn += buffer.size() - before;
+        flush_cv.notify_one();
+        return next_lsn;
+    }
+
+    // False if the log failed before `lsn` became durable.
+    bool waitDurable(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (durable_lsn >= lsn) return true;
+        flush_cv.notify_one();
+        durable_cv.wait(lock, [&] { return durable_lsn >= lsn || failed; });
+        return durable_lsn >= lsn;
+    }
+
+    bool flush() {
+        uint64_t target;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            target = next_lsn;
+        }
+        return waitDurable(target);
+    }
+
+    bool hasFailed() {
+        std::lock_guard<std::mutex> lock(mu);
+        return failed;
+    }
+
+    uint64_t endLsn() {
+        std::lock_guard<std::mutex> lock(mu);
+        return next_lsn;
+    }
+
+    uint64_t sizeBytes() {
+        std::lock_guard<std::mutex> lock(mu);
+        return next_lsn - base_lsn;
+    }
+
+    // Reads every intact record, stopping at the first torn or corrupt one,
+    // and positions the append point right after the last intact record.
+    std::vector<LogRecord> readAll() {
+        std::vector<LogRecord> records;
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) return records;
+        size_t file_size = (size_t)st.st_size;
+        std::string data(file_size > sizeof(LogFileHeader) ? file_size - sizeof(LogFileHeader) : 0, '\0');
+        if (!data.empty() && ::pread(fd, &data[0], data.size(), sizeof(LogFileHeader)) != (ssize_t)data.size()) {
+            data.clear();
+        }
+
+        size_t pos = 0;
+        while (pos + sizeof(LogRecordHeader) <= data.size()) {
+            LogRecordHeader h;
+            std::memcpy(&h, data.data() + pos, sizeof(h));
+            if (pos + sizeof(h) + h.length > data.size()) break;
+            uint32_t crc = crc32(data.data() + pos + sizeof(uint32_t), sizeof(h) - sizeof(uint32_t) + h.length);
+            if (crc != h.crc || h.lsn != base_lsn + pos) break;
+            records.push_back({h.lsn, h.txn_id, (LogRecordType)h.type, h.page_id,
+                               std::string(data.data() + pos + sizeof(h), h.length)});
+            pos += sizeof(h) + h.length;
+        }
+
+        std::lock_guard<std::mutex> lock(mu);
+        next_lsn = durable_lsn = base_lsn + pos;
+        return records;
+    }
+
+    // Called after a checkpoint made every logged change durable in the
+    // data file: drops all records and restarts the file at the current LSN.
+    // A failed log is kept as it is.
+    void truncate() {
+        if (!flush()) return;
+        std::lock_guard<std::mutex> lock(mu);
+        uint64_t old_base = base_lsn;
+        base_lsn = next_lsn;
+        if (!resetFile()) base_lsn = old_base;
+    }
+};
+
+#endif // WAL_H
@@ -0,0 +1,92 @@
+#include "BPlusTree.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read scalability of the optimistic get path: each thread runs a 95/5
+// get/put mix against a resident tree for a fixed time.
+//
+// Usage: bench_concurrent_get [records] [max_threads] [millis]
+//
+// Gets take no latches on the hot upper levels, so throughput should grow
+// with the thread count up to the number of cores.
+
+static std::string makeKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "key%09d", i);
+    return buf;
+}
+
+int main(int argc, char** argv) {
+    int records = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int max_threads = argc > 2 ? std::atoi(argv[2]) : 32;
+    int millis = argc > 3 ? std::atoi(argv[3]) : 1000;
+    const std::string path = "bench_get.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+
+    PoolOptions options;
+    options.pool_size = 16384;
+    options.sync_commit = false;
+    BPlusTree db(path, options);
+
+    std::cout << "--- Loading " << records << " records ---" << std::endl;
+    for (int i = 0; i < records; ++i) db.put(makeKey(i), "value_" + std::to_string(i));
+    std::atomic<int> next_key{records};
+
+    std::cout << "--- 95% get / 5% put, " << millis << " ms per run, "
+              << std::thread::hardware_concurrency() << " hardware threads ---" << std::endl;
+    std::cout << std::left << std::setw(10) << "threads" << std::right
+              << std::setw(14) << "ops/s" << std::setw(14) << "gets/s"
+              << std::setw(12) << "speedup" << std::endl;
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::atomic<bool> stop{false};
+        std::vector<long> gets(threads, 0), puts(threads, 0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(t + 1);
+                std::uniform_int_distribution<int> pick(0, records - 1);
+                long g = 0, p = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    if (rng() % 100 < 5) {
+                        db.put(makeKey(next_key++), "new");
+                        p++;
+                    } else {
+                        if (!db.get(makeKey(pick(rng)))) std::abort();
+                        g++;
+                    }
+                }
+                gets[t] = g;
+                puts[t] = p;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+        stop = true;
+        for (auto& w : workers) w.join();
+
+        long total_gets = 0, total_ops = 0;
+        for (int t = 0; t < threads; ++t) {
+            total_gets += gets[t];
+            total_ops += gets[t] + puts[t];
+        }
+        double secs = millis / 1000.0;
+        if (threads == 1) base = total_ops / secs;
+        std::cout << std::left << std::setw(10) << threads << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(14) << total_ops / secs
+                  << std::setw(14) << total_gets / secs << std::setw(11) << std::setprecision(2)
+                  << (total_ops / secs) / base << "x" << std::endl;
+    }
+
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "BPlusTree.h"
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+// Compares buffered and O_DIRECT page I/O for random point lookups with a
+// buffer pool that holds only part of the tree.
+//
+// Usage: bench_direct_io [records] [lookups] [pool_pages]
+//
+// Raw throughput flatters buffered mode, because pool misses are served
+// from the kernel page cache, i.e. from a second copy of the data. The
+// benchmark therefore also reports the miss-service rate (lookups/s x
+// miss rate): how many pool misses per second each mode actually served.
+// With O_DIRECT every one of those is a device read; a buffered run with
+// the same pool hit rate needs the page cache on top of the pool's RAM.
+
+static std::string makeKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "key%09d", i);
+    return buf;
+}
+
+static void load(const std::string& path, int records) {
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    PoolOptions options;
+    options.pool_size = 4096;
+    options.sync_commit = false;
+    BPlusTree db(path, options);
+    for (int i = 0; i < records; ++i) db.put(makeKey(i), "value_" + std::to_string(i));
+    db.checkpoint();
+}
+
+static void runLookups(const std::string& path, const char* label, bool direct,
+                       int records, int lookups, size_t pool_pages) {
+    PoolOptions options;
+    options.pool_size = pool_pages;
+    options.direct_io = direct;
+    BPlusTree db(path, options);
+
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> pick(0, records - 1);
+    for (int i = 0; i < lookups / 10; ++i) db.get(makeKey(pick(rng))); // warm the pool
+    db.resetPoolStats();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int found = 0;
+    for (int i = 0; i < lookups; ++i) {
+        if (db.get(makeKey(pick(rng)))) found++;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+
+    PoolStats st = db.poolStats();
+    double ops = lookups / diff.count();
+    double miss_rate = 1.0 - st.hitRate();
+    std::cout << std::left << std::setw(10) << label
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(14) << ops
+              << std::setw(10) << std::setprecision(3) << st.hitRate()
+              << std::setw(16) << std::setprecision(0) << ops * miss_rate
+              << std::setw(10) << found << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int records = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 200000;
+    size_t pool_pages = argc > 3 ? std::atoi(argv[3]) : 256;
+    const std::string path = "bench_direct.bin";
+
+    std::cout << "--- Loading " << records << " records ---" << std::endl;
+    load(path, records);
+
+    std::cout << "--- " << lookups << " random gets, pool of " << pool_pages << " pages ---" << std::endl;
+    std::cout << std::left << std::setw(10) << "mode" << std::right
+              << std::setw(14) << "gets/s" << std::setw(10) << "hit rate"
+              << std::setw(16) << "misses/s" << std::setw(10) << "found" << std::endl;
+    runLookups(path, "buffered", false, records, lookups, pool_pages);
+    runLookups(path, "direct", true, records, lookups, pool_pages);
+
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "Join.h"
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// users x orders on the user id, the nightly report's join. "probe" is
+// the previous joinDicts, kept here for comparison: a materialized
+// rangeScan of users, then one point lookup (and a copied value) per
+// user. "merge" walks both inputs once with mergeJoin, "parallel" splits
+// the key range across threads with parallelMergeJoin, and "hash" builds
+// on users and probes orders. Both sources are SkipLists, then
+// BPlusTrees.
+//
+// Usage: bench_join [users] [threads]
+
+static std::string userKey(uint64_t i) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "user%010llu", (unsigned long long)i);
+    return buf;
+}
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --- previous implementation ---
+
+static std::vector<JoinedResult> probeJoin(SkipList& users, SkipList& orders, const std::string& start, const std::string& end) {
+    std::vector<JoinedResult> report;
+    for (auto& user : users.rangeScan(start, end)) {
+        std::string order = orders.get(user.first);
+        if (order != "Not Found") report.push_back({user.first, user.second, order});
+    }
+    return report;
+}
+
+static std::vector<JoinedResult> probeJoin(BPlusTree& users, BPlusTree& orders, const std::string& start, const std::string& end) {
+    std::vector<JoinedResult> report;
+    for (auto& user : users.rangeScan(start, end)) {
+        auto order = orders.get(user.first);
+        if (order) report.push_back({user.first, user.second, *order});
+    }
+    return report;
+}
+
+// --- benchmark ---
+
+template <typename Source>
+static void run(const char* label, Source& users, Source& orders, int threads) {
+    const std::string start = "", end = "\xff";
+    std::vector<std::pair<std::string, double>> rows;
+    size_t matches = 0;
+    auto time = [&](const char* name, auto join) {
+        double t0 = now();
+        size_t n = join();
+        rows.emplace_back(name, now() - t0);
+        if (matches && n != matches) std::abort();
+        matches = n;
+    };
+    time("probe", [&] { return probeJoin(users, orders, start, end).size(); });
+    time("merge", [&] { return joinDicts(users, orders, start, end).size(); });
+    time("parallel", [&] { return parallelMergeJoin(users, orders, start, end, threads).size(); });
+    time("hash", [&] {
+        HashJoin join;
+        join.build(users);
+        size_t n = 0;
+        join.probe(orders, start, end, rowKey, [&](const JoinRow&, const JoinRow&) { n++; });
+        return n;
+    });
+
+    std::cout << "--- " << label << ", " << matches << " matches ---" << std::endl;
+    for (auto& r : rows) {
+        std::cout << std::left << std::setw(12) << r.first << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << r.second * 1e3 << " ms" << std::setw(10) << std::setprecision(2)
+                  << rows[0].second / r.second << "x" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 500000;
+    int threads = argc > 2 ? std::atoi(argv[2]) : (int)std::max(2u, std::thread::hardware_concurrency());
+
+    // Every user, orders for about half of them.
+    std::mt19937_64 rng(3);
+    std::vector<std::pair<std::string, std::string>> users, orders;
+    for (uint64_t i = 0; i < n; ++i) {
+        users.emplace_back(userKey(i), "name" + std::to_string(i) + std::string(40, 'u'));
+        if (rng() % 2) orders.emplace_back(userKey(i), "order" + std::to_string(rng() % 100000) + std::string(60, 'o'));
+    }
+    std::cout << n << " users, " << orders.size() << " orders, " << threads << " threads" << std::endl;
+
+    {
+        SkipList u, o;
+        for (auto& kv : users) u.put(kv.first, kv.second);
+        for (auto& kv : orders) o.put(kv.first, kv.second);
+        run("SkipList", u, o, threads);
+    }
+    {
+        std::remove("bench_users.bin");
+        std::remove("bench_users.bin.wal");
+        std::remove("bench_orders.bin");
+        std::remove("bench_orders.bin.wal");
+        BPlusTree u("bench_users.bin"), o("bench_orders.bin");
+        u.multiPut(users);
+        o.multiPut(orders);
+        run("BPlusTree", u, o, threads);
+    }
+    std::remove("bench_users.bin");
+    std::remove("bench_users.bin.wal");
+    std::remove("bench_orders.bin");
+    std::remove("bench_orders.bin.wal");
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "LeafNode.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Per-operation cost of leaf splits and deletes. "before" is the previous
+// code, kept here for comparison: a split re-inserted the upper half one
+// record at a time (binary search + slot shift each) and then defragmented
+// the old leaf through a heap-allocated 4 KB buffer, and every delete ran
+// that same defragmentation. "after" is LeafNode: a split copies the slot
+// range over in one pass, a delete drops its slot and counts the hole, and
+// compaction waits until an insert finds the free gap too small.
+//
+// Usage: bench_leaf_ops [operations]
+
+using Slot = LeafNode::Slot;
+
+// --- previous implementation ---
+
+static int findSlot(const char* page, std::string_view key) {
+    const PageHeader* h = (const PageHeader*)page;
+    const Slot* slots = LeafNode::slots(page);
+    int low = 0, high = (int)h->num_slots - 1, result = (int)h->num_slots;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        int cmp = LeafNode::recordKey(page + slots[mid].offset).compare(key);
+        if (cmp == 0) return mid;
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            result = mid;
+            high = mid - 1;
+        }
+    }
+    return result;
+}
+
+static bool oldInsert(char* page, std::string_view key, std::string_view stored, bool overflow) {
+    PageHeader* h = (PageHeader*)page;
+    size_t size = LeafNode::recordSize(key.size(), stored.size());
+    if (h->free_space_offset < sizeof(PageHeader) + (h->num_slots + 1) * sizeof(Slot) + size) return false;
+    int idx = findSlot(page, key);
+    Slot* slots = LeafNode::slots(page);
+    std::memmove(&slots[idx + 1], &slots[idx], (h->num_slots - idx) * sizeof(Slot));
+    h->free_space_offset -= (uint32_t)size;
+    LeafNode::writeRecord(page + h->free_space_offset, key, stored, overflow);
+    slots[idx] = {(uint16_t)h->free_space_offset, (uint16_t)size};
+    h->num_slots++;
+    return true;
+}
+
+static void oldDefragment(char* page) {
+    PageHeader* h = (PageHeader*)page;
+    Slot* slots = LeafNode::slots(page);
+    std::vector<char> temp(PAGE_SIZE, 0);
+    uint32_t offset = PAGE_SIZE;
+    for (uint32_t i = 0; i < h->num_slots; ++i) {
+        uint32_t size = (uint32_t)LeafNode::recordSize(page + slots[i].offset);
+        offset -= size;
+        std::memcpy(temp.data() + offset, page + slots[i].offset, size);
+        slots[i] = {(uint16_t)offset, (uint16_t)size};
+    }
+    uint32_t data_start = sizeof(PageHeader) + h->num_slots * sizeof(Slot);
+    std::memset(page + data_start, 0, PAGE_SIZE - data_start);
+    std::memcpy(page + offset, temp.data() + offset, PAGE_SIZE - offset);
+    h->free_space_offset = offset;
+}
+
+static void oldSplit(char* page, char* right) {
+    PageHeader* h = (PageHeader*)page;
+    const Slot* slots = LeafNode::slots(page);
+    uint32_t mid = h->num_slots / 2;
+    for (uint32_t i = mid; i < h->num_slots; ++i) {
+        const char* rec = page + slots[i].offset;
+        oldInsert(right, LeafNode::recordKey(rec), LeafNode::storedValue(rec), LeafNode::isOverflow(rec));
+    }
+    h->num_slots = mid;
+    oldDefragment(page);
+}
+
+static void oldErase(char* page, int idx) {
+    PageHeader* h = (PageHeader*)page;
+    Slot* slots = LeafNode::slots(page);
+    std::memmove(&slots[idx], &slots[idx + 1], (h->num_slots - idx - 1) * sizeof(Slot));
+    h->num_slots--;
+    oldDefragment(page);
+}
+
+// --- workload ---
+
+static void emptyLeaf(char* page) {
+    std::memset(page, 0, PAGE_SIZE);
+    ((PageHeader*)page)->is_leaf = true;
+    ((PageHeader*)page)->free_space_offset = PAGE_SIZE;
+}
+
+struct Record {
+    std::string key, value;
+};
+
+// Records of 16-byte keys and 20..120-byte values, in random key order.
+static std::vector<Record> makeRecords(size_t n, std::mt19937& rng) {
+    std::vector<Record> out;
+    std::uniform_int_distribution<int> len(20, 120);
+    for (size_t i = 0; i < n; ++i) {
+        char key[32];
+        std::snprintf(key, sizeof(key), "user%012u", (unsigned)rng());
+        out.push_back({key, std::string(len(rng), 'v')});
+    }
+    return out;
+}
+
+// A leaf filled in random key order, as put() leaves it before a split.
+static std::vector<char> fullLeaf(std::mt19937& rng) {
+    std::vector<char> page(PAGE_SIZE);
+    emptyLeaf(page.data());
+    for (const auto& r : makeRecords(1000, rng)) {
+        if (!LeafNode::hasRoom(page.data(), LeafNode::recordSize(r.key.size(), r.value.size()))) break;
+        LeafNode::insert(page.data(), findSlot(page.data(), r.key), r.key, r.value, false);
+    }
+    return page;
+}
+
+template <typename F>
+static double nsPer(size_t ops, F body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (double)ops;
+}
+
+static void row(const char* label, double before, double after) {
+    std::cout << std::left << std::setw(26) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << before << std::setw(12) << after << std::setw(10) << before / after << "x"
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::mt19937 rng(7);
+    std::vector<char> full = fullLeaf(rng);
+    std::vector<char> work(PAGE_SIZE), right(PAGE_SIZE);
+    uint32_t records = ((PageHeader*)full.data())->num_slots;
+
+    // Both splits must produce the same halves.
+    {
+        std::vector<char> a = full, b = full, ra(PAGE_SIZE), rb(PAGE_SIZE);
+        emptyLeaf(ra.data());
+        emptyLeaf(rb.data());
+        oldSplit(a.data(), ra.data());
+        LeafNode::moveUpper(b.data(), ((PageHeader*)b.data())->num_slots / 2, rb.data());
+        for (int side = 0; side < 2; ++side) {
+            const char* x = side ? ra.data() : a.data();
+            const char* y = side ? rb.data() : b.data();
+            uint32_t n = ((const PageHeader*)x)->num_slots;
+            bool same = n == ((const PageHeader*)y)->num_slots;
+            for (uint32_t i = 0; same && i < n; ++i) {
+                same = LeafNode::recordKey(x + LeafNode::slots(x)[i].offset) ==
+                           LeafNode::recordKey(y + LeafNode::slots(y)[i].offset) &&
+                       LeafNode::storedValue(x + LeafNode::slots(x)[i].offset) ==
+                           LeafNode::storedValue(y + LeafNode::slots(y)[i].offset);
+            }
+            if (!same) {
+                std::cerr << "split results differ" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "--- ns per leaf operation (" << records << " records per full leaf) ---" << std::endl;
+    std::cout << std::left << std::setw(26) << "operation" << std::right << std::setw(12) << "before"
+              << std::setw(12) << "after" << std::setw(11) << "speedup" << std::endl;
+
+    // Split: copy in the full leaf, split it. The copy is the same in both.
+    size_t splits = std::max<size_t>(1, ops / 10);
+    double split_before = nsPer(splits, [&] {
+        for (size_t i = 0; i < splits; ++i) {
+            std::memcpy(work.data(), full.data(), PAGE_SIZE);
+            emptyLeaf(right.data());
+            oldSplit(work.data(), right.data());
+        }
+    });
+    double split_after = nsPer(splits, [&] {
+        for (size_t i = 0; i < splits; ++i) {
+            std::memcpy(work.data(), full.data(), PAGE_SIZE);
+            emptyLeaf(right.data());
+            LeafNode::moveUpper(work.data(), ((PageHeader*)work.data())->num_slots / 2, right.data());
+        }
+    });
+    row("split", split_before, split_after);
+
+    // Deletes: empty a full leaf in random order.
+    std::vector<std::vector<int>> orders;
+    for (int k = 0; k < 16; ++k) {
+        std::vector<int> order;
+        for (uint32_t n = records; n > 0; --n) order.push_back((int)(rng() % n));
+        orders.push_back(order);
+    }
+    size_t rounds = std::max<size_t>(1, ops / records);
+    double delete_before = nsPer(rounds * records, [&] {
+        for (size_t r = 0; r < rounds; ++r) {
+            std::memcpy(work.data(), full.data(), PAGE_SIZE);
+            for (int idx : orders[r % orders.size()]) oldErase(work.data(), idx);
+        }
+    });
+    double delete_after = nsPer(rounds * records, [&] {
+        for (size_t r = 0; r < rounds; ++r) {
+            std::memcpy(work.data(), full.data(), PAGE_SIZE);
+            for (int idx : orders[r % orders.size()]) LeafNode::erase(work.data(), idx);
+        }
+    });
+    row("delete", delete_before, delete_after);
+
+    // Churn on a full leaf: delete a record, insert a new one of another
+    // size. After the change the inserts pay for the occasional compaction.
+    std::vector<Record> fresh = makeRecords(4096, rng);
+    auto churn = [&](bool before) {
+        std::memcpy(work.data(), full.data(), PAGE_SIZE);
+        for (size_t i = 0; i < ops; ++i) {
+            uint32_t n = ((PageHeader*)work.data())->num_slots;
+            int idx = (int)(rng() % n);
+            if (before) oldErase(work.data(), idx);
+            else LeafNode::erase(work.data(), idx);
+            const Record& r = fresh[i % fresh.size()];
+            if (before) {
+                oldInsert(work.data(), r.key, r.value, false);
+            } else if (LeafNode::hasRoom(work.data(), LeafNode::recordSize(r.key.size(), r.value.size()))) {
+                LeafNode::insert(work.data(), findSlot(work.data(), r.key), r.key, r.value, false);
+            }
+        }
+    };
+    double churn_before = nsPer(ops, [&] { churn(true); });
+    double churn_after = nsPer(ops, [&] { churn(false); });
+    row("delete + insert", churn_before, churn_after);
+    return 0;
+}
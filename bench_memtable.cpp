@@ -0,0 +1,147 @@
+#include "SkipList.h"
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Memtable insert cost, memory accounting and teardown. "before" is the
+// previous SkipList, kept here for comparison: every node was a heap
+// object holding two std::strings and a std::vector tower, so an insert
+// made up to four allocations (plus a temporary update vector), the flush
+// threshold was an estimate of those, and freeing the list walked and
+// deleted every node. "after" is SkipList: one bump allocation per node,
+// memoryUsage() is exactly what the arena holds, and teardown releases the
+// arena's blocks.
+//
+// Usage: bench_memtable [inserts] [value bytes]
+
+// --- previous implementation ---
+
+struct OldNode {
+    std::string key;
+    std::string value;
+    std::vector<OldNode*> next;
+
+    OldNode(std::string k, std::string v, int level) : key(k), value(v), next(level + 1, nullptr) {}
+};
+
+class OldSkipList {
+    int max_level = 24;
+    int current_level = 0;
+    OldNode* head;
+    size_t memory_bytes = 0;
+
+    int randomLevel() {
+        int lvl = 0;
+        while ((float)std::rand() / RAND_MAX < 0.5f && lvl < max_level - 1) lvl++;
+        return lvl;
+    }
+
+public:
+    OldSkipList() { head = new OldNode("", "", max_level); }
+
+    ~OldSkipList() {
+        OldNode* curr = head->next[0];
+        while (curr) {
+            OldNode* temp = curr;
+            curr = curr->next[0];
+            delete temp;
+        }
+        delete head;
+    }
+
+    void put(std::string key, std::string value) {
+        std::vector<OldNode*> update(max_level, nullptr);
+        OldNode* curr = head;
+        for (int i = current_level; i >= 0; i--) {
+            while (curr->next[i] != nullptr && curr->next[i]->key < key) curr = curr->next[i];
+            update[i] = curr;
+        }
+        curr = curr->next[0];
+        if (curr != nullptr && curr->key == key) {
+            memory_bytes = memory_bytes - curr->value.size() + value.size();
+            curr->value = value;
+            return;
+        }
+        int rLevel = randomLevel();
+        if (rLevel > current_level) {
+            for (int i = current_level + 1; i <= rLevel; i++) update[i] = head;
+            current_level = rLevel;
+        }
+        memory_bytes += sizeof(OldNode) + key.size() + value.size() + (rLevel + 1) * sizeof(OldNode*);
+        OldNode* node = new OldNode(key, value, rLevel);
+        for (int i = 0; i <= rLevel; i++) {
+            node->next[i] = update[i]->next[i];
+            update[i]->next[i] = node;
+        }
+    }
+
+    size_t memoryUsage() const { return memory_bytes; }
+};
+
+// --- benchmark ---
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t heapInUse() { return mallinfo2().uordblks + mallinfo2().hblkhd; }
+
+struct Result {
+    double insert_ns, teardown_ms;
+    size_t reported, actual;
+};
+
+template <typename List>
+static Result run(const std::vector<std::string>& keys, const std::string& value) {
+    Result r;
+    size_t heap0 = heapInUse();
+    List* list = new List();
+    std::srand(1);
+    double t0 = now();
+    for (const std::string& k : keys) list->put(k, value);
+    double t1 = now();
+    r.reported = list->memoryUsage();
+    r.actual = heapInUse() - heap0;
+    delete list;
+    double t2 = now();
+    r.insert_ns = (t1 - t0) * 1e9 / keys.size();
+    r.teardown_ms = (t2 - t1) * 1e3;
+    return r;
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t value_bytes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+
+    std::mt19937_64 rng(7);
+    std::vector<std::string> keys(n);
+    char buf[32];
+    for (std::string& k : keys) {
+        std::snprintf(buf, sizeof(buf), "user%016llx", (unsigned long long)rng());
+        k = buf;
+    }
+    std::string value(value_bytes, 'v');
+
+    Result before = run<OldSkipList>(keys, value);
+    Result after = run<SkipList>(keys, value);
+
+    std::cout << "--- " << n << " random inserts, " << keys[0].size() << " B keys, " << value_bytes
+              << " B values ---" << std::endl;
+    std::cout << std::left << std::setw(26) << "" << std::right << std::setw(14) << "before" << std::setw(14)
+              << "after" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(26) << "ns per insert" << std::right << std::setw(14) << before.insert_ns
+              << std::setw(14) << after.insert_ns << std::endl;
+    std::cout << std::left << std::setw(26) << "teardown ms" << std::right << std::setw(14) << before.teardown_ms
+              << std::setw(14) << after.teardown_ms << std::endl;
+    std::cout << std::left << std::setw(26) << "memoryUsage() MB" << std::right << std::setw(14)
+              << before.reported / 1048576.0 << std::setw(14) << after.reported / 1048576.0 << std::endl;
+    std::cout << std::left << std::setw(26) << "heap in use MB" << std::right << std::setw(14)
+              << before.actual / 1048576.0 << std::setw(14) << after.actual / 1048576.0 << std::endl;
+    return 0;
+}
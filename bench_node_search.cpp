@@ -0,0 +1,125 @@
+#include "InternalNode.h"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Per-node search cost in an internal node: which child does a key route
+// to? Compares the original linear scan (one std::string per separator),
+// a plain binary search over the separators, and InternalNode::find (SIMD
+// pass over the 4-byte heads, full compares only on ties). All three must
+// agree on every probe.
+//
+// Usage: bench_node_search [searches]
+
+typedef std::string (*KeyGen)(int);
+
+static std::string numericKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "key%09d", i * 37);
+    return buf;
+}
+
+static std::string compositeKey(int i) {
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "tenant/%04d/user/%08d/ts/%012d", i / 5000, (i / 20) * 7919 % 100000000, i * 1013);
+    return buf;
+}
+
+// Fills one node with the separators a run of leaf splits would produce.
+static std::vector<char> buildNode(KeyGen gen, int& n) {
+    std::vector<InternalNode::Entry> entries;
+    for (int i = 1;; ++i) {
+        entries.push_back({InternalNode::shortestSeparator(gen(i * 50 - 1), gen(i * 50)), (uint32_t)i});
+        if (InternalNode::encodedSize(entries, 0, entries.size()) > InternalNode::capacity()) {
+            entries.pop_back();
+            break;
+        }
+    }
+    std::vector<char> node(PAGE_SIZE);
+    InternalNode::write(node.data(), 0, entries, 0, entries.size());
+    n = (int)entries.size();
+    return node;
+}
+
+static int linearFind(const char* node, const std::string& key) {
+    int i = InternalNode::size(node) - 1;
+    while (i >= 0 && key < InternalNode::separator(node, i)) --i;
+    return i;
+}
+
+static int binaryFind(const char* node, std::string_view key) {
+    std::string_view pre = InternalNode::prefix(node);
+    int c = key.compare(0, pre.size(), pre);
+    if (c < 0) return -1;
+    if (c > 0) return InternalNode::size(node) - 1;
+    std::string_view rest = key.substr(pre.size());
+    int lo = 0, hi = InternalNode::size(node);
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (InternalNode::suffix(node, mid) <= rest) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+template <typename F>
+static double nsPerSearch(const std::vector<std::string>& probes, int rounds, F find) {
+    long sink = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (const auto& k : probes) sink += find(k);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (sink == 42) std::cout << "";
+    return std::chrono::duration<double, std::nano>(end - start).count() / ((double)rounds * probes.size());
+}
+
+static void run(const char* label, KeyGen gen, int searches) {
+    int n = 0;
+    std::vector<char> node = buildNode(gen, n);
+    const char* data = node.data();
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, n * 50 + 100);
+    std::vector<std::string> probes;
+    for (int i = 0; i < 4096; ++i) probes.push_back(gen(pick(rng)));
+    for (int i = 0; i < n; i += 7) probes.push_back(InternalNode::separator(data, i));
+    for (const auto& k : probes) {
+        int expected = linearFind(data, k);
+        assert(binaryFind(data, k) == expected);
+        assert(InternalNode::find(data, k) == expected);
+        (void)expected;
+    }
+
+    int rounds = std::max(1, searches / (int)probes.size());
+    double linear = nsPerSearch(probes, rounds, [&](const std::string& k) { return linearFind(data, k); });
+    double binary = nsPerSearch(probes, rounds, [&](const std::string& k) { return binaryFind(data, k); });
+    double heads = nsPerSearch(probes, rounds, [&](const std::string& k) { return InternalNode::find(data, k); });
+
+    std::cout << std::left << std::setw(12) << label << std::right << std::setw(8) << n
+              << std::setw(8) << InternalNode::prefix(data).size() << std::fixed << std::setprecision(1)
+              << std::setw(14) << linear << std::setw(14) << binary << std::setw(14) << heads << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int searches = argc > 1 ? std::atoi(argv[1]) : 2000000;
+#if defined(__AVX2__)
+    const char* kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    std::cout << "--- ns per internal-node search, " << kernel << " head kernel ---" << std::endl;
+    std::cout << std::left << std::setw(12) << "keys" << std::right << std::setw(8) << "fanout"
+              << std::setw(8) << "prefix" << std::setw(14) << "linear" << std::setw(14) << "binary"
+              << std::setw(14) << "heads" << std::endl;
+    run("numeric", numericKey, searches);
+    run("composite", compositeKey, searches);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "ConcurrentSkipList.h"
+#include "SkipList.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Multi-threaded memtable throughput: each thread inserts fresh random
+// keys, and in the mixed run also reads keys already inserted, for a
+// fixed time. "locked" is SkipList behind one mutex, the way the LSM
+// memtable used to be guarded; "lock-free" is ConcurrentSkipList.
+//
+// Usage: bench_skip_list_mt [max_threads] [millis] [read percent]
+//
+// The lock-free list should scale with the thread count up to the number
+// of cores; the locked one stays flat or degrades.
+
+static std::string makeKey(uint64_t i) {
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), "key%016llx", (unsigned long long)i);
+    return buf;
+}
+
+struct Locked {
+    std::mutex mu;
+    SkipList list;
+
+    void put(const std::string& key, const std::string& value) {
+        std::lock_guard<std::mutex> lock(mu);
+        list.put(key, value);
+    }
+    bool get(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mu);
+        return list.get(key) != "Not Found";
+    }
+};
+
+struct LockFree {
+    ConcurrentSkipList list;
+    std::atomic<uint64_t> seq{0};
+
+    void put(const std::string& key, const std::string& value) {
+        list.add(key, seq.fetch_add(1, std::memory_order_relaxed) + 1, ValueType::Value, value);
+    }
+    bool get(const std::string& key) { return list.find(key) != nullptr; }
+};
+
+// Operations per second with `threads` threads.
+template <typename Memtable>
+static double run(int threads, int millis, int read_pct) {
+    Memtable table;
+    std::atomic<bool> stop{false};
+    std::vector<long> ops(threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            // Hashed counters: random order, and every thread can replay
+            // its own keys for reads.
+            uint64_t inserted = 0;
+            const std::string value(100, 'v');
+            long n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (inserted > 0 && (int)(rng() % 100) < read_pct) {
+                    uint64_t i = rng() % inserted;
+                    if (!table.get(makeKey((i * threads + t) * 0x9E3779B97F4A7C15ull))) std::abort();
+                } else {
+                    table.put(makeKey((inserted * threads + t) * 0x9E3779B97F4A7C15ull), value);
+                    inserted++;
+                }
+                n++;
+            }
+            ops[t] = n;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop = true;
+    for (auto& w : workers) w.join();
+    long total = 0;
+    for (long n : ops) total += n;
+    return total / (millis / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? std::atoi(argv[1]) : 16;
+    int millis = argc > 2 ? std::atoi(argv[2]) : 1000;
+    int read_pct = argc > 3 ? std::atoi(argv[3]) : 50;
+
+    for (int pct : {0, read_pct}) {
+        std::cout << "--- " << pct << "% get / " << 100 - pct << "% put, " << millis << " ms per run, "
+                  << std::thread::hardware_concurrency() << " hardware threads ---" << std::endl;
+        std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(14) << "locked"
+                  << std::setw(14) << "lock-free" << std::setw(11) << "ratio" << std::endl;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            double locked = run<Locked>(threads, millis, pct);
+            double lock_free = run<LockFree>(threads, millis, pct);
+            std::cout << std::left << std::setw(10) << threads << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(14) << locked << std::setw(14) << lock_free << std::setw(10)
+                      << std::setprecision(2) << lock_free / locked << "x" << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,487 @@
+#include "BPlusTree.h"
+#include "LSMTree.h"
+#include "SkipList.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The YCSB core workloads against every engine, reported as JSON:
+//
+//   A  50% read, 50% update                       zipfian
+//   B  95% read,  5% update                       zipfian
+//   C  100% read                                  zipfian
+//   D  95% read,  5% insert                       latest
+//   E  95% scan of 1-100 records, 5% insert       zipfian
+//   F  50% read, 50% read-modify-write            zipfian
+//
+// Each engine is loaded with `records` keys, then the workloads run in the
+// order given on the same data, at each thread count, as YCSB runs them
+// (the inserts of D and E grow it). Keys are "user" and the zero-padded
+// record number, so a scan covers consecutive records; zipfian picks are
+// scattered over the key space by hashing the rank, like YCSB's scrambled
+// zipfian. Every operation is timed. The JSON (stdout, or --output) has
+// the throughput and p50/p99/p999/max latency of each run, overall and
+// per operation type; progress goes to stderr.
+//
+// Usage: flintkv_bench [--engines=bplustree,skiplist,lsm] [--workloads=A,B,C,D,E,F]
+//                      [--records=100000] [--operations=100000] [--threads=1,4]
+//                      [--key-bytes=16] [--value-bytes=100] [--scan-length=100]
+//                      [--distribution=zipfian|uniform|latest] [--sync]
+//                      [--dir=flintkv_bench.data] [--output=results.json]
+//
+// --distribution overrides the workloads' own; --sync makes every
+// BPlusTree write wait for its WAL fsync.
+
+struct Config {
+    std::vector<std::string> engines{"bplustree", "skiplist", "lsm"};
+    std::string workloads = "ABCDEF";
+    uint64_t records = 100000;
+    uint64_t operations = 100000;
+    std::vector<int> threads{1, 4};
+    size_t key_bytes = 16;
+    size_t value_bytes = 100;
+    uint64_t scan_length = 100;
+    std::string distribution; // empty: each workload's own
+    bool sync = false;
+    std::string dir = "flintkv_bench.data";
+    std::string output;
+};
+
+// --- engines ---
+
+// What the workloads need from an engine. Another engine needs an adapter
+// and an entry in openEngine(). Every call may come from several threads.
+class Engine {
+public:
+    virtual ~Engine() = default;
+    virtual void put(const std::string& key, const std::string& value) = 0;
+    virtual bool get(const std::string& key, std::string& value) = 0;
+    // Records in [start, end].
+    virtual size_t scan(const std::string& start, const std::string& end) = 0;
+};
+
+class BPlusTreeEngine : public Engine {
+    BPlusTree db;
+
+    static PoolOptions poolOptions(const Config& config) {
+        PoolOptions options;
+        options.pool_size = 16384;
+        options.sync_commit = config.sync;
+        return options;
+    }
+
+public:
+    BPlusTreeEngine(const std::string& dir, const Config& config) : db(dir + "/db.bin", poolOptions(config)) {}
+
+    void put(const std::string& key, const std::string& value) override { db.put(key, value); }
+    bool get(const std::string& key, std::string& value) override {
+        auto v = db.get(key);
+        if (v) value = std::move(*v);
+        return v.has_value();
+    }
+    size_t scan(const std::string& start, const std::string& end) override { return db.rangeScan(start, end).size(); }
+};
+
+// SkipList is single-threaded, so it runs behind one mutex.
+class SkipListEngine : public Engine {
+    std::mutex mu;
+    SkipList list;
+
+public:
+    void put(const std::string& key, const std::string& value) override {
+        std::lock_guard<std::mutex> lock(mu);
+        list.put(key, value);
+    }
+    bool get(const std::string& key, std::string& value) override {
+        std::lock_guard<std::mutex> lock(mu);
+        value = list.get(key);
+        return value != "Not Found";
+    }
+    size_t scan(const std::string& start, const std::string& end) override {
+        std::lock_guard<std::mutex> lock(mu);
+        return list.rangeScan(start, end).size();
+    }
+};
+
+class LSMEngine : public Engine {
+    LSMTree db;
+
+public:
+    explicit LSMEngine(const std::string& dir) : db(dir + "/lsm") {}
+
+    void put(const std::string& key, const std::string& value) override { db.put(key, value); }
+    bool get(const std::string& key, std::string& value) override {
+        auto v = db.get(key);
+        if (v) value = std::move(*v);
+        return v.has_value();
+    }
+    size_t scan(const std::string& start, const std::string& end) override { return db.rangeScan(start, end).size(); }
+};
+
+static std::unique_ptr<Engine> openEngine(const std::string& name, const std::string& dir, const Config& config) {
+    if (name == "bplustree") return std::make_unique<BPlusTreeEngine>(dir, config);
+    if (name == "skiplist") return std::make_unique<SkipListEngine>();
+    if (name == "lsm") return std::make_unique<LSMEngine>(dir);
+    return nullptr;
+}
+
+// --- key choice ---
+
+// Zipfian ranks in [0, n), rank 0 the most popular, after Gray et al.,
+// "Quickly generating billion-record synthetic databases", with YCSB's
+// constant 0.99. Building it sums n terms.
+class Zipfian {
+    uint64_t n;
+    double theta, zetan, alpha, eta, half_pow;
+
+public:
+    explicit Zipfian(uint64_t items, double constant = 0.99) : n(std::max<uint64_t>(items, 2)), theta(constant) {
+        zetan = 0;
+        for (uint64_t i = 1; i <= n; ++i) zetan += 1 / std::pow((double)i, theta);
+        double zeta2 = 1 + 1 / std::pow(2.0, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        half_pow = 1 + std::pow(0.5, theta);
+    }
+
+    // `u` uniform in [0, 1).
+    uint64_t next(double u) const {
+        double uz = u * zetan;
+        if (uz < 1) return 0;
+        if (uz < half_pow) return 1;
+        return std::min(n - 1, (uint64_t)(n * std::pow(eta * u - eta + 1, alpha)));
+    }
+};
+
+static uint64_t fnv64(uint64_t x) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; ++i, x >>= 8) h = (h ^ (x & 0xff)) * 0x100000001b3ull;
+    return h;
+}
+
+// Record numbers: `count` are readable, `next` is the next to insert.
+struct KeySpace {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> next{0};
+    int digits = 10;
+
+    std::string key(uint64_t i) const {
+        char buf[264];
+        std::snprintf(buf, sizeof(buf), "user%0*llu", digits, (unsigned long long)i);
+        return buf;
+    }
+};
+
+enum class Distribution { Uniform, Zipfian, Latest };
+
+static const char* distributionName(Distribution d) {
+    return d == Distribution::Uniform ? "uniform" : d == Distribution::Zipfian ? "zipfian" : "latest";
+}
+
+// --- workloads ---
+
+enum Op { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE, OP_COUNT };
+static const char* const OP_NAMES[OP_COUNT] = {"read", "update", "insert", "scan", "read_modify_write"};
+
+struct Workload {
+    char name;
+    int read, update, insert, scan, rmw; // percentages
+    Distribution distribution;
+};
+
+static const Workload WORKLOADS[] = {
+    {'A', 50, 50, 0, 0, 0, Distribution::Zipfian}, {'B', 95, 5, 0, 0, 0, Distribution::Zipfian},
+    {'C', 100, 0, 0, 0, 0, Distribution::Zipfian}, {'D', 95, 0, 5, 0, 0, Distribution::Latest},
+    {'E', 0, 0, 5, 95, 0, Distribution::Zipfian},  {'F', 50, 0, 0, 0, 50, Distribution::Zipfian},
+};
+
+// Latencies of one run, in nanoseconds, per operation type.
+struct Samples {
+    std::vector<uint64_t> ns[OP_COUNT];
+    uint64_t not_found = 0;
+
+    void merge(Samples& other) {
+        for (int op = 0; op < OP_COUNT; ++op) ns[op].insert(ns[op].end(), other.ns[op].begin(), other.ns[op].end());
+        not_found += other.not_found;
+    }
+};
+
+struct RunResult {
+    std::string engine, workload, distribution;
+    int threads;
+    uint64_t operations;
+    double seconds;
+    Samples samples;
+};
+
+static std::string makeValue(std::mt19937_64& rng, size_t bytes) {
+    std::string v(bytes, ' ');
+    for (char& c : v) c = 'a' + rng() % 26;
+    return v;
+}
+
+static RunResult runWorkload(Engine& engine, KeySpace& keys, const Workload& w, Distribution dist,
+                             const Zipfian& zipf, int threads, const Config& config) {
+    RunResult r;
+    r.workload = std::string(1, w.name);
+    r.distribution = distributionName(dist);
+    r.threads = threads;
+    r.operations = config.operations;
+    std::vector<Samples> samples(threads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(w.name * 1000 + t);
+            std::uniform_real_distribution<double> unit(0, 1);
+            Samples& s = samples[t];
+            std::string value = makeValue(rng, config.value_bytes), read;
+            auto pick = [&]() -> uint64_t {
+                uint64_t count = std::max<uint64_t>(keys.count.load(std::memory_order_relaxed), 1);
+                switch (dist) {
+                case Distribution::Uniform: return rng() % count;
+                case Distribution::Zipfian: return fnv64(zipf.next(unit(rng))) % count;
+                default: return count - 1 - std::min(count - 1, zipf.next(unit(rng)));
+                }
+            };
+            uint64_t ops = config.operations / threads + ((uint64_t)t < config.operations % threads);
+            for (uint64_t i = 0; i < ops; ++i) {
+                int roll = rng() % 100;
+                Op op = READ_MODIFY_WRITE;
+                if (roll < w.read) op = READ;
+                else if (roll < w.read + w.update) op = UPDATE;
+                else if (roll < w.read + w.update + w.insert) op = INSERT;
+                else if (roll < w.read + w.update + w.insert + w.scan) op = SCAN;
+                value[rng() % value.size()] = 'a' + rng() % 26;
+                auto t0 = std::chrono::steady_clock::now();
+                switch (op) {
+                case READ:
+                    if (!engine.get(keys.key(pick()), read)) s.not_found++;
+                    break;
+                case UPDATE:
+                    engine.put(keys.key(pick()), value);
+                    break;
+                case INSERT:
+                    engine.put(keys.key(keys.next.fetch_add(1)), value);
+                    keys.count.fetch_add(1);
+                    break;
+                case SCAN: {
+                    uint64_t first = pick();
+                    engine.scan(keys.key(first), keys.key(first + rng() % config.scan_length));
+                    break;
+                }
+                default: {
+                    std::string key = keys.key(pick());
+                    if (!engine.get(key, read)) s.not_found++;
+                    engine.put(key, value);
+                }
+                }
+                auto t1 = std::chrono::steady_clock::now();
+                s.ns[op].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+            }
+        });
+    }
+    for (auto& th : workers) th.join();
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Inserts that finished out of order are all readable now.
+    keys.count = keys.next.load();
+    for (auto& s : samples) r.samples.merge(s);
+    return r;
+}
+
+static RunResult load(Engine& engine, KeySpace& keys, const Config& config) {
+    RunResult r;
+    r.workload = "load";
+    r.distribution = "shuffled";
+    r.threads = 1;
+    r.operations = config.records;
+    std::mt19937_64 rng(1);
+    std::string value = makeValue(rng, config.value_bytes);
+    // Shuffled, so that no engine gets a sorted bulk insert.
+    std::vector<uint64_t> order(config.records);
+    for (uint64_t i = 0; i < config.records; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i : order) {
+        value[rng() % value.size()] = 'a' + rng() % 26;
+        auto t0 = std::chrono::steady_clock::now();
+        engine.put(keys.key(i), value);
+        r.samples.ns[INSERT].push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    keys.count = keys.next = config.records;
+    return r;
+}
+
+// --- report ---
+
+static void writeLatency(std::ostream& out, std::vector<uint64_t>& ns) {
+    if (ns.empty()) {
+        out << "{\"count\": 0}";
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    auto at = [&](double p) { return ns[std::min(ns.size() - 1, (size_t)(p * ns.size()))] / 1e3; };
+    out << "{\"count\": " << ns.size() << ", \"p50\": " << at(0.5) << ", \"p99\": " << at(0.99)
+        << ", \"p999\": " << at(0.999) << ", \"max\": " << ns.back() / 1e3 << "}";
+}
+
+static void writeResult(std::ostream& out, RunResult& r) {
+    out << "    {\"engine\": \"" << r.engine << "\", \"workload\": \"" << r.workload << "\", \"distribution\": \""
+        << r.distribution << "\", \"threads\": " << r.threads << ", \"operations\": " << r.operations
+        << ", \"seconds\": " << r.seconds << ", \"throughput_ops_per_sec\": " << r.operations / r.seconds
+        << ", \"not_found\": " << r.samples.not_found << ",\n     \"latency_us\": {";
+    std::vector<uint64_t> all;
+    for (auto& ns : r.samples.ns) all.insert(all.end(), ns.begin(), ns.end());
+    out << "\"all\": ";
+    writeLatency(out, all);
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (r.samples.ns[op].empty()) continue;
+        out << ", \"" << OP_NAMES[op] << "\": ";
+        writeLatency(out, r.samples.ns[op]);
+    }
+    out << "}}";
+}
+
+static void writeReport(std::ostream& out, const Config& config, std::vector<RunResult>& results) {
+    out << std::fixed << std::setprecision(2);
+    out << "{\n  \"benchmark\": \"flintkv_bench\",\n  \"config\": {\"records\": " << config.records
+        << ", \"operations\": " << config.operations << ", \"key_bytes\": " << config.key_bytes
+        << ", \"value_bytes\": " << config.value_bytes << ", \"scan_length\": " << config.scan_length
+        << ", \"sync\": " << (config.sync ? "true" : "false") << ", \"hardware_threads\": "
+        << std::thread::hardware_concurrency() << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        writeResult(out, results[i]);
+        out << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+// --- command line ---
+
+static std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> parts;
+    std::stringstream in(s);
+    for (std::string part; std::getline(in, part, ',');) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+static bool parseArgs(int argc, char** argv, Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--engines") config.engines = split(value);
+        else if (name == "--workloads") {
+            config.workloads.clear();
+            for (auto& w : split(value)) config.workloads += (char)std::toupper(w[0]);
+        } else if (name == "--records") config.records = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--operations") config.operations = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "--threads") {
+            config.threads.clear();
+            for (auto& t : split(value)) config.threads.push_back(std::max(1, std::atoi(t.c_str())));
+        } else if (name == "--key-bytes") config.key_bytes = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "--value-bytes") config.value_bytes = std::strtoul(value.c_str(), nullptr, 10);
+        else if (name == "--scan-length") config.scan_length = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        else if (name == "--distribution") config.distribution = value;
+        else if (name == "--sync") config.sync = true;
+        else if (name == "--dir") config.dir = value;
+        else if (name == "--output") config.output = value;
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (config.distribution != "" && config.distribution != "zipfian" && config.distribution != "uniform" &&
+        config.distribution != "latest") {
+        std::cerr << "Unknown distribution " << config.distribution << std::endl;
+        return false;
+    }
+    if (config.records == 0 || config.operations == 0 || config.value_bytes == 0 || config.threads.empty()) {
+        std::cerr << "Need records, operations, a value size and a thread count" << std::endl;
+        return false;
+    }
+    if (config.key_bytes > 255) {
+        std::cerr << "Keys are at most 255 bytes (BPlusTree stores their length in one byte)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Config config;
+    if (!parseArgs(argc, argv, config)) return 1;
+
+    // Wide enough for every record number the run can reach.
+    KeySpace keys;
+    uint64_t max_records = config.records + config.operations * config.workloads.size() * config.threads.size();
+    int digits = (int)std::to_string(max_records).size();
+    keys.digits = std::max(digits, (int)config.key_bytes - 4);
+    config.key_bytes = 4 + keys.digits;
+
+    std::cerr << "Preparing zipfian over " << config.records << " records" << std::endl;
+    Zipfian zipf(config.records);
+    std::vector<RunResult> results;
+    for (const std::string& name : config.engines) {
+        std::filesystem::remove_all(config.dir);
+        std::filesystem::create_directories(config.dir);
+        std::unique_ptr<Engine> engine = openEngine(name, config.dir, config);
+        if (!engine) {
+            std::cerr << "Unknown engine " << name << std::endl;
+            return 1;
+        }
+        keys.count = keys.next = 0;
+        std::cerr << name << ": loading" << std::endl;
+        results.push_back(load(*engine, keys, config));
+        results.back().engine = name;
+        for (char w : config.workloads) {
+            const Workload* workload = nullptr;
+            for (const Workload& candidate : WORKLOADS) {
+                if (candidate.name == w) workload = &candidate;
+            }
+            if (!workload) {
+                std::cerr << "Unknown workload " << w << std::endl;
+                return 1;
+            }
+            Distribution dist = config.distribution == "uniform"   ? Distribution::Uniform
+                                : config.distribution == "zipfian" ? Distribution::Zipfian
+                                : config.distribution == "latest"  ? Distribution::Latest
+                                                                   : workload->distribution;
+            for (int threads : config.threads) {
+                std::cerr << name << ": workload " << w << ", " << threads << " threads" << std::endl;
+                results.push_back(runWorkload(*engine, keys, *workload, dist, zipf, threads, config));
+                results.back().engine = name;
+            }
+        }
+    }
+    std::filesystem::remove_all(config.dir);
+
+    if (config.output.empty()) {
+        writeReport(std::cout, config, results);
+    } else {
+        std::ofstream out(config.output);
+        writeReport(out, config, results);
+        std::cerr << "Wrote " << config.output << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,366 @@
+#include "BPlusTree.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Single-threaded checks of the B+ tree's page formats. bulkLoad: sorted
+// input packed to the fill factor, with values large enough for overflow
+// runs, must pass checkInvariants() and read back before and after a
+// reopen; unsorted or repeated input and a non-empty tree are rejected
+// without changing the tree. Long composite keys (tenant/user/timestamp,
+// 40-80 bytes with long shared prefixes) and keys at the 255-byte cap
+// must survive the splits and merges of random inserts and deletes,
+// which re-encode internal nodes around their shared prefix. Values of
+// 16-64 KB must round-trip through get, multiGet and cursors and give
+// their overflow runs back to the free list when removed. A value of
+// MAX_VALUE_SIZE, far larger than a 64-frame pool, must do the same; one
+// byte more is rejected. Overwrites, by put and multiPut, must keep one
+// record per key and free the runs of the values they replace.
+
+using Rows = std::vector<std::pair<std::string, std::string>>;
+
+static std::string makeKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "k%07d", i);
+    return buf;
+}
+
+static void removeFiles(const std::string& path) {
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+}
+
+// Every 50th value goes to a two-page overflow run.
+static std::string loadValue(int i) {
+    if (i % 50 == 0) return std::string(OVERFLOW_PAYLOAD + 1000, (char)('a' + i % 26));
+    return "value_" + std::to_string(i);
+}
+
+static void checkRows(BPlusTree& db, const Rows& rows) {
+    for (const auto& r : rows) assert(db.get(r.first) == r.second);
+    auto all = db.rangeScan("", "\xff");
+    assert(all == rows);
+    assert(db.checkInvariants());
+}
+
+static void run_bulk_load_test(int count, double fill_factor) {
+    std::cout << "--- bulkLoad of " << count << " rows, fill factor " << fill_factor << " ---" << std::endl;
+    const std::string path = "bplustree.bin";
+    removeFiles(path);
+    Rows rows;
+    for (int i = 0; i < count; ++i) rows.push_back({makeKey(i), loadValue(i)});
+    {
+        BPlusTree db(path);
+        assert(db.bulkLoad(rows.begin(), rows.end(), fill_factor));
+        checkRows(db, rows);
+        double fill = db.leafFill();
+        std::cout << "Leaf fill: " << fill << std::endl;
+        assert(fill <= fill_factor && fill > fill_factor - 0.03);
+    }
+    {
+        BPlusTree db(path);
+        checkRows(db, rows);
+        // The loaded tree takes ordinary writes.
+        db.put(makeKey(count), "after");
+        assert(db.remove(makeKey(0)));
+        assert(db.get(makeKey(count)) == std::optional<std::string>("after") && !db.get(makeKey(0)));
+        assert(db.checkInvariants());
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+static void run_bulk_load_rejects_test() {
+    std::cout << "--- bulkLoad rejects bad input ---" << std::endl;
+    const std::string path = "bplustree.bin";
+    removeFiles(path);
+    Rows rows;
+    for (int i = 0; i < 2000; ++i) rows.push_back({makeKey(i), loadValue(i)});
+    {
+        BPlusTree db(path);
+        Rows unsorted = rows;
+        std::swap(unsorted[700], unsorted[701]);
+        assert(!db.bulkLoad(unsorted.begin(), unsorted.end()));
+        Rows repeated = rows;
+        repeated[1500].first = repeated[1499].first;
+        assert(!db.bulkLoad(repeated.begin(), repeated.end()));
+        Rows long_key = rows;
+        long_key.back().first = std::string(256, 'z'); // one byte over the cap
+        assert(!db.bulkLoad(long_key.begin(), long_key.end()));
+        assert(db.rangeScan("", "\xff").empty());
+
+        // Still empty, so a good load goes through.
+        assert(db.bulkLoad(rows.begin(), rows.end()));
+        checkRows(db, rows);
+        // Now it is not empty any more.
+        Rows more = {{makeKey(5000), "x"}, {makeKey(5001), "y"}};
+        assert(!db.bulkLoad(more.begin(), more.end()));
+        assert(!db.get(makeKey(5000)));
+        checkRows(db, rows);
+    }
+    removeFiles(path);
+    {
+        BPlusTree db(path);
+        db.put(makeKey(1), "put");
+        assert(!db.bulkLoad(rows.begin(), rows.end()));
+        assert(db.rangeScan("", "\xff") == Rows({{makeKey(1), "put"}}));
+        assert(db.checkInvariants());
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// Tenants share a long prefix, users within a tenant a longer one.
+static std::string compositeKey(int i) {
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "tenant/%s/user/%08d/event/%016llu", i % 2 ? "acme-corporation-eu" : "acme-corporation-us",
+                  (i / 2) % 997, (unsigned long long)i * 7919);
+    return buf;
+}
+
+// 255 bytes: one of 16 long prefixes, then a distinguishing tail. Nodes
+// within a group store the prefix once; nodes spanning groups hold
+// separators of nearly full length, a dozen to a page.
+static std::string maxKey(int i) {
+    char tail[16];
+    std::snprintf(tail, sizeof(tail), "%08d", i);
+    return std::string(255 - 8, (char)('a' + i % 16)) + tail;
+}
+
+template <typename KeyOf>
+static void checkKeys(BPlusTree& db, const std::map<std::string, std::string>& model, int count, KeyOf key_of) {
+    for (int i = 0; i < count; ++i) {
+        auto it = model.find(key_of(i));
+        auto v = db.get(key_of(i));
+        assert(it == model.end() ? !v : v == it->second);
+    }
+    assert(db.rangeScan("", "\xff") == Rows(model.begin(), model.end()));
+    assert(db.checkInvariants());
+}
+
+template <typename KeyOf>
+static void run_long_key_test(const char* label, int count, KeyOf key_of) {
+    std::cout << "--- " << label << ": " << count << " keys ---" << std::endl;
+    const std::string path = "bplustree.bin";
+    removeFiles(path);
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(7));
+    std::map<std::string, std::string> model;
+    PoolOptions options;
+    options.sync_commit = false;
+    {
+        BPlusTree db(path, options);
+        for (int i : order) {
+            db.put(key_of(i), "v" + std::to_string(i));
+            model[key_of(i)] = "v" + std::to_string(i);
+        }
+        checkKeys(db, model, count, key_of);
+
+        // Nine in ten go again, so leaves and internal nodes merge.
+        std::shuffle(order.begin(), order.end(), std::mt19937(8));
+        for (int i : order) {
+            if (i % 10 == 0) continue;
+            assert(db.remove(key_of(i)));
+            model.erase(key_of(i));
+        }
+        checkKeys(db, model, count, key_of);
+
+        // Refill part of the gaps, splitting the merged nodes again.
+        for (int i = 1; i < count; i += 3) {
+            if (i % 10 == 0) continue;
+            db.put(key_of(i), "w" + std::to_string(i));
+            model[key_of(i)] = "w" + std::to_string(i);
+        }
+        checkKeys(db, model, count, key_of);
+    }
+    {
+        BPlusTree db(path, options);
+        checkKeys(db, model, count, key_of);
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+static void run_key_cap_test() {
+    std::cout << "--- Keys at the 255-byte cap ---" << std::endl;
+    const std::string path = "bplustree.bin";
+    removeFiles(path);
+    {
+        BPlusTree db(path);
+        std::string at_cap = std::string(255, 'k');
+        std::string over_cap = std::string(256, 'k');
+        db.put(at_cap, "fits");
+        db.put(over_cap, "too long");
+        assert(db.get(at_cap) == std::optional<std::string>("fits"));
+        assert(!db.get(over_cap));
+        assert(db.rangeScan("", "\xff") == Rows({{at_cap, "fits"}}));
+        std::vector<std::pair<std::string, std::string>> batch = {{over_cap, "x"}, {"short", "y"}};
+        db.multiPut(batch);
+        assert(!db.get(over_cap) && db.get("short") == std::optional<std::string>("y"));
+        assert(db.checkInvariants());
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// Each large value has its own length and fill pattern.
+static std::string largeValue(int i) {
+    size_t length = 16 * 1024 + (size_t)i * 7919 % (48 * 1024);
+    std::string value(length, '\0');
+    for (size_t j = 0; j < length; ++j) value[j] = (char)('A' + (i + j / 97) % 26);
+    return value;
+}
+
+static void run_overflow_test(int count) {
+    std::cout << "--- " << count << " values of 16-64 KB ---" << std::endl;
+    const std::string path = "bplustree.bin";
+    removeFiles(path);
+    PoolOptions options;
+    options.sync_commit = false;
+    {
+        BPlusTree db(path, options);
+        // Small records around the large ones keep them in shared leaves.
+        std::vector<std::string> keys;
+        for (int i = 0; i < count; ++i) {
+            db.put(makeKey(2 * i), "small_" + std::to_string(i));
+            db.put(makeKey(2 * i + 1), largeValue(i));
+            keys.push_back(makeKey(2 * i + 1));
+            keys.push_back(makeKey(2 * i));
+        }
+        auto check = [&] {
+            for (int i = 0; i < count; ++i) assert(db.get(makeKey(2 * i + 1)) == largeValue(i));
+            auto values = db.multiGet(keys);
+            for (int i = 0; i < count; ++i) {
+                assert(values[2 * i] == largeValue(i));
+                assert(values[2 * i + 1] == "small_" + std::to_string(i));
+            }
+            auto cur = db.cursor();
+            int n = 0;
+            for (cur.seek(""); cur.valid(); cur.next(), ++n) {
+                assert(cur.key() == makeKey(n));
+                assert(cur.value() == (n % 2 ? largeValue(n / 2) : "small_" + std::to_string(n / 2)));
+            }
+            assert(n == 2 * count);
+            assert(db.checkInvariants());
+        };
+        check();
+
+        // Removing a value frees its whole run; putting it back reuses it.
+        uint64_t free_before = db.poolStats().free_pages;
+        size_t run_pages = 0;
+        for (int i = 0; i < count; i += 2) {
+            assert(db.remove(makeKey(2 * i + 1)));
+            run_pages += (largeValue(i).size() + OVERFLOW_PAYLOAD - 1) / OVERFLOW_PAYLOAD;
+        }
+        uint64_t free_after = db.poolStats().free_pages;
+        assert(free_after >= free_before + run_pages);
+        for (int i = 0; i < count; i += 2) assert(!db.get(makeKey(2 * i + 1)));
+        for (int i = 0; i < count; i += 2) db.put(makeKey(2 * i + 1), largeValue(i));
+        assert(db.poolStats().free_pages + run_pages <= free_after);
+        check();
+    }
+    {
+        BPlusTree db(path, options);
+        for (int i = 0; i < count; ++i) assert(db.get(makeKey(2 * i + 1)) == largeValue(i));
+        assert(db.checkInvariants());
+    }
+    removeFiles(path);
+
+    // The value limit does not depend on the pool: runs are written and
+    // freed a page at a time.
+    options.pool_size = 64;
+    std::string at_limit(MAX_VALUE_SIZE, '\0');
+    for (size_t j = 0; j < at_limit.size(); ++j) at_limit[j] = (char)('a' + j / 4001 % 26);
+    {
+        BPlusTree db(path, options);
+        std::string over_limit(MAX_VALUE_SIZE + 1, 'y');
+        db.put("at_limit", at_limit);
+        db.put("over_limit", over_limit);
+        db.multiPut({{"over_limit_batch", over_limit}, {"small", "z"}});
+        assert(db.get("at_limit") == at_limit);
+        assert(!db.get("over_limit") && !db.get("over_limit_batch"));
+        assert(db.get("small") == std::optional<std::string>("z"));
+        assert(db.checkInvariants());
+    }
+    {
+        BPlusTree db(path, options);
+        assert(db.get("at_limit") == at_limit);
+        uint64_t free_before = db.poolStats().free_pages;
+        assert(db.remove("at_limit"));
+        assert(db.poolStats().free_pages >= free_before + (MAX_VALUE_SIZE + OVERFLOW_PAYLOAD - 1) / OVERFLOW_PAYLOAD);
+        assert(!db.get("at_limit") && db.checkInvariants());
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// Every key is written four times: short values, inline values that fill
+// the leaves until they split, overflow values, then short ones again,
+// alternately with put and multiPut. The tree must keep one record per
+// key, the last value, and the overflow runs of replaced values must go
+// back to the free list.
+static void run_overwrite_test(int count) {
+    std::cout << "--- Overwrites of " << count << " keys ---" << std::endl;
+    const std::string path = "test_bplustree.bin";
+    removeFiles(path);
+    auto valueFor = [](int round, int i) {
+        if (round == 1) return std::string(INLINE_VALUE_MAX, (char)('a' + i % 26));
+        if (round == 2) return largeValue(i);
+        return "r" + std::to_string(round) + "_" + std::to_string(i);
+    };
+    auto check = [&](BPlusTree& db, int round) {
+        auto cur = db.cursor();
+        int n = 0;
+        for (cur.seek(""); cur.valid(); cur.next(), ++n) {
+            assert(cur.key() == makeKey(n) && cur.value() == valueFor(round, n));
+        }
+        assert(n == count);
+        assert(db.checkInvariants());
+    };
+    {
+        BPlusTree db(path);
+        uint64_t free_before = 0;
+        for (int round = 0; round < 4; ++round) {
+            if (round % 2 == 0) {
+                for (int i = 0; i < count; ++i) db.put(makeKey(i), valueFor(round, i));
+            } else {
+                // A key given twice in a batch keeps its later value.
+                Rows batch;
+                for (int i = count - 1; i >= 0; --i) batch.emplace_back(makeKey(i), "stale");
+                for (int i = 0; i < count; ++i) batch.emplace_back(makeKey(i), valueFor(round, i));
+                db.multiPut(batch);
+            }
+            check(db, round);
+            if (round == 2) free_before = db.poolStats().free_pages;
+        }
+        size_t run_pages = 0;
+        for (int i = 0; i < count; ++i) run_pages += (largeValue(i).size() + OVERFLOW_PAYLOAD - 1) / OVERFLOW_PAYLOAD;
+        assert(db.poolStats().free_pages >= free_before + run_pages);
+    }
+    {
+        BPlusTree db(path);
+        check(db, 3);
+    }
+    removeFiles(path);
+    std::cout << "Passed!\n" << std::endl;
+}
+
+int main() {
+    run_bulk_load_test(20000, 0.9);
+    run_bulk_load_test(20000, 0.6);
+    run_bulk_load_rejects_test();
+    run_long_key_test("Composite keys", 60000, compositeKey);
+    run_long_key_test("255-byte keys", 6000, maxKey);
+    run_key_cap_test();
+    run_overflow_test(300);
+    run_overwrite_test(600);
+    return 0;
+}
@@ -0,0 +1,520 @@
+#include "BPlusTree.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Multi-threaded stress test for latch crabbing: writers insert and remove
+// disjoint key ranges (odd writers in batches through multiPut) while
+// readers run point lookups, batched lookups and range scans. The removals
+// empty most leaves, so they are merged concurrently. Afterwards every key
+// must have its expected state and the tree must pass checkInvariants().
+// The stress also runs on the io_uring and fstream backends with a pool
+// small enough that write-back is batched; io_uring is skipped if the
+// kernel refuses to create a ring. A worker that throws is reported and
+// fails the run instead of terminating the binary.
+// A vacuum then runs while writers insert and remove keys; afterwards
+// every key must read back, the file must have shrunk and the leaves must
+// lie in key order. Then a log lost after a checkpoint: a child process
+// fills the gaps between the keys in the checkpointed leaves and exits
+// without a checkpoint, and the reopened tree must redo its commits. Then
+// a crash in the middle of an overflow run: every page of the run must be
+// free again after the reopen, also when the reopen kept the log and
+// committed more txns before crashing in turn. Then a log whose writes
+// fail: nothing past the failure may be reported durable, by the log or
+// by the tree's writes. Last, a data file whose writes fail: the
+// checkpoint must keep the log.
+
+static std::string makeKey(int thread, int i) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "t%02d_%07d", thread, i);
+    return buf;
+}
+
+// Runs the body of a worker thread. An exception is reported and counted
+// rather than escaping the thread, which would std::terminate the binary.
+template <typename Body>
+static void runWorker(const char* role, int id, std::atomic<int>& failures, Body body) {
+    try {
+        body();
+    } catch (const std::exception& e) {
+        std::cerr << role << " " << id << " failed: " << e.what() << std::endl;
+        failures++;
+    }
+}
+
+// False if a worker thread failed.
+static bool run_stress(const char* label, PoolOptions options, int writers, int readers, int per_thread) {
+    std::cout << "--- " << label << ": " << writers << " writers, " << readers
+              << " readers, " << per_thread << " keys each ---" << std::endl;
+    const std::string path = "concurrency.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+
+    {
+        BPlusTree db(path, options);
+        std::atomic<bool> done{false};
+        std::atomic<long> lookups{0};
+        std::atomic<long> scanned{0};
+        std::atomic<int> failures{0};
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < writers; ++t) {
+            threads.emplace_back([&, t] {
+                runWorker("Writer", t, failures, [&] {
+                    std::vector<int> order(per_thread);
+                    for (int i = 0; i < per_thread; ++i) order[i] = i;
+                    std::shuffle(order.begin(), order.end(), std::mt19937(t));
+                    if (t % 2 == 0) {
+                        for (int i : order) db.put(makeKey(t, i), "v" + std::to_string(i));
+                    } else {
+                        std::vector<std::pair<std::string, std::string>> batch;
+                        for (int i : order) {
+                            batch.push_back({makeKey(t, i), "v" + std::to_string(i)});
+                            if (batch.size() == 100) {
+                                db.multiPut(batch);
+                                batch.clear();
+                            }
+                        }
+                        db.multiPut(batch);
+                    }
+                    // All but every fifth key are removed again
+                    for (int i : order) {
+                        if (i % 5 != 0) assert(db.remove(makeKey(t, i)));
+                    }
+                });
+            });
+        }
+        for (int r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                runWorker("Reader", r, failures, [&] {
+                    std::mt19937 rng(1000 + r);
+                    while (!done.load()) {
+                        int t = rng() % writers;
+                        int i = rng() % per_thread;
+                        auto v = db.get(makeKey(t, i));
+                        if (v) assert(*v == "v" + std::to_string(i));
+                        lookups++;
+
+                        std::vector<std::string> keys;
+                        for (int k = 0; k < 20; ++k) keys.push_back(makeKey(t, (i + k * 7) % per_thread));
+                        auto values = db.multiGet(keys);
+                        for (int k = 0; k < 20; ++k) {
+                            if (values[k]) assert(*values[k] == "v" + std::to_string((i + k * 7) % per_thread));
+                        }
+                        lookups += keys.size();
+
+                        auto rows = db.rangeScan(makeKey(t, i), makeKey(t, i + 50));
+                        for (size_t k = 1; k < rows.size(); ++k) assert(rows[k - 1].first <= rows[k].first);
+                        scanned += rows.size();
+                    }
+                });
+            });
+        }
+        for (int t = 0; t < writers; ++t) threads[t].join();
+        done = true;
+        for (size_t t = writers; t < threads.size(); ++t) threads[t].join();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> diff = end - start;
+        if (failures > 0) {
+            std::cout << failures.load() << " worker threads failed\n" << std::endl;
+            return false;
+        }
+
+        int bad = 0;
+        for (int t = 0; t < writers; ++t) {
+            for (int i = 0; i < per_thread; ++i) {
+                auto v = db.get(makeKey(t, i));
+                bool expect = i % 5 == 0;
+                if (expect != (bool)v || (v && *v != "v" + std::to_string(i))) bad++;
+            }
+        }
+        auto all = db.rangeScan(makeKey(0, 0), makeKey(writers, 0));
+        std::cout << "Finished in " << diff.count() << " s, " << lookups.load() << " lookups, "
+                  << scanned.load() << " rows scanned" << std::endl;
+        std::cout << "Wrong keys: " << bad << ", scan returned " << all.size() << std::endl;
+        assert(bad == 0);
+        assert((int)all.size() == writers * ((per_thread + 4) / 5));
+        assert(db.checkInvariants());
+    }
+
+    // Everything committed must be there after reopening.
+    {
+        BPlusTree db(path, options);
+        assert(db.get(makeKey(writers - 1, 5)) == std::optional<std::string>("v5"));
+        assert(!db.get(makeKey(0, 1)));
+        assert(db.checkInvariants());
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::cout << "Passed!\n" << std::endl;
+    return true;
+}
+
+// Whether this kernel lets an IoUringPageIO set up its ring.
+static bool ioUringAvailable() {
+#ifdef FLINTKV_HAVE_IO_URING
+    const std::string path = "concurrency.probe";
+    bool ring = IoUringPageIO(path).usingRing();
+    std::remove(path.c_str());
+    return ring;
+#else
+    return false;
+#endif
+}
+
+// Random inserts leave the leaf chain scattered over db.bin and the
+// removals free most of it. Writers keep changing their own keys during
+// the vacuum's first steps; the rest runs once they have stopped, so
+// that no split lands between the leaves the last pass laid out.
+static void run_vacuum_test(int writers, int per_thread) {
+    std::cout << "--- Vacuum during writes: " << writers << " writers, " << per_thread << " keys each ---" << std::endl;
+    const std::string path = "concurrency.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    PoolOptions options;
+    options.pool_size = 256;
+    options.sync_commit = false;
+    std::vector<std::map<std::string, std::string>> models(writers);
+    BPlusTree::VacuumStats stats;
+    {
+        BPlusTree db(path, options);
+        std::vector<int> order(per_thread);
+        for (int i = 0; i < per_thread; ++i) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(1));
+        for (int i : order) {
+            for (int t = 0; t < writers; ++t) db.put(makeKey(t, i), "v" + std::to_string(i));
+        }
+        for (int i : order) {
+            for (int t = 0; t < writers; ++t) {
+                if (i % 4 != 0) assert(db.remove(makeKey(t, i)));
+                else models[t][makeKey(t, i)] = "v" + std::to_string(i);
+            }
+        }
+
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < writers; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937 rng(100 + t);
+                auto& model = models[t];
+                while (!stop.load()) {
+                    int i = rng() % per_thread;
+                    std::string key = makeKey(t, i);
+                    if (model.count(key)) {
+                        assert(db.remove(key));
+                        model.erase(key);
+                    } else {
+                        db.put(key, "w" + std::to_string(i));
+                        model[key] = "w" + std::to_string(i);
+                    }
+                }
+            });
+        }
+        auto vacuum = db.vacuum();
+        int concurrent_steps = 0;
+        for (; concurrent_steps < 20 && vacuum.step(4); ++concurrent_steps) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        stop = true;
+        for (auto& t : threads) t.join();
+        assert(concurrent_steps == 20 && !vacuum.done());
+        while (vacuum.step(64)) {}
+        stats = vacuum.stats();
+
+        std::cout << "Pages " << stats.pages_before << " -> " << stats.pages_after << ", sequential "
+                  << stats.sequential_before << " -> " << stats.sequential_after << ", "
+                  << stats.pages_moved << " pages moved" << std::endl;
+        assert(db.checkInvariants());
+        size_t live = 0;
+        for (int t = 0; t < writers; ++t) {
+            for (int i = 0; i < per_thread; ++i) {
+                auto it = models[t].find(makeKey(t, i));
+                auto v = db.get(makeKey(t, i));
+                assert(it == models[t].end() ? !v : v == it->second);
+            }
+            live += models[t].size();
+        }
+        assert(db.rangeScan(makeKey(0, 0), makeKey(writers, 0)).size() == live);
+        assert(stats.pages_after < stats.pages_before);
+        assert(stats.sequential_after == 1.0 && db.sequentialLeafRatio() == 1.0);
+    }
+    {
+        BPlusTree db(path, options);
+        struct stat st;
+        assert(::stat(path.c_str(), &st) == 0 && (uint64_t)st.st_size <= (uint64_t)stats.pages_after * PAGE_SIZE);
+        for (int t = 0; t < writers; ++t) {
+            for (const auto& kv : models[t]) assert(db.get(kv.first) == kv.second);
+        }
+        assert(db.checkInvariants() && db.sequentialLeafRatio() == 1.0);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::cout << "Passed!\n" << std::endl;
+}
+
+static void run_lost_log_test() {
+    std::cout << "--- Lost log ---" << std::endl;
+    const std::string path = "concurrency.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    const int count = 2000;
+    {
+        BPlusTree db(path);
+        for (int i = 0; i < count; i += 2) db.put(makeKey(0, i), "v" + std::to_string(i));
+    }
+    std::remove((path + ".wal").c_str());
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        BPlusTree db(path);
+        for (int i = 1; i < count; i += 2) db.put(makeKey(0, i), "v" + std::to_string(i));
+        _exit(0); // a crash: no checkpoint
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        BPlusTree db(path);
+        for (int i = 0; i < count; ++i) assert(db.get(makeKey(0, i)) == "v" + std::to_string(i));
+        assert(db.checkInvariants());
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// A crash while a txn is writing an overflow run: the child writes a run
+// too large for its pool in an open txn, so most of it is written back
+// before the exit, and never commits. In the second round another thread
+// commits a few pages before the crash, and the next session caps the
+// file size, so the checkpoint after its recovery fails and the log is
+// kept. That session commits a few txns and crashes too; their ids must
+// not match the run's, or the last reopen would redo the run.
+static void run_open_run_test() {
+    std::cout << "--- Crash during an overflow run ---" << std::endl;
+    const std::string path = "concurrency.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    PoolOptions options;
+    options.pool_size = 16;
+    // Like an overflow page: a page in use, unless recovery frees it.
+    auto fill = [](char* page, uint32_t, uint32_t i) {
+        ((PageHeader*)page)->free_space_offset = PAGE_SIZE;
+        page[sizeof(PageHeader)] = (char)i;
+    };
+    pid_t pid = fork();
+    if (pid == 0) {
+        BufferPool pool(path, options);
+        TxnScope txn(pool);
+        pool.newRun(64, fill);
+        _exit(0); // a crash: no commit, no checkpoint
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        // Every page that reached the file is free again, bar the meta
+        // page and the page the free list is saved in.
+        BufferPool pool(path, options);
+        uint32_t pages = pool.pageCount();
+        std::cout << pages << " pages in the file, " << pool.stats().free_pages << " free" << std::endl;
+        assert(pages > options.pool_size && pool.stats().free_pages + 2 == pages);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+
+    const int committed = 4;
+    pid = fork();
+    if (pid == 0) {
+        BufferPool pool(path, options);
+        TxnScope txn(pool);
+        pool.newRun(64, fill);
+        std::thread([&] {
+            TxnScope other(pool, 1);
+            for (int i = 0; i < committed; ++i) pool.newPage();
+        }).join();
+        _exit(0); // a crash: the run is still not committed
+    }
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    pid = fork();
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit limit{(rlim_t)PAGE_SIZE, RLIM_INFINITY}; // no page but the meta page can be written
+        setrlimit(RLIMIT_FSIZE, &limit);
+        PoolOptions resident = options;
+        resident.pool_size = 256; // recovery must not need to evict
+        BufferPool pool(path, resident);
+        limit.rlim_cur = RLIM_INFINITY;
+        setrlimit(RLIMIT_FSIZE, &limit);
+        for (int i = 0; i < committed; ++i) {
+            TxnScope txn(pool);
+            PageGuard page = pool.fetchPageForWrite(pool.pageCount() - 1 - i);
+            page.markDirty();
+        }
+        _exit(0); // a crash: the log still holds the run
+    }
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        BufferPool pool(path, options);
+        uint32_t pages = pool.pageCount();
+        std::cout << pages << " pages in the file, " << pool.stats().free_pages << " free" << std::endl;
+        assert(pool.stats().free_pages + 2 + committed == pages);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// The child caps its file size, so log writes past the cap fail.
+static void run_log_failure_test() {
+    std::cout << "--- Failed log writes ---" << std::endl;
+    const std::string path = "concurrency.bin.wal";
+    std::remove(path.c_str());
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        LogManager log(path);
+        std::string page(PAGE_SIZE, 'p');
+        auto appendPage = [&] {
+            return log.append([&](uint64_t lsn, std::string& out) {
+                LogManager::encode(out, LogRecordType::PageImage, lsn, 1, 1, page.data(), PAGE_SIZE);
+            });
+        };
+        uint64_t first = appendPage();
+        if (!log.waitDurable(first)) _exit(1);
+        rlimit limit{(rlim_t)(first + 2 * PAGE_SIZE), RLIM_INFINITY};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        uint64_t end = 0;
+        for (int i = 0; i < 4; ++i) end = appendPage();
+        if (log.waitDurable(end) || !log.hasFailed()) _exit(2);
+        // Later commits fail too, even if they would fit.
+        if (log.waitDurable(appendPage()) || log.flush()) _exit(3);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    std::remove(path.c_str());
+
+    // The tree's writes must not report success past the failure either.
+    const std::string db_path = "concurrency.bin";
+    std::remove(db_path.c_str());
+    pid = fork();
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        BPlusTree db(db_path);
+        db.put(makeKey(0, 0), "v");
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) _exit(1);
+        rlimit limit{(rlim_t)(st.st_size + 4 * PAGE_SIZE), RLIM_INFINITY};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        int i = 1;
+        try {
+            for (; i < 100; ++i) db.put(makeKey(0, i), "v");
+        } catch (const std::runtime_error&) {
+        }
+        if (i == 100) _exit(2);
+        try {
+            db.remove(makeKey(0, 0));
+            _exit(3);
+        } catch (const std::runtime_error&) {
+        }
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    std::remove(db_path.c_str());
+    std::remove(path.c_str());
+    std::cout << "Passed!\n" << std::endl;
+}
+
+// The child caps its file size below what a checkpoint has to write to
+// db.bin: the checkpoint must fail and keep the log, from which the
+// reopened tree redoes every put.
+static void run_data_failure_test() {
+    std::cout << "--- Failed data file writes ---" << std::endl;
+    const std::string path = "concurrency.bin";
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    const int count = 20000, extra = 100;
+    PoolOptions options;
+    options.sync_commit = false;
+    {
+        BPlusTree db(path, options);
+        for (int i = 0; i < count; ++i) db.put(makeKey(0, i), std::string(100, 'v'));
+    }
+    struct stat st;
+    assert(::stat(path.c_str(), &st) == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        BPlusTree db(path, options);
+        rlimit limit{(rlim_t)st.st_size, RLIM_INFINITY};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        for (int i = 0; i < extra; ++i) db.put(makeKey(1, i), std::string(1000, 'w'));
+        if (db.checkpoint()) _exit(1);
+        _exit(0); // a crash: the log is all that holds the puts
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    {
+        BPlusTree db(path, options);
+        for (int i = 0; i < count; i += 97) assert(db.get(makeKey(0, i)) == std::string(100, 'v'));
+        for (int i = 0; i < extra; ++i) assert(db.get(makeKey(1, i)) == std::string(1000, 'w'));
+        assert(db.checkInvariants());
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+    std::cout << "Passed!\n" << std::endl;
+}
+
+int main() {
+    PoolOptions wal;
+    wal.pool_size = 512;
+    wal.sync_commit = false;
+    bool ok = run_stress("WAL, 512 frames", wal, 4, 2, 5000);
+
+    PoolOptions small;
+    small.pool_size = 64;
+    small.enable_wal = false;
+    ok = run_stress("No WAL, 64 frames", small, 4, 2, 5000) && ok;
+
+    PoolOptions mapped = wal;
+    mapped.mmap_reads = true;
+    mapped.policy = ReplacementPolicy::LRUK;
+    ok = run_stress("WAL + mmap reads, LRU-K", mapped, 3, 3, 3000) && ok;
+
+    PoolOptions uring = wal;
+    uring.pool_size = 64;
+    uring.io_backend = IoBackend::IoUring;
+    if (ioUringAvailable()) ok = run_stress("WAL + io_uring, 64 frames", uring, 4, 2, 3000) && ok;
+    else std::cout << "--- WAL + io_uring: skipped, no io_uring ring ---\n" << std::endl;
+
+    PoolOptions fstream = uring;
+    fstream.io_backend = IoBackend::FStream;
+    ok = run_stress("WAL + fstream, 64 frames", fstream, 4, 2, 3000) && ok;
+
+    run_vacuum_test(4, 10000);
+    run_lost_log_test();
+    run_open_run_test();
+    run_log_failure_test();
+    run_data_failure_test();
+    return ok ? 0 : 1;
+}
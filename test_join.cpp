@@ -0,0 +1,167 @@
+#include "Join.h"
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Joins against the same joins over std::map models. Users and orders by
+// user id, the same data in SkipLists and BPlusTrees, with removed users
+// (tombstones in the SkipList) and orders of unknown users: merge joins in
+// every source combination, sequential and split across threads. Then a
+// hash join of purchases on the user id inside their value, again both
+// ways, and the split keys the parallel runs partition by.
+
+static std::string userKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "u%07d", i);
+    return buf;
+}
+
+static void removeFile(const std::string& path) {
+    std::remove(path.c_str());
+    std::remove((path + ".wal").c_str());
+}
+
+using Model = std::map<std::string, std::string>;
+
+static std::vector<JoinedResult> modelJoin(const Model& users, const Model& orders, const std::string& start,
+                                           const std::string& end) {
+    std::vector<JoinedResult> res;
+    for (auto it = users.lower_bound(start); it != users.end() && it->first <= end; ++it) {
+        auto o = orders.find(it->first);
+        if (o != orders.end()) res.push_back({it->first, it->second, o->second});
+    }
+    return res;
+}
+
+static void expectEqual(const std::vector<JoinedResult>& got, const std::vector<JoinedResult>& want) {
+    assert(got.size() == want.size());
+    for (size_t i = 0; i < got.size(); ++i) {
+        assert(got[i].key == want[i].key);
+        assert(got[i].user_info == want[i].user_info);
+        assert(got[i].order_info == want[i].order_info);
+    }
+}
+
+template <typename Source>
+static void checkSplitKeys(Source& source, const std::string& start, const std::string& end, size_t parts) {
+    std::vector<std::string> keys = source.splitKeys(start, end, parts);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        assert(keys[i] > start && keys[i] <= end);
+        if (i > 0) assert(keys[i - 1] < keys[i]);
+    }
+}
+
+template <typename Users, typename Orders>
+static void checkMergeJoins(const char* label, Users& users, Orders& orders, const Model& user_model,
+                            const Model& order_model) {
+    std::cout << "--- Merge join, " << label << " ---" << std::endl;
+    for (auto range : {std::make_pair(std::string(""), std::string("\xff")), std::make_pair(userKey(12345), userKey(34567)),
+                       std::make_pair(userKey(500), userKey(500))}) {
+        auto want = modelJoin(user_model, order_model, range.first, range.second);
+        expectEqual(joinDicts(users, orders, range.first, range.second), want);
+        for (int threads : {1, 2, 4, 7}) expectEqual(parallelMergeJoin(users, orders, range.first, range.second, threads), want);
+    }
+    std::cout << "Passed!" << std::endl;
+}
+
+template <typename Users, typename Purchases>
+static void checkHashJoin(const char* label, Users& users, Purchases& purchases, const Model& user_model,
+                          const Model& purchase_model) {
+    std::cout << "--- Hash join, " << label << " ---" << std::endl;
+    auto userOf = [](std::string_view, std::string_view value) { return value.substr(0, value.find('|')); };
+    std::vector<JoinedResult> want;
+    for (auto& p : purchase_model) {
+        auto u = user_model.find(std::string(userOf(p.first, p.second)));
+        if (u != user_model.end()) want.push_back({p.first, u->second, p.second});
+    }
+
+    HashJoin join;
+    join.build(users);
+    assert(join.size() == user_model.size());
+    std::vector<JoinedResult> got;
+    join.probe(purchases, "", "\xff", userOf, [&](const JoinRow& user, const JoinRow& purchase) {
+        got.push_back({std::string(purchase.key), std::string(user.value), std::string(purchase.value)});
+    });
+    expectEqual(got, want);
+    for (int threads : {2, 4}) expectEqual(join.parallelProbe(purchases, "", "\xff", userOf, threads), want);
+
+    // Built on the value column instead: every purchase per user.
+    HashJoin by_user(userOf);
+    by_user.build(purchases);
+    size_t pairs = 0;
+    by_user.probe(users, "", "\xff", rowKey, [&](const JoinRow& purchase, const JoinRow& user) {
+        assert(purchase.value.substr(0, purchase.value.find('|')) == user.key);
+        pairs++;
+    });
+    assert(pairs == want.size());
+    std::cout << "Passed!" << std::endl;
+}
+
+int main() {
+    const int user_count = 50000;
+    std::mt19937 rng(11);
+    Model user_model, order_model, purchase_model;
+    for (int i = 0; i < user_count; ++i) {
+        if (rng() % 5 == 0) continue;
+        user_model[userKey(i)] = "name" + std::to_string(i);
+    }
+    for (int i = 0; i < user_count + 1000; ++i) {
+        if (rng() % 2 == 0) order_model[userKey(i)] = "order" + std::to_string(rng() % 1000);
+    }
+    for (int i = 0; i < 30000; ++i) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "p%07d", i);
+        purchase_model[buf] = userKey(rng() % (user_count + 1000)) + "|item" + std::to_string(i);
+    }
+
+    SkipList users, orders, purchases;
+    const std::string user_path = "join_users.bin", order_path = "join_orders.bin", purchase_path = "join_purchases.bin";
+    removeFile(user_path);
+    removeFile(order_path);
+    removeFile(purchase_path);
+    {
+        BPlusTree user_tree(user_path), order_tree(order_path), purchase_tree(purchase_path);
+        // Every user goes in, the missing ones are removed again.
+        for (int i = 0; i < user_count; ++i) {
+            std::string name = "name" + std::to_string(i);
+            users.put(userKey(i), name);
+            user_tree.put(userKey(i), name);
+            if (!user_model.count(userKey(i))) {
+                users.remove(userKey(i));
+                user_tree.remove(userKey(i));
+            }
+        }
+        for (auto& kv : order_model) {
+            orders.put(kv.first, kv.second);
+            order_tree.put(kv.first, kv.second);
+        }
+        for (auto& kv : purchase_model) {
+            purchases.put(kv.first, kv.second);
+            purchase_tree.put(kv.first, kv.second);
+        }
+
+        for (size_t parts : {2, 4, 64, 100000}) {
+            checkSplitKeys(users, "", "\xff", parts);
+            checkSplitKeys(user_tree, "", "\xff", parts);
+            checkSplitKeys(users, userKey(100), userKey(900), parts);
+            checkSplitKeys(user_tree, userKey(100), userKey(900), parts);
+        }
+        assert(user_tree.splitKeys("", "\xff", 4).size() >= 3);
+        assert(users.splitKeys("", "\xff", 4).size() >= 3);
+
+        checkMergeJoins("SkipList x SkipList", users, orders, user_model, order_model);
+        checkMergeJoins("BPlusTree x SkipList", user_tree, orders, user_model, order_model);
+        checkMergeJoins("BPlusTree x BPlusTree", user_tree, order_tree, user_model, order_model);
+        checkHashJoin("SkipList", users, purchases, user_model, purchase_model);
+        checkHashJoin("BPlusTree", user_tree, purchase_tree, user_model, purchase_model);
+    }
+    removeFile(user_path);
+    removeFile(order_path);
+    removeFile(purchase_path);
+    std::cout << "\nAll join tests completed successfully!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,458 @@
+#include "LSMTree.h"
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// An SSTable on its own: point gets read at most one block and none for
+// keys the filter or key range rules out. Then LSMTree against a std::map
+// model: random puts, overwrites and deletes with a small memtable and
+// small levels, so that tables are flushed and compacted down several
+// levels, then range scans and a reopen that must recover the same
+// contents, and a reopen on a damaged manifest that must delete nothing. A
+// flush that cannot write its table must report it. Snapshots and merges
+// are checked against copies of the model, and merges that grow past the
+// value size limit. A last run has writers and readers on disjoint keys in
+// parallel with rate-limited compactions, while a snapshot of each reader
+// must read the same throughout.
+
+static std::string makeKey(int i) {
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "k%07d", i);
+    return buf;
+}
+
+static void clearDir(const std::string& dir) {
+    std::system(("rm -rf " + dir).c_str());
+}
+
+static void run_sstable_test(int count) {
+    std::cout << "--- SSTable with " << count << " keys ---" << std::endl;
+    const std::string path = "test.sst";
+    {
+        SSTableWriter writer(path);
+        for (int i = 0; i < count; ++i) writer.add(makeKey(2 * i + 1), i + 1, ValueType::Value, "value_" + std::to_string(i));
+        assert(writer.finish());
+    }
+    auto table = SSTable::open(path);
+    assert(table && table->count() == (uint64_t)count);
+    assert(table->smallest() == makeKey(1) && table->largest() == makeKey(2 * count - 1));
+
+    std::string value;
+    ValueType type;
+    uint64_t before = table->blockReads();
+    for (int i = 0; i < count; ++i) {
+        assert(table->get(makeKey(2 * i + 1), MAX_SEQUENCE, type, value) && value == "value_" + std::to_string(i));
+        assert(type == ValueType::Value && table->blockReads() == before + i + 1);
+    }
+    // Absent keys inside the range only read a block on a filter false positive
+    before = table->blockReads();
+    for (int i = 0; i < count; ++i) assert(!table->get(makeKey(2 * i), MAX_SEQUENCE, type, value));
+    double false_positives = (double)(table->blockReads() - before) / count;
+    std::cout << "Filter false positive rate: " << false_positives * 100 << "%" << std::endl;
+    assert(false_positives < 0.03);
+    before = table->blockReads();
+    assert(!table->get(makeKey(2 * count + 1), MAX_SEQUENCE, type, value) && !table->get("a", MAX_SEQUENCE, type, value));
+    assert(table->blockReads() == before);
+
+    SSTable::Iterator it(*table);
+    int n = 0;
+    for (it.seekToFirst(); it.valid(); it.next()) assert(it.key() == makeKey(2 * n++ + 1));
+    assert(n == count);
+    for (int i = 0; i < 2 * count; i += 997) {
+        it.seek(makeKey(i));
+        assert(it.valid() && it.key() == makeKey(i | 1));
+    }
+    it.seek(makeKey(2 * count));
+    assert(!it.valid());
+
+    // Many versions of one key span several blocks; a read at sequence
+    // number s sees the newest version <= s.
+    {
+        SSTableWriter writer(path);
+        writer.add("a", 1, ValueType::Value, "a");
+        for (int v = 2000; v >= 2; v -= 2) {
+            writer.add("hot", v, v % 10 == 0 ? ValueType::Delete : ValueType::Value, std::string(20, 'x') + std::to_string(v));
+        }
+        writer.add("z", 1, ValueType::Value, "z");
+        assert(writer.finish());
+    }
+    table = SSTable::open(path);
+    assert(table && table->count() == 1002);
+    for (uint64_t s = 1; s <= 2001; s += 7) {
+        bool found = table->get("hot", s, type, value);
+        uint64_t v = s & ~1ull;
+        assert(found == (v >= 2));
+        if (found && v % 10 == 0) assert(type == ValueType::Delete);
+        if (found && v % 10 != 0) assert(type == ValueType::Value && value == std::string(20, 'x') + std::to_string(v));
+    }
+    it = SSTable::Iterator(*table);
+    it.seek("hot", 1);
+    assert(it.valid() && it.key() == "z");
+    std::remove(path.c_str());
+    std::cout << "Passed!" << std::endl;
+}
+
+static void check(LSMTree& db, const std::map<std::string, std::string>& model, int key_space) {
+    for (int i = 0; i < key_space; ++i) {
+        auto it = model.find(makeKey(i));
+        auto got = db.get(makeKey(i));
+        assert(got.has_value() == (it != model.end()));
+        if (got) assert(*got == it->second);
+    }
+    std::mt19937 rng(1);
+    for (int s = 0; s < 50; ++s) {
+        int a = rng() % key_space, b = a + rng() % 500;
+        auto res = db.rangeScan(makeKey(a), makeKey(b));
+        auto it = model.lower_bound(makeKey(a));
+        for (auto& kv : res) {
+            assert(it != model.end() && kv.first == it->first && kv.second == it->second);
+            ++it;
+        }
+        assert(it == model.end() || it->first > makeKey(b));
+    }
+}
+
+static void run_model_test() {
+    std::cout << "--- LSMTree vs std::map ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    LSMOptions options;
+    options.memtable_bytes = 128 << 10;
+    options.level_base_bytes = 512 << 10;
+    options.level_multiplier = 4;
+    options.target_file_bytes = 128 << 10;
+    std::map<std::string, std::string> model;
+    const int key_space = 20000;
+    std::mt19937 rng(42);
+    {
+        LSMTree db(dir, options);
+        for (int op = 0; op < 100000; ++op) {
+            std::string key = makeKey(rng() % key_space);
+            if (rng() % 4 == 0) {
+                bool present = model.erase(key) > 0;
+                assert(db.remove(key) == present);
+            } else {
+                std::string value = "v" + std::to_string(op) + std::string(rng() % 64, 'x');
+                db.put(key, value);
+                model[key] = value;
+            }
+        }
+        check(db, model, key_space);
+        db.waitForCompactions();
+        assert(db.checkInvariants());
+        check(db, model, key_space);
+        std::cout << "Tables per level:";
+        for (size_t n : db.tablesPerLevel()) std::cout << " " << n;
+        std::cout << std::endl;
+        assert(db.tablesPerLevel()[0] < options.l0_compaction_trigger && db.tablesPerLevel()[2] > 0);
+    }
+    {
+        LSMTree db(dir, options);
+        assert(db.checkInvariants());
+        check(db, model, key_space);
+    }
+    std::cout << "Recovered " << model.size() << " keys." << std::endl;
+    clearDir(dir);
+}
+
+// A manifest that is not one, or that lists a table that is gone, must
+// fail the open and leave every table in place; tables it does not list
+// are deleted.
+static void run_recovery_test() {
+    std::cout << "--- Recovery from a damaged manifest ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    {
+        LSMTree db(dir);
+        for (int i = 0; i < 1000; ++i) db.put(makeKey(i), "v");
+    }
+    auto opens = [&] {
+        try {
+            LSMTree db(dir);
+            return db.get(makeKey(7)).has_value();
+        } catch (const std::runtime_error& e) {
+            std::cout << "Refused: " << e.what() << std::endl;
+            return false;
+        }
+    };
+    auto exists = [](const std::string& path) { return ::access(path.c_str(), F_OK) == 0; };
+    const std::string table = dir + "/000001.sst", manifest = dir + "/MANIFEST";
+    assert(exists(table));
+
+    std::rename(manifest.c_str(), (manifest + ".good").c_str());
+    if (FILE* f = std::fopen(manifest.c_str(), "wb")) {
+        std::fputs("garbage that is long enough to hold a header", f);
+        std::fclose(f);
+    }
+    assert(!opens() && exists(table));
+    std::rename((manifest + ".good").c_str(), manifest.c_str());
+
+    std::rename(table.c_str(), (table + ".moved").c_str());
+    assert(!opens());
+    std::rename((table + ".moved").c_str(), table.c_str());
+
+    const std::string orphan = dir + "/000099.sst";
+    std::fclose(std::fopen(orphan.c_str(), "wb"));
+    assert(opens() && exists(table) && !exists(orphan));
+    std::cout << "Passed!" << std::endl;
+    clearDir(dir);
+}
+
+// The child caps its file size below a table's: flush() must report the
+// failure instead of waiting for it, and the destructor must return.
+static void run_flush_failure_test() {
+    std::cout << "--- Failed flushes ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit limit{4096, RLIM_INFINITY};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        {
+            LSMTree db(dir);
+            for (int i = 0; i < 1000; ++i) db.put(makeKey(i), std::string(100, 'v'));
+            if (db.flush()) _exit(1);
+            if (*db.get(makeKey(7)) != std::string(100, 'v')) _exit(2);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    std::cout << "Passed!" << std::endl;
+    clearDir(dir);
+}
+
+// Snapshots against copies of a std::map model taken at the same time,
+// with merges (comma-separated appends) mixed into the writes. The
+// snapshots must read the same before and after the tables under them are
+// compacted, and release lets compaction drop what they pinned. So must a
+// cursor and a limited query opened on one.
+static void run_snapshot_test() {
+    std::cout << "--- Snapshots and merges ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    LSMOptions options;
+    options.memtable_bytes = 64 << 10;
+    options.level_base_bytes = 256 << 10;
+    options.level_multiplier = 4;
+    options.target_file_bytes = 64 << 10;
+    options.merge_operator = [](const std::string&, const std::optional<std::string>& existing,
+                                const std::string& operand) { return existing ? *existing + "," + operand : operand; };
+    using Model = std::map<std::string, std::string>;
+    const int key_space = 5000;
+    std::mt19937 rng(7);
+    Model model;
+    auto writeSome = [&](LSMTree& db, int ops) {
+        for (int op = 0; op < ops; ++op) {
+            std::string key = makeKey(rng() % key_space);
+            int kind = rng() % 8;
+            if (kind == 0) {
+                db.remove(key);
+                model.erase(key);
+            } else if (kind < 4) {
+                std::string operand = "m" + std::to_string(op % 100);
+                db.merge(key, operand);
+                auto it = model.find(key);
+                model[key] = it == model.end() ? operand : it->second + "," + operand;
+            } else {
+                std::string value = "v" + std::to_string(op) + std::string(rng() % 32, 'x');
+                db.put(key, value);
+                model[key] = value;
+            }
+        }
+    };
+    auto checkAt = [&](LSMTree& db, const Model& m, const SnapshotPtr& snap) {
+        for (int i = 0; i < key_space; i += 7) {
+            auto it = m.find(makeKey(i));
+            auto got = db.get(makeKey(i), snap);
+            assert(got.has_value() == (it != m.end()));
+            if (got) assert(*got == it->second);
+        }
+        auto res = db.rangeScan(makeKey(0), makeKey(key_space), snap);
+        assert(res.size() == m.size());
+        auto it = m.begin();
+        for (auto& kv : res) {
+            assert(kv.first == it->first && kv.second == it->second);
+            ++it;
+        }
+    };
+    {
+        LSMTree db(dir, options);
+        writeSome(db, 20000);
+        SnapshotPtr first = db.snapshot();
+        Model first_model = model;
+        writeSome(db, 20000);
+        SnapshotPtr second = db.snapshot();
+        Model second_model = model;
+        // A query at a snapshot runs later and still sees its data.
+        auto merged = db.query(first).where([](const std::string&, const std::string& v) {
+            return v.find(',') != std::string::npos;
+        });
+        writeSome(db, 20000);
+
+        checkAt(db, first_model, first);
+        checkAt(db, second_model, second);
+        checkAt(db, model, nullptr);
+        db.waitForCompactions();
+        assert(db.checkInvariants());
+        checkAt(db, first_model, first);
+        checkAt(db, second_model, second);
+        checkAt(db, model, nullptr);
+        size_t expected = 0;
+        for (auto& kv : first_model) expected += kv.second.find(',') != std::string::npos;
+        assert(merged.execute().size() == expected);
+        auto limited = db.query(second).select(makeKey(100), makeKey(key_space)).limit(10).execute();
+        auto want = second_model.lower_bound(makeKey(100));
+        assert(limited.size() == 10);
+        for (auto& kv : limited) assert(kv.first == want->first && kv.second == (want++)->second);
+
+        // A cursor keeps reading its memtables and tables while newer
+        // writes flush and compact them away.
+        LSMTree::Cursor cursor = db.scan(makeKey(0), makeKey(key_space), second);
+        auto expect = second_model.begin();
+        for (int i = 0; i < 100; ++i, ++expect, cursor.next()) assert(cursor.key() == expect->first);
+        first.reset();
+        writeSome(db, 20000);
+        db.waitForCompactions();
+        for (; cursor.valid(); ++expect, cursor.next()) {
+            assert(cursor.key() == expect->first && cursor.value() == expect->second);
+        }
+        assert(expect == second_model.end());
+        checkAt(db, second_model, second);
+        checkAt(db, model, nullptr);
+    }
+    {
+        LSMTree db(dir, options);
+        checkAt(db, model, nullptr);
+        // Sequence numbers continue after a reopen.
+        SnapshotPtr snap = db.snapshot();
+        Model before = model;
+        writeSome(db, 5000);
+        checkAt(db, before, snap);
+        checkAt(db, model, nullptr);
+    }
+    std::cout << "Passed!" << std::endl;
+    clearDir(dir);
+}
+
+// A merge whose folded result is larger than a record may be stays
+// unfolded in flushes and compactions and still reads back whole. A
+// writer refuses a record it cannot store instead of truncating it.
+static void run_large_merge_test() {
+    std::cout << "--- Merges past the value size limit ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    {
+        SSTableWriter writer(dir + ".sst");
+        assert(writer.add("a", 1, ValueType::Value, std::string(100000, 'v')));
+        assert(!writer.add(std::string(70000, 'k'), 1, ValueType::Value, "v"));
+        assert(!writer.finish());
+        std::remove((dir + ".sst").c_str());
+    }
+    LSMOptions options;
+    options.l0_compaction_trigger = 2; // the second flush compacts
+    options.merge_operator = [](const std::string&, const std::optional<std::string>& existing,
+                                const std::string& operand) { return existing ? *existing + operand : operand; };
+    const std::string big(40000, 'a'), operand(40000, 'b');
+    {
+        LSMTree db(dir, options);
+        db.put("k", big);
+        db.merge("k", operand);
+        db.merge("small", "x");
+        db.merge("small", "y");
+        assert(db.get("k")->size() == 80000);
+        db.flush();
+        assert(*db.get("k") == big + operand);
+        assert(*db.get("small") == "xy");
+    }
+    {
+        LSMTree db(dir, options);
+        assert(*db.get("k") == big + operand);
+        db.merge("k", "c");
+        db.flush();
+        db.waitForCompactions();
+        assert(*db.get("k") == big + operand + "c");
+    }
+    std::cout << "Passed!" << std::endl;
+    clearDir(dir);
+}
+
+static void run_concurrent_test(int writers, int readers, int per_thread) {
+    std::cout << "--- " << writers << " writers, " << readers << " readers ---" << std::endl;
+    const std::string dir = "lsm_test";
+    clearDir(dir);
+    LSMOptions options;
+    options.memtable_bytes = 256 << 10;
+    options.level_base_bytes = 1 << 20;
+    options.target_file_bytes = 256 << 10;
+    options.compaction_bytes_per_sec = 16 << 20;
+    {
+        LSMTree db(dir, options);
+        std::atomic<bool> done{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < writers; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < per_thread; ++i) db.put(makeKey(t * per_thread + i), "v" + std::to_string(i));
+                for (int i = 0; i < per_thread; i += 3) db.remove(makeKey(t * per_thread + i));
+            });
+        }
+        for (int r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                std::mt19937 rng(r);
+                // What a snapshot sees does not change under writes,
+                // flushes and compactions.
+                SnapshotPtr snap = db.snapshot();
+                auto pinned = db.rangeScan(makeKey(0), makeKey(writers * per_thread), snap);
+                while (!done) {
+                    assert(db.rangeScan(makeKey(0), makeKey(writers * per_thread), snap) == pinned);
+                    int i = rng() % (writers * per_thread);
+                    auto v = db.get(makeKey(i));
+                    if (v) assert(*v == "v" + std::to_string(i % per_thread));
+                    auto res = db.rangeScan(makeKey(i), makeKey(i + 100));
+                    for (size_t k = 1; k < res.size(); ++k) assert(res[k - 1].first < res[k].first);
+                }
+            });
+        }
+        for (int t = 0; t < writers; ++t) threads[t].join();
+        done = true;
+        for (size_t t = writers; t < threads.size(); ++t) threads[t].join();
+
+        for (int i = 0; i < writers * per_thread; ++i) {
+            auto v = db.get(makeKey(i));
+            assert(v.has_value() == ((i % per_thread) % 3 != 0));
+        }
+        db.waitForCompactions();
+        assert(db.checkInvariants());
+        for (int i = 0; i < writers * per_thread; ++i) {
+            assert(db.get(makeKey(i)).has_value() == ((i % per_thread) % 3 != 0));
+        }
+    }
+    std::cout << "Passed!" << std::endl;
+    clearDir(dir);
+}
+
+int main() {
+    run_sstable_test(50000);
+    run_model_test();
+    run_recovery_test();
+    run_flush_failure_test();
+    run_snapshot_test();
+    run_large_merge_test();
+    run_concurrent_test(4, 2, 20000);
+    std::cout << "\nAll LSMTree tests completed successfully!" << std::endl;
+    return 0;
+}
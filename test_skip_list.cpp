@@ -1,6 +1,10 @@
+#include "Join.h"
 #include "SkipList.h"
+#include "ConcurrentSkipList.h"
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <cassert>
 
@@ -135,6 +139,81 @@ void run_join_test() {
     std::cout << "Join test passed!\n" << std::endl;
 }
 
+// Writers insert disjoint keys and keep overwriting a few shared ones
+// while readers seek. Afterwards every key is present, the list is sorted
+// by key with the versions of a key newest first, and each shared key
+// ends with the last value some writer put. Writers also read back
+// their own earlier keys. A delete is a newer record and leaves the older
+// version readable at its sequence number.
+void run_concurrent_test(int writers, int per_writer) {
+    std::cout << "--- Running Concurrent SkipList Test (" << writers << " writers) ---" << std::endl;
+    ConcurrentSkipList list;
+    std::atomic<uint64_t> seq{0};
+    auto put = [&](const std::string& key, const std::string& value) {
+        list.add(key, seq.fetch_add(1) + 1, ValueType::Value, value);
+    };
+    auto get = [&](const std::string& key, std::string& value) {
+        const ConcurrentSkipList::Node* n = list.find(key);
+        if (n) value = n->value();
+        return n != nullptr;
+    };
+    std::atomic<bool> done{false};
+    std::atomic<int> misses{0};
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w] {
+            std::string value;
+            for (int i = 0; i < per_writer; ++i) {
+                put("key_" + std::to_string(w) + "_" + std::to_string(i), "val_" + std::to_string(i));
+                put("shared_" + std::to_string(i % 8), std::to_string(w) + ":" + std::to_string(i));
+                // An earlier put of this writer stays visible while others insert.
+                if (!get("key_" + std::to_string(w) + "_" + std::to_string(i / 2), value)) misses++;
+            }
+        });
+    }
+    std::thread reader([&] {
+        while (!done) {
+            std::string value;
+            // key_0_0 is the first key of writer 0; once seen it stays.
+            if (get("key_0_0", value) && value != "val_0") misses++;
+            const ConcurrentSkipList::Node* n = list.seek("key_");
+            for (int steps = 0; n && steps < 100; ++steps, n = n->next()) {
+                const ConcurrentSkipList::Node* next = n->next();
+                if (next && next->key() < n->key()) misses++;
+            }
+        }
+    });
+    for (auto& t : threads) t.join();
+    done = true;
+    reader.join();
+    assert(misses == 0);
+
+    assert(list.size() == (size_t)writers * per_writer * 2);
+    std::string value;
+    for (int w = 0; w < writers; ++w) {
+        for (int i = 0; i < per_writer; ++i) {
+            assert(get("key_" + std::to_string(w) + "_" + std::to_string(i), value));
+            assert(value == "val_" + std::to_string(i));
+        }
+    }
+    for (const ConcurrentSkipList::Node* n = list.first(); n && n->next(); n = n->next()) {
+        const ConcurrentSkipList::Node* next = n->next();
+        assert(n->key() < next->key() || (n->key() == next->key() && n->seq > next->seq));
+    }
+    // The newest version of a shared key is some writer's last put of it.
+    for (int k = 0; k < 8; ++k) {
+        assert(get("shared_" + std::to_string(k), value));
+        int i = std::stoi(value.substr(value.find(':') + 1));
+        assert(i % 8 == k && i + 8 >= per_writer);
+    }
+    list.add("key_0_0", seq + 1, ValueType::Delete, "");
+    assert(list.find("key_0_0")->type == ValueType::Delete);
+    assert(list.find("key_0_0", seq)->value() == "val_0");
+
+    std::cout << "Concurrent tests passed!\n" << std::endl;
+}
+
 int main() {
     try {
         run_basic_test();
@@ -142,6 +221,7 @@ int main() {
         run_persistence_test();
         test_query_engine();
         run_join_test();
+        run_concurrent_test(4, 20000);
         
         std::cout << "\nAll SkipList tests completed successfully!" << std::endl;
     } catch (const std::exception& e) {